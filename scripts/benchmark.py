@@ -56,6 +56,14 @@ SCENARIOS = [
         )
         for i in (1, 10, 100, 1000)
     ],
+    *[
+        (
+            "austin",
+            f"Deep recursion [depth: {n}]",
+            ["-Pi", "100", sys.executable, target("recursive.py"), str(n)],
+        )
+        for n in (100, 1000, 2000)
+    ],
 ]
 
 
@@ -17,14 +17,16 @@ import common
 import numpy as np
 from scipy.stats import f
 
-from austin.format.mojo import (
-    MojoFile,
-    MojoStack,
-    MojoFrameReference,
-    MojoMetric,
+from test.utils import (
+    MOJO_FRAME_REF,
+    MOJO_METRIC_MEMORY,
+    MOJO_METRIC_TIME,
+    MOJO_STACK,
     MojoFrame,
+    parse_mojo,
+    python,
+    target,
 )
-from test.utils import python, target
 
 Scenario = namedtuple("Scenario", ["title", "variant", "args"])
 
@@ -140,8 +142,8 @@ class AustinFlameGraph(dict):
         def serialize(frame: MojoFrame) -> str:
             return ":".join(
                 (
-                    frame.filename.string.value,
-                    frame.scope.string.value,
+                    frame.filename,
+                    frame.scope,
                     str(frame.line),
                     str(frame.line_end),
                     str(frame.column),
@@ -149,16 +151,16 @@ class AustinFlameGraph(dict):
                 )
             )
 
-        for e in MojoFile(BytesIO(data)).parse():
-            if isinstance(e, MojoStack):
+        for e, *args in parse_mojo(BytesIO(data)):
+            if e == MOJO_STACK:
                 if stack:
                     fg += cls({";".join(stack): metric})
                 stack.clear()
                 metric = 0
-            elif isinstance(e, MojoFrameReference):
-                stack.append(serialize(e.frame))
-            elif isinstance(e, MojoMetric):
-                metric = e.value
+            elif e == MOJO_FRAME_REF:
+                stack.append(serialize(args[0]))
+            elif e in (MOJO_METRIC_TIME, MOJO_METRIC_MEMORY):
+                metric = args[0]
 
         return fg
 
@@ -0,0 +1,315 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "aggregate.h"
+#include "events.h"
+#include "hints.h"
+#include "logging.h"
+#include "mojo.h"
+
+
+// ---- PRIVATE ---------------------------------------------------------------
+
+// The memory used by the profiles of all the processes. Processes can be
+// sampled by different threads, so this is updated atomically.
+static size_t _aggregate_memory = 0;
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_aggregate_reserve(size_t size) {
+  if (__atomic_add_fetch(&_aggregate_memory, size, __ATOMIC_RELAXED) > AGGREGATE_MAX_MEMORY) {
+    __atomic_sub_fetch(&_aggregate_memory, size, __ATOMIC_RELAXED);
+    FAIL;
+  }
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+#define _aggregate_release(size) \
+  { __atomic_sub_fetch(&_aggregate_memory, (size), __ATOMIC_RELAXED); }
+
+
+// ----------------------------------------------------------------------------
+#define _aggregate_entry__memory(entry) \
+  (sizeof(aggregate_entry_t) + (entry)->size * sizeof(key_dt) + (isvalid((entry)->text) ? strlen((entry)->text) + 1 : 0))
+
+
+// ----------------------------------------------------------------------------
+#define _fnv(hash, value) (((hash) ^ (uint64_t) (value)) * 0x100000001b3ull)
+
+static inline uint64_t
+_aggregate_sample__hash(aggregate_sample_t * sample) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+
+  hash = _fnv(hash, sample->pid);
+  hash = _fnv(hash, sample->iid);
+  hash = _fnv(hash, sample->tid);
+  hash = _fnv(hash, sample->idle | (sample->gc << 1) | (sample->invalid << 2));
+  for (size_t i = 0; i < sample->size; i++)
+    hash = _fnv(hash, sample->keys[i]);
+
+  return hash;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_aggregate_entry__is_of(aggregate_entry_t * self, uint64_t hash, aggregate_sample_t * sample) {
+  return self->hash == hash
+    && self->pid == sample->pid
+    && self->iid == sample->iid
+    && self->tid == sample->tid
+    && self->idle == sample->idle
+    && self->gc == sample->gc
+    && self->invalid == sample->invalid
+    && self->size == sample->size
+    && memcmp(self->keys, sample->keys, sample->size * sizeof(key_dt)) == 0;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline aggregate_entry_t **
+_aggregate__find_slot(aggregate_entry_t ** slots, size_t mask, uint64_t hash, aggregate_sample_t * sample) {
+  size_t index = hash & mask;
+
+  for (;;) {
+    aggregate_entry_t ** slot = slots + index;
+    if (!isvalid(*slot) || (isvalid(sample) && _aggregate_entry__is_of(*slot, hash, sample)))
+      return slot;
+
+    index = (index + 1) & mask;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_aggregate__grow(aggregate_t * self) {
+  size_t capacity = self->capacity << 1;
+
+  if (fail(_aggregate_reserve(capacity * sizeof(aggregate_entry_t *))))
+    FAIL;
+
+  aggregate_entry_t ** slots = (aggregate_entry_t **) calloc(capacity, sizeof(aggregate_entry_t *));
+  if (!isvalid(slots)) {
+    _aggregate_release(capacity * sizeof(aggregate_entry_t *));
+    FAIL;
+  }
+
+  for (size_t i = 0; i < self->capacity; i++) {
+    aggregate_entry_t * entry = self->slots[i];
+    if (isvalid(entry))
+      *_aggregate__find_slot(slots, capacity - 1, entry->hash, NULL) = entry;
+  }
+
+  free(self->slots);
+  _aggregate_release(self->capacity * sizeof(aggregate_entry_t *));
+
+  self->slots    = slots;
+  self->capacity = capacity;
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_aggregate_entry__emit(aggregate_entry_t * self) {
+  emit_stack(pargs.head_format, self->pid, self->iid, self->tid, "", "");
+
+  for (int i = 0; i < self->invalid; i++)
+    emit_invalid_frame();
+
+  if (pargs.binary) {
+    for (size_t i = 0; i < self->size; i++) {
+      mojo_event(MOJO_FRAME_REF);
+      mojo_integer(self->keys[i], 0);
+    }
+  }
+  else if (isvalid(self->text)) {
+    fputs(self->text, output_stream());
+  }
+
+  if (self->gc)
+    emit_gc();
+
+  if (pargs.full) {
+    emit_full_metrics(self->time, self->idle, self->memory);
+  }
+  else {
+    if (pargs.memory) {
+      emit_memory_metric(self->memory);
+    } else {
+      emit_time_metric(self->time);
+    }
+  }
+}
+
+
+// ---- PUBLIC ----------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+aggregate_t *
+aggregate_new(void) {
+  if (fail(_aggregate_reserve(sizeof(aggregate_t) + AGGREGATE_INITIAL_CAPACITY * sizeof(aggregate_entry_t *))))
+    return NULL;
+
+  aggregate_t * self = (aggregate_t *) calloc(1, sizeof(aggregate_t));
+  if (!isvalid(self))
+    goto error;
+
+  self->slots = (aggregate_entry_t **) calloc(AGGREGATE_INITIAL_CAPACITY, sizeof(aggregate_entry_t *));
+  if (!isvalid(self->slots))
+    goto error;
+
+  self->capacity = AGGREGATE_INITIAL_CAPACITY;
+  self->flushed  = gettime();
+
+  return self;
+
+error:
+  sfree(self);
+  _aggregate_release(sizeof(aggregate_t) + AGGREGATE_INITIAL_CAPACITY * sizeof(aggregate_entry_t *));
+  return NULL;
+}
+
+
+// ----------------------------------------------------------------------------
+int
+aggregate__add(
+  aggregate_t        * self,
+  aggregate_sample_t * sample,
+  ctime_t              time,
+  ssize_t              memory,
+  aggregate_render_t   render
+) {
+  uint64_t             hash  = _aggregate_sample__hash(sample);
+  aggregate_entry_t ** slot  = _aggregate__find_slot(self->slots, self->capacity - 1, hash, sample);
+  aggregate_entry_t  * entry = *slot;
+
+  if (!isvalid(entry)) {
+    // Keep the table at most half full.
+    if ((self->size + 1) << 1 > self->capacity) {
+      if (fail(_aggregate__grow(self)))
+        goto drop;
+      slot = _aggregate__find_slot(self->slots, self->capacity - 1, hash, sample);
+    }
+
+    size_t size = sizeof(aggregate_entry_t) + sample->size * sizeof(key_dt);
+    if (fail(_aggregate_reserve(size)))
+      goto drop;
+
+    entry = (aggregate_entry_t *) malloc(size);
+    if (!isvalid(entry)) {
+      _aggregate_release(size);
+      goto drop;
+    }
+
+    entry->hash    = hash;
+    entry->pid     = sample->pid;
+    entry->iid     = sample->iid;
+    entry->tid     = sample->tid;
+    entry->idle    = sample->idle;
+    entry->gc      = sample->gc;
+    entry->invalid = sample->invalid;
+    entry->time    = 0;
+    entry->memory  = 0;
+    entry->size    = sample->size;
+    memcpy(entry->keys, sample->keys, sample->size * sizeof(key_dt));
+
+    // The rendered frames might take us slightly over the memory limit, which
+    // is then enforced on the next new entry.
+    entry->text = isvalid(render) ? render() : NULL;
+    if (isvalid(entry->text))
+      __atomic_add_fetch(&_aggregate_memory, strlen(entry->text) + 1, __ATOMIC_RELAXED);
+
+    *slot = entry;
+    self->size++;
+  }
+
+  entry->time   += time;
+  entry->memory += memory;
+
+  SUCCESS;
+
+drop:
+  self->dropped++;
+  self->dropped_time   += time;
+  self->dropped_memory += memory;
+
+  FAIL;
+}
+
+
+// ----------------------------------------------------------------------------
+void
+aggregate__flush(aggregate_t * self) {
+  for (size_t i = 0; i < self->capacity; i++) {
+    aggregate_entry_t * entry = self->slots[i];
+    if (!isvalid(entry))
+      continue;
+
+    _aggregate_entry__emit(entry);
+
+    _aggregate_release(_aggregate_entry__memory(entry));
+    sfree(entry->text);
+    free(entry);
+    self->slots[i] = NULL;
+  }
+
+  if (self->dropped) {
+    log_w("Dropped %lu samples that did not fit in the aggregated profile", self->dropped);
+    if (pargs.memory && !pargs.full) {
+      emit_metadata("dropped", "%lu," MEM_METRIC, self->dropped, self->dropped_memory);
+    }
+    else {
+      emit_metadata("dropped", "%lu," TIME_METRIC, self->dropped, self->dropped_time);
+    }
+  }
+
+  self->size           = 0;
+  self->dropped        = 0;
+  self->dropped_time   = 0;
+  self->dropped_memory = 0;
+  self->flushed        = gettime();
+}
+
+
+// ----------------------------------------------------------------------------
+void
+aggregate__destroy(aggregate_t * self) {
+  if (!isvalid(self))
+    return;
+
+  aggregate__flush(self);
+
+  free(self->slots);
+  _aggregate_release(sizeof(aggregate_t) + self->capacity * sizeof(aggregate_entry_t *));
+
+  free(self);
+}
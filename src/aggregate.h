@@ -0,0 +1,144 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "argparse.h"
+#include "cache.h"
+#include "stats.h"
+
+
+// The maximum amount of memory that the profiles of all the processes can use
+// together. Samples of new stacks are dropped once this is reached.
+#define AGGREGATE_MAX_MEMORY        (64 << 20)
+
+#define AGGREGATE_INITIAL_CAPACITY  1024
+
+
+// The identity of a sample. Samples with the same identity are aggregated
+// together in the profile.
+typedef struct {
+  pid_t       pid;
+  int64_t     iid;
+  uintptr_t   tid;
+  int         idle;
+  int         gc;
+  int         invalid;  // The number of invalid frame markers
+  size_t      size;
+  key_dt    * keys;     // The frame keys, in the order they are emitted
+} aggregate_sample_t;
+
+
+typedef struct {
+  uint64_t    hash;
+  pid_t       pid;
+  int64_t     iid;
+  uintptr_t   tid;
+  int         idle;
+  int         gc;
+  int         invalid;
+  ctime_t     time;
+  ssize_t     memory;
+  char      * text;     // The frames in the collapsed format (text mode only)
+  size_t      size;
+  key_dt      keys[];
+} aggregate_entry_t;
+
+
+typedef struct {
+  aggregate_entry_t ** slots;
+  size_t               capacity;  // Always a power of 2
+  size_t               size;
+  ctime_t              flushed;   // The time of the last flush
+
+  // Samples of new stacks that did not fit in memory since the last flush
+  ustat_t              dropped;
+  ctime_t              dropped_time;
+  ssize_t              dropped_memory;
+} aggregate_t;
+
+
+/**
+ * Render the frames of a sample in the collapsed format. The returned string
+ * is owned by the profile.
+ */
+typedef char * (*aggregate_render_t)(void);
+
+
+/**
+ * Create a new, empty, profile.
+ *
+ * @return a valid pointer to a profile, NULL otherwise.
+ */
+aggregate_t *
+aggregate_new(void);
+
+
+/**
+ * Add the metrics of a sample to the profile.
+ *
+ * If the sample has not been seen since the last flush, a new entry is
+ * created and, in text mode, the render callback is used to get the frames of
+ * the sample. If there is no room left for the new entry, the sample is
+ * accounted for as dropped.
+ *
+ * @param  aggregate_t *        self.
+ * @param  aggregate_sample_t * the sample.
+ * @param  ctime_t              the time delta.
+ * @param  ssize_t              the memory delta.
+ * @param  aggregate_render_t   the callback that renders the frames.
+ *
+ * @return either SUCCESS or FAIL if the sample has been dropped.
+ */
+int
+aggregate__add(aggregate_t *, aggregate_sample_t *, ctime_t, ssize_t, aggregate_render_t);
+
+
+/**
+ * Emit the collected samples and empty the profile.
+ *
+ * @param  aggregate_t *  self.
+ */
+void
+aggregate__flush(aggregate_t *);
+
+
+/**
+ * Check whether the profile is due to be flushed.
+ */
+#define aggregate__is_due(self) \
+  (gettime() - (self)->flushed >= pargs.aggregate * 1000000)
+
+
+/**
+ * Destroy the profile. Any collected samples are flushed first.
+ *
+ * @param  aggregate_t *  self.
+ */
+void
+aggregate__destroy(aggregate_t *);
+
+#endif
@@ -30,11 +30,13 @@
 #endif
 
 #include <limits.h>
+#include <string.h>
 
 #include "argparse.h"
 #include "austin.h"
 #include "hints.h"
 #include "platform.h"
+#include "writer.h"
 
 #if defined PL_LINUX && !defined __MUSL__
 #define GNU_ARGP
@@ -47,6 +49,8 @@
 #endif
 #define DEFAULT_INIT_TIMEOUT_MS     1000  // 1 second
 #define DEFAULT_HEAP_SIZE              0
+#define DEFAULT_JOBS                   1
+#define MAX_JOBS                      64
 
 const char SAMPLE_FORMAT_NORMAL[]      = ";%s:%s:%d";
 const char SAMPLE_FORMAT_WHERE[]       = "    \033[33;1m%2$s\033[0m (\033[36;1m%1$s\033[0m:\033[32;1m%3$d\033[0m)\n";
@@ -89,9 +93,19 @@ parsed_args_t pargs = {
   /* heap                */ DEFAULT_HEAP_SIZE,
   #ifdef NATIVE
   /* kernel              */ 0,
+  /* raw                 */ 0,
   #endif
+  /* jobs                */ DEFAULT_JOBS,
+  /* catch_up            */ 0,
+  /* budget              */ 0,
+  /* aggregate           */ 0,
+  /* writer              */ WRITER_OFF,
+  /* deferred            */ 0,
 };
 
+// Per-thread output stream override
+__thread FILE * _output_file = NULL;
+
 static int exec_arg = 0;
 
 
@@ -146,6 +160,53 @@ parse_interval(char * str, long * num) {
 }
 
 
+/**
+ * Parse the budget argument.
+ *
+ * This is a percentage, optionally followed by the % sign. The result is the
+ * corresponding fraction.
+ */
+static int
+parse_budget(char * str, double * num) {
+  char * p_err;
+
+  *num = strtod(str, &p_err);
+
+  if (p_err == str)
+    FAIL;
+
+  if (*p_err == '%')
+    p_err++;
+
+  if (*p_err != '\0' || *num <= 0 || *num > 100)
+    FAIL;
+
+  *num /= 100;
+
+  SUCCESS;
+}
+
+
+/**
+ * Parse the writer argument.
+ *
+ * This is the name of the backpressure policy of the output writer thread.
+ */
+static int
+parse_writer(const char * str, int * policy) {
+  if (strcmp(str, "block") == 0)
+    *policy = WRITER_BLOCK;
+  else if (strcmp(str, "drop") == 0)
+    *policy = WRITER_DROP;
+  else if (strcmp(str, "spill") == 0)
+    *policy = WRITER_SPILL;
+  else
+    FAIL;
+
+  SUCCESS;
+}
+
+
 /**
  * Parse the timeout argument.
  *
@@ -263,17 +324,54 @@ static struct argp_option options[] = {
     "Maximum heap size to allocate to increase sampling accuracy, in MB "
     "(default is 0)."
   },
+  {
+    "budget",       'B', "n_pct",       0,
+    "Maximum share of CPU time to use for sampling, as a percentage. The "
+    "sampling interval is widened as required to stay within the budget."
+  },
+  #ifndef NATIVE
+  {
+    "aggregate",    'A', "n_sec",       0,
+    "Aggregate the samples in memory and emit the collected profile every "
+    "n_sec seconds and on exit."
+  },
+  {
+    "deferred",     'D', NULL,          0,
+    "Resolve the frames of the samples in a separate thread, off the sampling "
+    "path."
+  },
+  #endif
   {
     "binary",       'b', NULL,          0,
     "Emit data in the MOJO binary format. "
     "See https://github.com/P403n1x87/austin/wiki/The-MOJO-file-format for more details.",
   },
+  {
+    "catch-up",     'c', NULL,          0,
+    "Catch up with missed sampling deadlines instead of skipping them."
+  },
+  {
+    "jobs",         'j', "n",           0,
+    "Number of threads to use to sample child processes (default is 1)."
+  },
+  {
+    "writer",       'W', "policy",      0,
+    "Write the output from a separate thread. The policy decides what to do "
+    "when the output cannot keep up: block, drop the samples, or spill them "
+    "to a temporary file."
+  },
 
   #ifdef NATIVE
   {
     "kernel",       'k', NULL,          0,
     "Sample the kernel call stack."
   },
+  {
+    "raw",          'r', NULL,          0,
+    "Record the raw program counters of the native frames, together with the "
+    "VM maps, for offline symbolization with austin-symbolize. Requires the "
+    "binary output format."
+  },
   #endif
   #ifndef GNU_ARGP
   {
@@ -311,7 +409,10 @@ parse_opt (int key, char *arg, struct argp_state *state)
     state->next = state->argc;
   }
 
-  long l_pid;
+  long l_pid, l_jobs;
+  #ifndef NATIVE
+  long l_aggregate;
+  #endif
   switch(key) {
   case 'i':
     if (
@@ -385,6 +486,41 @@ parse_opt (int key, char *arg, struct argp_state *state)
     pargs.heap <<= 20;
     break;
 
+  case 'j':
+    if (str_to_num(arg, &l_jobs) == 1 || l_jobs <= 0 || l_jobs > MAX_JOBS)
+      argp_error(state, "the number of jobs must be a positive integer not greater than 64");
+    pargs.jobs = (int) l_jobs;
+    break;
+
+  case 'c':
+    pargs.catch_up = 1;
+    break;
+
+  case 'B':
+    if (fail(parse_budget(arg, &(pargs.budget))))
+      argp_error(state, "the budget must be a percentage between 0 and 100");
+    break;
+
+  case 'W':
+    if (fail(parse_writer(arg, &(pargs.writer))))
+      argp_error(state, "the writer policy must be one of block, drop or spill");
+    break;
+
+  #ifndef NATIVE
+  case 'A':
+    if (
+      str_to_num(arg, &l_aggregate) == 1 ||
+      l_aggregate <= 0 || l_aggregate > LONG_MAX / 1000000
+    )
+      argp_error(state, "the aggregation period must be a positive integer");
+    pargs.aggregate = (ctime_t) l_aggregate;
+    break;
+
+  case 'D':
+    pargs.deferred = 1;
+    break;
+  #endif
+
   case 'w':
     if (str_to_num(arg, &l_pid) == 1 || l_pid <= 0)
       argp_error(state, "invalid PID");
@@ -403,6 +539,10 @@ parse_opt (int key, char *arg, struct argp_state *state)
   case 'k':
     pargs.kernel = 1;
     break;
+
+  case 'r':
+    pargs.raw = 1;
+    break;
   #endif
 
   case ARGP_KEY_ARG:
@@ -553,16 +693,28 @@ print(";")
 "data out of a running Python process (and all its children, if required) that\n"
 "requires no instrumentation and has practically no impact on the tracee.\n"
 "\n"
+"  -A, --aggregate=n_sec      Aggregate the samples in memory and emit the\n"
+"                             collected profile every n_sec seconds and on\n"
+"                             exit.\n"
 "  -b, --binary               Emit data in the MOJO binary format. See\n"
 "                             https://github.com/P403n1x87/austin/wiki/The-MOJO-file-format\n"
 "                             for more details.\n"
+"  -B, --budget=n_pct         Maximum share of CPU time to use for sampling, as\n"
+"                             a percentage. The sampling interval is widened as\n"
+"                             required to stay within the budget.\n"
+"  -c, --catch-up             Catch up with missed sampling deadlines instead of\n"
+"                             skipping them.\n"
 "  -C, --children             Attach to child processes.\n"
+"  -D, --deferred             Resolve the frames of the samples in a separate\n"
+"                             thread, off the sampling path.\n"
 "  -f, --full                 Produce the full set of metrics (time +mem -mem).\n"
 "  -g, --gc                   Sample the garbage collector state.\n"
 "  -h, --heap=n_mb            Maximum heap size to allocate to increase sampling\n"
 "                             accuracy, in MB (default is 0).\n"
 "  -i, --interval=n_us        Sampling interval in microseconds (default is\n"
 "                             100). Accepted units: s, ms, us.\n"
+"  -j, --jobs=n               Number of threads to use to sample child processes\n"
+"                             (default is 1).\n"
 "  -m, --memory               Profile memory usage.\n"
 "  -o, --output=FILE          Specify an output file for the collected samples.\n"
 "  -p, --pid=PID              Attach to the process with the given PID.\n"
@@ -572,6 +724,10 @@ print(";")
 "                             100). Accepted units: s, ms.\n"
 "  -w, --where=PID            Dump the stacks of all the threads within the\n"
 "                             process with the given PID.\n"
+"  -W, --writer=policy        Write the output from a separate thread. The\n"
+"                             policy decides what to do when the output cannot\n"
+"                             keep up: block, drop the samples, or spill them to\n"
+"                             a temporary file.\n"
 "  -x, --exposure=n_sec       Sample for n_sec seconds only.\n"
 "  -?, --help                 Give this help list\n"
 "      --usage                Give a short usage message\n"
@@ -591,11 +747,14 @@ for line in check_output(["src/austin", "--usage"]).decode().strip().splitlines(
   print(f'"{line}\\n"')
 print(";")
 ]]]*/
-"Usage: austin [-bCfgmPs?V] [-h n_mb] [-i n_us] [-o FILE] [-p PID] [-t n_ms]\n"
-"            [-w PID] [-x n_sec] [--binary] [--children] [--full] [--gc]\n"
-"            [--heap=n_mb] [--interval=n_us] [--memory] [--output=FILE]\n"
-"            [--pid=PID] [--pipe] [--sleepless] [--timeout=n_ms] [--where=PID]\n"
-"            [--exposure=n_sec] [--help] [--usage] [--version] command [ARG...]\n"
+"Usage: austin [-bcCDfgmPs?V] [-A n_sec] [-B n_pct] [-h n_mb] [-i n_us] [-j n]\n"
+"            [-o FILE] [-p PID] [-t n_ms] [-w PID] [-W policy] [-x n_sec]\n"
+"            [--aggregate=n_sec] [--binary] [--budget=n_pct] [--catch-up]\n"
+"            [--children] [--deferred] [--full] [--gc] [--heap=n_mb]\n"
+"            [--interval=n_us] [--jobs=n] [--memory] [--output=FILE] [--pid=PID]\n"
+"            [--pipe] [--sleepless] [--timeout=n_ms] [--where=PID]\n"
+"            [--writer=policy] [--exposure=n_sec] [--help] [--usage]\n"
+"            [--version] command [ARG...]\n"
 ;
 /*[[[end]]]*/
 
@@ -650,6 +809,8 @@ arg_parse(arg_option * opts, arg_callback cb, int argc, char ** argv) {
 // ----------------------------------------------------------------------------
 static int
 cb(const char opt, const char * arg) {
+  long l_jobs, l_aggregate;
+
   switch (opt) {
   case 'i':
     if (
@@ -742,6 +903,39 @@ cb(const char opt, const char * arg) {
     pargs.heap <<= 20;
     break;
 
+  case 'j':
+    if (str_to_num((char *) arg, &l_jobs) == 1 || l_jobs <= 0 || l_jobs > MAX_JOBS)
+      arg_error("the number of jobs must be a positive integer not greater than 64");
+    pargs.jobs = (int) l_jobs;
+    break;
+
+  case 'c':
+    pargs.catch_up = 1;
+    break;
+
+  case 'B':
+    if (fail(parse_budget((char *) arg, &(pargs.budget))))
+      arg_error("the budget must be a percentage between 0 and 100");
+    break;
+
+  case 'W':
+    if (fail(parse_writer(arg, &(pargs.writer))))
+      arg_error("the writer policy must be one of block, drop or spill");
+    break;
+
+  case 'A':
+    if (
+      str_to_num((char *) arg, &l_aggregate) == 1 ||
+      l_aggregate <= 0 || l_aggregate > LONG_MAX / 1000000
+    )
+      arg_error("the aggregation period must be a positive integer");
+    pargs.aggregate = (ctime_t) l_aggregate;
+    break;
+
+  case 'D':
+    pargs.deferred = 1;
+    break;
+
   case '?':
     puts(help_msg);
     exit(0);
@@ -774,6 +968,41 @@ static inline void validate() {
     pargs.binary = 0;
   }
 
+  if (pargs.aggregate && pargs.where) {
+    // silently ignore the aggregate option
+    pargs.aggregate = 0;
+  }
+
+  if (pargs.deferred && (pargs.where || pargs.aggregate)) {
+    // silently ignore the deferred option, as there is either nothing to defer
+    // or the aggregation takes care of resolving frames only once.
+    pargs.deferred = 0;
+  }
+
+  #ifdef NATIVE
+  if (pargs.raw && pargs.where) {
+    // silently ignore the raw option, as we resolve the frames straight away
+    pargs.raw = 0;
+  }
+
+  if (pargs.raw && !pargs.binary) {
+    // The VM map events that are needed to resolve raw frames are MOJO-only.
+    puts("The raw option requires the binary output format");
+    exit(-1);
+  }
+  #endif
+
+  if (pargs.writer && pargs.where) {
+    // silently ignore the writer option
+    pargs.writer = WRITER_OFF;
+  }
+
+  if (pargs.writer == WRITER_DROP && pargs.binary) {
+    // Dropped MOJO output might contain definitions that are referenced later.
+    puts("The drop writer policy is not supported in binary mode");
+    exit(-1);
+  }
+
   if (isvalid(pargs.output_filename)) {
     pargs.output_file = fopen(pargs.output_filename, pargs.binary ? "wb" : "w");
     if (pargs.output_file == NULL) {
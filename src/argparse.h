@@ -54,15 +54,34 @@ typedef struct {
   size_t    heap;
   #ifdef NATIVE
   int       kernel;
+  int       raw;
   #endif
+  int       jobs;
+  int       catch_up;
+  double    budget;
+  ctime_t   aggregate;
+  int       writer;
+  int       deferred;
 } parsed_args_t;
 
 
 #ifndef ARGPARSE_C
 extern parsed_args_t pargs;
+
+extern __thread FILE * _output_file;
 #endif
 
 
+/**
+ * Get the output stream for the calling thread.
+ *
+ * Sampler threads can redirect their output to a private stream, which is then
+ * merged into the main output file. All the other threads write directly to the
+ * output file given on the command line.
+ */
+#define output_stream() (_output_file == NULL ? pargs.output_file : _output_file)
+
+
 #define ARG_ARGUMENT                   0
 
 #define ARG_STOP_PARSING               1
@@ -44,6 +44,7 @@
 #include "stats.h"
 #include "timing.h"
 #include "version.h"
+#include "writer.h"
 
 #include "py_proc.h"
 #include "py_proc_list.h"
@@ -77,18 +78,18 @@ do_single_process(py_proc_t * py_proc) {
   if (!pargs.where) 
     NL;
 
+  scheduler_start();
+
   if (pargs.exposure == 0) {
     while(interrupt == FALSE) {
       stopwatch_start();
 
       if (fail(py_proc__sample(py_proc)))
         break;
-      
-      #ifdef NATIVE
-      stopwatch_pause(0);
-      #else
-      stopwatch_pause(stopwatch_duration());
-      #endif
+
+      writer_commit();
+
+      scheduler_wait();
     }
   }
   else {
@@ -101,14 +102,12 @@ do_single_process(py_proc_t * py_proc) {
       if (fail(py_proc__sample(py_proc)))
         break;
 
-      #ifdef NATIVE
-      stopwatch_pause(0);
-      #else
-      stopwatch_pause(stopwatch_duration());
-      #endif
+      writer_commit();
 
       if (end_time < gettime() || pargs.where)
         interrupt++;
+      else
+        scheduler_wait();
     }
   }
 
@@ -180,18 +179,16 @@ do_child_processes(py_proc_t * py_proc) {
     NL;
   }
 
+  scheduler_start();
+
   if (pargs.exposure == 0) {
     while (!py_proc_list__is_empty(list) && interrupt == FALSE) {
-      #ifndef NATIVE
-      ctime_t start_time = gettime();
-      #endif
       py_proc_list__update(list);
       py_proc_list__sample(list);
-      #ifdef NATIVE
-      stopwatch_pause(0);
-      #else
-      stopwatch_pause(gettime() - start_time);
-      #endif
+
+      writer_commit();
+
+      scheduler_wait();
     }
   }
   else {
@@ -199,19 +196,15 @@ do_child_processes(py_proc_t * py_proc) {
       log_m("🕑 Sampling for %d second%s", pargs.exposure, pargs.exposure != 1 ? "s" : "");
     ctime_t end_time = gettime() + pargs.exposure * 1000000;
     while (!py_proc_list__is_empty(list) && interrupt == FALSE) {
-      #ifndef NATIVE
-      ctime_t start_time = gettime();
-      #endif
       py_proc_list__update(list);
       py_proc_list__sample(list);
-      #ifdef NATIVE
-      stopwatch_pause(0);
-      #else
-      stopwatch_pause(gettime() - start_time);
-      #endif
+
+      writer_commit();
 
       if (end_time < gettime() || pargs.where)
         interrupt++;
+      else
+        scheduler_wait();
     }
   }
 
@@ -348,6 +341,11 @@ int main(int argc, char ** argv) {
     }
   }
 
+  // Start the writer only now that we have forked, if we had to.
+  if (pargs.writer && fail(writer_start())) {
+    log_w("Cannot start the output writer. Writing the output synchronously.");
+  }
+
   // Redirect output to STDOUT if not output file was given.
   if (pargs.output_file != stdout)
     log_i("Output file: %s", pargs.output_filename);
@@ -355,11 +353,15 @@ int main(int argc, char ** argv) {
   if (pargs.where) {
     log_i("Where mode on process %d", pargs.attach_pid);
     pargs.t_sampling_interval = 1;
+    pargs.budget = 0;
     // We use the exposure branch to emulate sampling once
     pargs.exposure = 1;
   }
-  else
+  else {
     log_i("Sampling interval: %lu μs", pargs.t_sampling_interval);
+    if (pargs.budget > 0)
+      log_i("CPU budget: %.2f%%", pargs.budget * 100);
+  }
 
   if (pargs.heap)
     log_i("Maximum frame heap size: %d MB", pargs.heap >> 20);
@@ -415,12 +417,16 @@ int main(int argc, char ** argv) {
   stats_log_metrics();NL;
 
 finally:
+  writer_stop();
+
   py_thread_free();
   py_proc__destroy(py_proc);
+  py_proc_free();
 
   log_footer();
 
 release:
+  mojo_flush();
   if (pargs.output_file != NULL && pargs.output_file != stdout) {
     fclose(pargs.output_file);
     log_d("Output file closed.");
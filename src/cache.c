@@ -222,13 +222,36 @@ void chain__destroy(chain_t * self) {
 }
 
 // ----------------------------------------------------------------------------
+#if UINTPTR_MAX > 0xFFFFFFFF
+#define MAGIC 11400714819323198485ull
+#else
+#define MAGIC 2654435769u
+#endif
+
+#define MIN_HASH_TABLE_SLOTS_BITS 3
+
 hash_table_t *
 hash_table_new(int capacity) {
   hash_table_t *hash = (hash_table_t *) calloc(1, sizeof(hash_table_t));
+  if (!isvalid(hash))
+    return NULL;
 
   hash->capacity = capacity;
   hash->load_factor = 0.75 * capacity;
-  hash->chains = (chain_t **) calloc(hash->capacity, sizeof(chain_t *));
+
+  // Keep the load below 75% even when the table is at full capacity, so that
+  // there always are empty slots to terminate the probe sequences.
+  unsigned int bits = MIN_HASH_TABLE_SLOTS_BITS;
+  while (((size_t) 1 << bits) - ((size_t) 1 << (bits - 2)) <= hash->capacity)
+    bits++;
+
+  hash->mask  = ((size_t) 1 << bits) - 1;
+  hash->shift = (sizeof(key_dt) << 3) - bits;
+  hash->slots = (hash_slot_t *) calloc(hash->mask + 1, sizeof(hash_slot_t));
+  if (!isvalid(hash->slots)) {
+    free(hash);
+    return NULL;
+  }
 
   #ifdef DEBUG
   hash->set_total = 0;
@@ -239,11 +262,32 @@ hash_table_new(int capacity) {
 }
 
 // ----------------------------------------------------------------------------
-#define MAGIC 2654435761
-
 static inline index_t
 _hash_table__index(hash_table_t *self, key_dt key) {
-  return (uintptr_t)((key * MAGIC) % self->capacity);
+  // Fibonacci hashing
+  return (index_t) ((key * MAGIC) >> self->shift);
+}
+
+// ----------------------------------------------------------------------------
+static inline hash_slot_t *
+_hash_table__find(hash_table_t *self, key_dt key) {
+  index_t      index = _hash_table__index(self, key);
+  unsigned int psl   = 1;
+
+  for (;;) {
+    hash_slot_t * slot = self->slots + index;
+
+    // With Robin Hood hashing, the key cannot be further along the probe
+    // sequence if we find an item that is closer to its home slot.
+    if (slot->psl < psl)
+      return NULL;
+
+    if (slot->key == key)
+      return slot;
+
+    index = (index + 1) & self->mask;
+    psl++;
+  }
 }
 
 // ----------------------------------------------------------------------------
@@ -252,11 +296,9 @@ hash_table__get(hash_table_t *self, key_dt key) {
   if (!isvalid(self))
     return NULL;
 
-  chain_t * chain = self->chains[_hash_table__index(self, key)];
-  if (!isvalid(chain))
-    return NULL;
+  hash_slot_t * slot = _hash_table__find(self, key);
 
-  return chain__find(chain, key);
+  return isvalid(slot) ? slot->value : NULL;
 }
 
 // ----------------------------------------------------------------------------
@@ -274,28 +316,46 @@ hash_table__set(hash_table_t *self, key_dt key, value_t value) {
   if (!isvalid(self))
     return;
 
-  index_t index = _hash_table__index(self, key);
-
   #ifdef DEBUG
   self->set_total++;
   #endif
 
-  chain_t * chain = self->chains[index];
-  if (!isvalid(chain)) {
-    if (self->size >= self->capacity)
-      return;
-    #ifdef DEBUG
-    self->set_empty++;
-    #endif
-    self->chains[index] = chain_head();
-    self->size += chain__add(self->chains[index], key, value);
+  hash_slot_t * slot = _hash_table__find(self, key);
+  if (isvalid(slot)) {
+    slot->value = value;
     return;
   }
 
-  if ((self->size >= self->capacity) && !chain__has(chain, key))
+  if (self->size >= self->capacity)
     return;
 
-  self->size += chain__add(self->chains[index], key, value);
+  index_t     index = _hash_table__index(self, key);
+  hash_slot_t item  = {key, value, 1};
+
+  #ifdef DEBUG
+  if (!self->slots[index].psl)
+    self->set_empty++;
+  #endif
+
+  for (;;) {
+    slot = self->slots + index;
+
+    if (!slot->psl) {
+      *slot = item;
+      self->size++;
+      return;
+    }
+
+    // Take the slot from items that are closer to their home slot.
+    if (slot->psl < item.psl) {
+      hash_slot_t displaced = *slot;
+      *slot = item;
+      item  = displaced;
+    }
+
+    index = (index + 1) & self->mask;
+    item.psl++;
+  }
 }
 
 // ----------------------------------------------------------------------------
@@ -304,18 +364,24 @@ hash_table__del(hash_table_t * self, key_dt key) {
   if (!isvalid(self) || self->size == 0)
     return;
 
-  index_t   index = _hash_table__index(self, key);
-  chain_t * chain = self->chains[index];
-
-  if (!isvalid(chain))
+  hash_slot_t * slot = _hash_table__find(self, key);
+  if (!isvalid(slot))
     return;
 
-  self->size -= chain__remove(chain, key);
+  // Shift the following items back by one slot until we find an empty slot or
+  // an item that is already in its home slot.
+  index_t index = slot - self->slots;
+  index_t next  = (index + 1) & self->mask;
+  while (self->slots[next].psl > 1) {
+    self->slots[index] = self->slots[next];
+    self->slots[index].psl--;
 
-  if (chain__is_empty(chain)) {
-    chain__destroy(chain);
-    self->chains[index] = NULL;
+    index = next;
+    next  = (next + 1) & self->mask;
   }
+
+  self->slots[index] = (hash_slot_t) {0, NULL, 0};
+  self->size--;
 }
 
 // ----------------------------------------------------------------------------
@@ -324,12 +390,7 @@ hash_table__destroy(hash_table_t *self) {
   if (!isvalid(self))
     return;
 
-  if (isvalid(self->chains)) {
-    for (int i = 0; i < self->capacity; i++) {
-      chain__destroy(self->chains[i]);
-    }
-    sfree(self->chains);
-  }
+  sfree(self->slots);
 
   free(self);
 }
@@ -337,102 +398,154 @@ hash_table__destroy(hash_table_t *self) {
 
 // -- LRU Cache ---------------------------------------------------------------
 
+#define _lru_cache__index(value) ((unsigned int) (((uintptr_t) (value)) - 1))
+#define _lru_cache__value(index) ((value_t) (((uintptr_t) (index)) + 1))
+
 // ----------------------------------------------------------------------------
 lru_cache_t *
 lru_cache_new(int capacity, void (*deallocator)(value_t)) {
   lru_cache_t *cache = (lru_cache_t *)calloc(1, sizeof(lru_cache_t));
+  if (!isvalid(cache))
+    return NULL;
 
-  cache->capacity = capacity;
-  
-  capacity = capacity ? capacity : 1024;
+  cache->capacity    = capacity;
+  cache->deallocator = deallocator;
+  cache->head        = cache->tail = LRU_NIL;
+  cache->name        = "LRU cache";
   
-  cache->queue = queue_new(capacity, deallocator);
-  cache->hash  = hash_table_new((capacity * 4 / 3) | 1);
-
-  #ifdef DEBUG
-  cache->hits = 0;
-  cache->misses = 0;
-  #endif
+  cache->size  = capacity ? capacity : 1024;
+  cache->nodes = (lru_node_t *) calloc(cache->size, sizeof(lru_node_t));
+  cache->hash  = hash_table_new(cache->size);
+  if (!isvalid(cache->nodes) || !isvalid(cache->hash)) {
+    sfree(cache->nodes);
+    hash_table__destroy(cache->hash);
+    free(cache);
+    return NULL;
+  }
 
   return cache;
 }
 
+// ----------------------------------------------------------------------------
+static inline void
+_lru_cache__unlink(lru_cache_t *self, unsigned int index) {
+  lru_node_t * node = self->nodes + index;
+
+  if (node->prev == LRU_NIL)
+    self->head = node->next;
+  else
+    self->nodes[node->prev].next = node->next;
+
+  if (node->next == LRU_NIL)
+    self->tail = node->prev;
+  else
+    self->nodes[node->next].prev = node->prev;
+}
+
+// ----------------------------------------------------------------------------
+static inline void
+_lru_cache__push_front(lru_cache_t *self, unsigned int index) {
+  lru_node_t * node = self->nodes + index;
+
+  node->prev = LRU_NIL;
+  node->next = self->head;
+
+  if (self->head == LRU_NIL)
+    self->tail = index;
+  else
+    self->nodes[self->head].prev = index;
+
+  self->head = index;
+}
+
 // ----------------------------------------------------------------------------
 value_t
 lru_cache__maybe_hit(lru_cache_t *self, key_dt key) {
-  queue_item_t *item = (queue_item_t *)hash_table__get(self->hash, key);
+  value_t value = hash_table__get(self->hash, key);
 
-  if (!isvalid(item)) {
-    #ifdef DEBUG
+  if (!isvalid(value)) {
     self->misses++;
-    #endif
     return NULL;
   }
 
-  #ifdef DEBUG
   self->hits++;
-  #endif
-
-  // Bring hit element to the front of the queue
-  if (item != self->queue->front)
-  {
-    item->prev->next = item->next;
-    if (item->next)
-      item->next->prev = item->prev;
-
-    if (item == self->queue->rear)
-    {
-      self->queue->rear = item->prev;
-      self->queue->rear->next = NULL;
-    }
-
-    item->next = self->queue->front;
-    item->prev = NULL;
-
-    item->next->prev = item;
 
-    self->queue->front = item;
+  // Bring hit node to the front of the list
+  unsigned int index = _lru_cache__index(value);
+  if (index != self->head) {
+    _lru_cache__unlink(self, index);
+    _lru_cache__push_front(self, index);
   }
 
-  return item->value;
+  return self->nodes[index].value;
 }
 
 // ----------------------------------------------------------------------------
 int
 lru_cache__is_full(lru_cache_t *self) {
-  return queue__is_full(self->queue);
+  return self->count == self->size;
+}
+
+// ----------------------------------------------------------------------------
+static inline int
+_lru_cache__expand(lru_cache_t *self) {
+  // Double the slab. Nodes are linked by index, so the links stay valid.
+  unsigned int size = self->size << 1;
+
+  lru_node_t * nodes = (lru_node_t *) realloc(self->nodes, size * sizeof(lru_node_t));
+  if (!isvalid(nodes))
+    FAIL;
+  self->nodes = nodes;
+
+  hash_table_t *hash = hash_table_new(size);
+  if (!isvalid(hash))
+    FAIL;
+
+  // Move the node indices across to the new hash table.
+  hash_table__iteritems_start(self->hash, key_dt, _key, value_t, _value) {
+    hash_table__set(hash, _key, _value);
+  } hash_table__iter_stop(self->hash);
+
+  hash_table__destroy(self->hash);
+  self->hash = hash;
+  self->size = size;
+
+  SUCCESS;
 }
 
 // ----------------------------------------------------------------------------
 void
 lru_cache__store(lru_cache_t *self, key_dt key, value_t value) {
-  queue_t * queue = self->queue;
-
-  if (queue__is_full(queue)) {
-    if (self->capacity == LRU_CACHE_EXPAND) {
-      // Double the queue capacity.
-      unsigned capacity = queue->capacity = (queue->capacity << 1);
-
-      // Double the hash table and move the items across.
-      hash_table_t *new_hash = hash_table_new((capacity * 4 / 3) | 1);
-      
-      hash_table__iter_start(self->hash, queue_item_t *, item) {
-        hash_table__set(new_hash, item->key, item);
-      } hash_table__iter_stop(self->hash);
-
-      // Destroy the old hash table and replace it with the new one.
-      hash_table__destroy(self->hash);
-      self->hash = new_hash;
-    } else {
-      hash_table__del(self->hash, queue->rear->key);
-      
-      value_t value = queue__dequeue(queue);
-      if (isvalid(value))
-        queue->deallocator(value);
-    }
+  unsigned int index;
+
+  // If we fail to expand we fall back to evicting.
+  if (lru_cache__is_full(self) && self->capacity == LRU_CACHE_EXPAND)
+    _lru_cache__expand(self);
+
+  if (lru_cache__is_full(self)) {
+    // Evict the least recently used node and reuse it.
+    index = self->tail;
+    lru_node_t * node = self->nodes + index;
+
+    // A key stored more than once maps to the most recent node only.
+    if (hash_table__get(self->hash, node->key) == _lru_cache__value(index))
+      hash_table__del(self->hash, node->key);
+
+    if (isvalid(node->value))
+      self->deallocator(node->value);
+
+    _lru_cache__unlink(self, index);
+
+    self->evictions++;
   }
+  else
+    index = self->count++;
 
-  hash_table__set(self->hash, key, queue__enqueue(self->queue, value, key));
+  self->nodes[index].key   = key;
+  self->nodes[index].value = value;
+  _lru_cache__push_front(self, index);
+
+  hash_table__set(self->hash, key, _lru_cache__value(index));
 }
 
 // ----------------------------------------------------------------------------
@@ -443,21 +556,30 @@ lru_cache__destroy(lru_cache_t *self) {
 
   #ifdef DEBUG
   size_t total = self->hits + self->misses;
-  log_d(
-    "(%s) hit ratio: %d/%d (%0.2f%%)\n",
-    self->name, self->hits, total, (self->hits) * 100.0 / total
-  );
+  if (total) {
+    log_d(
+      "(%s) hits/misses/evictions: %lu/%lu/%lu (%0.2f%% hit ratio)",
+      self->name, self->hits, self->misses, self->evictions,
+      self->hits * 100.0 / total
+    );
+  }
+
   log_d(
     "(%s) hash collisions: %d/%d (%0.2f%%, prob: %0.2f%%)\n",
     self->name,
     self->hash->set_total - self->hash->set_empty,
     self->hash->set_total,
     (self->hash->set_total - self->hash->set_empty) * 100.0 / self->hash->set_total,
-    100.0 * (1 - exp(-((double) self->queue->count) * (self->queue->count - 1.0) / 2.0 / self->hash->capacity))
+    100.0 * (1 - exp(-((double) self->count) * (self->count - 1.0) / 2.0 / self->hash->capacity))
   );
   #endif
 
-  queue__destroy(self->queue);
+  for (unsigned int i = 0; i < self->count; i++) {
+    if (isvalid(self->nodes[i].value))
+      self->deallocator(self->nodes[i].value);
+  }
+
+  sfree(self->nodes);
   hash_table__destroy(self->hash);
 
   free(self);
@@ -156,11 +156,21 @@ typedef struct _chain_t {
     value_t value;
 } chain_t;
 
+// A slot of the open-addressing hash table. Slots are stored inline in a
+// single array, so that probing for a key touches contiguous memory.
+typedef struct {
+    key_dt key;
+    value_t value;
+    unsigned int psl;  // Probe sequence length + 1, or 0 if the slot is empty
+} hash_slot_t;
+
 typedef struct hash_table_t {
-    size_t capacity;
+    size_t capacity;      // Maximum number of items
     size_t size;
     size_t load_factor;
-    chain_t **chains;
+    size_t mask;          // Number of slots - 1
+    unsigned int shift;
+    hash_slot_t *slots;
 
     #ifdef DEBUG
     size_t set_total;
@@ -172,9 +182,9 @@ typedef struct hash_table_t {
 /**
  * Create a new chain.
  * 
- * This is an implementation of a linked list that used to implement chaining
- * for resolving collisions in a hash table and therefore should be regarded
- * as an internal detail implementation of the hash_table_t structure.
+ * This is an implementation of a linked list that was used to implement
+ * chaining for resolving collisions in a hash table. The hash table now uses
+ * open addressing instead.
  * 
  * A chain is an element in the list *and* the list itself. This is why this
  * constructor takes a key and a value.
@@ -278,6 +288,10 @@ chain__destroy(chain_t *);
 /**
  * Create a new hash table.
  * 
+ * The hash table uses open addressing with linear probing and Robin Hood
+ * hashing. The number of slots is the smallest power of 2 that keeps the load
+ * below 75% at full capacity.
+ * 
  * @param capacity  the hash table maximum capacity. Pass ``LRU_CACHE_EXPAND``
  *                   to allow the hash table to expand.
  * 
@@ -329,25 +343,23 @@ hash_table__set(hash_table_t *, key_dt, value_t);
 
 
 #define hash_table__iter_start(table, valtype, valvar)                         \
-    for (int __i = 0; __i < table->capacity; __i++) {                          \
-        chain_t * chain = table->chains[__i];                                  \
-        if (!isvalid(chain))                                                   \
+    for (size_t __i = 0; __i <= table->mask; __i++) {                          \
+        hash_slot_t * slot = table->slots + __i;                               \
+        if (!slot->psl)                                                        \
             continue;                                                          \
-        while (isvalid(chain->next)) {                                         \
-            chain = chain->next;                                               \
-            valtype valvar = (valtype) chain->value;                           \
+        {                                                                      \
+            valtype valvar = (valtype) slot->value;                            \
             if (!isvalid(valvar))                                              \
                 continue;
 
 #define hash_table__iteritems_start(table, keytype, keyvar, valtype, valvar)   \
-    for (int __i = 0; __i < table->capacity; __i++) {                          \
-        chain_t * chain = table->chains[__i];                                  \
-        if (!isvalid(chain))                                                   \
+    for (size_t __i = 0; __i <= table->mask; __i++) {                          \
+        hash_slot_t * slot = table->slots + __i;                               \
+        if (!slot->psl)                                                        \
             continue;                                                          \
-        while (isvalid(chain->next)) {                                         \
-            chain = chain->next;                                               \
-            keytype keyvar = (keytype) chain->key;                             \
-            valtype valvar = (valtype) chain->value;                           \
+        {                                                                      \
+            keytype keyvar = (keytype) slot->key;                              \
+            valtype valvar = (valtype) slot->value;                            \
             if (!isvalid(valvar))                                              \
                 continue;
 
@@ -375,27 +387,43 @@ hash_table__destroy(hash_table_t *);
 
 // -- LRU Cache ---------------------------------------------------------------
 
+#define LRU_NIL ((unsigned int) -1)
+
+// A node of the LRU cache. Nodes are allocated from a slab and are linked by
+// their index within it.
+typedef struct {
+    key_dt key;
+    value_t value;
+    unsigned int prev;
+    unsigned int next;
+} lru_node_t;
+
 typedef struct {
     int capacity;
-    queue_t *queue;
-    hash_table_t *hash;
+    unsigned int size;    // Number of nodes in the slab
+    unsigned int count;
+    unsigned int head;    // Most recently used node
+    unsigned int tail;    // Least recently used node
+    lru_node_t *nodes;
+    hash_table_t *hash;   // Maps keys to node indices + 1
+    void (*deallocator)(value_t);
 
-    #ifdef DEBUG
     const char * name;
     size_t hits;
     size_t misses;
-    #endif
+    size_t evictions;
 } lru_cache_t;
 
 
 /**
  * Create an LRU cache.
  * 
- * Internally, this makes use of a queue which takes ownership of the values
- * added to it. Therefore, the cache itself takes ownership of every value that
- * is stored within it.
+ * The cache nodes are preallocated in a slab and are linked by index, so that
+ * storing a value requires no allocations, unless the cache needs to expand.
+ * The cache takes ownership of every value that is stored within it.
  * 
- * @param capacity     the cache capacity
+ * @param capacity     the cache capacity. Pass ``LRU_CACHE_EXPAND`` to allow
+ *                     the cache to expand.
  * @param deallocator  the value deallocator
  * 
  * @return a valid reference to a cache, NULL otherwise.
@@ -451,6 +479,24 @@ void
 lru_cache__destroy(lru_cache_t *);
 
 
+/**
+ * Iterate over the items of the cache, from the least to the most recently
+ * used one. Storing the items into another cache in this order preserves their
+ * recency.
+*/
+#define lru_cache__iteritems_start(cache, keyvar, valtype, valvar)              \
+    for (                                                                      \
+        unsigned int __i = cache->tail;                                        \
+        __i != LRU_NIL;                                                        \
+        __i = cache->nodes[__i].prev                                           \
+    ) {                                                                        \
+        key_dt keyvar = cache->nodes[__i].key;                                 \
+        valtype valvar = (valtype) cache->nodes[__i].value;
+
+
+#define lru_cache__iter_stop(cache) }
+
+
 // -- Lookup ------------------------------------------------------------------
 
 typedef struct {
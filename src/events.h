@@ -62,7 +62,7 @@
     if (pargs.binary) {                         \
       mojo_event(MOJO_FRAME_INVALID);           \
     } else {                                    \
-      fprintf(pargs.output_file, ";:INVALID:"); \
+      fprintf(output_stream(), ";:INVALID:");   \
     }                                           \
   }
 
@@ -71,7 +71,7 @@
     if (pargs.binary) {                    \
       mojo_event(MOJO_GC);                 \
     } else {                               \
-      fprintf(pargs.output_file, ";:GC:"); \
+      fprintf(output_stream(), ";:GC:");   \
     }                                      \
   }
 
@@ -80,7 +80,7 @@
     if (pargs.binary) {                                                \
       mojo_stack(pid, iid, tid);                                       \
     } else {                                                           \
-      fprintfp(pargs.output_file, format, pid, iid, tid, __VA_ARGS__); \
+      fprintfp(output_stream(), format, pid, iid, tid, __VA_ARGS__);   \
     }                                                                  \
   }
 
@@ -89,7 +89,7 @@
     if (pargs.binary) {                                                    \
       mojo_frame_ref(frame);                                               \
     } else {                                                               \
-      fprintfp(pargs.output_file, format, frame->filename,                 \
+      fprintfp(output_stream(), format, frame->filename,                   \
                frame->scope == UNKNOWN_SCOPE ? "<unknown>" : frame->scope, \
                frame->line);                                               \
     }                                                                      \
@@ -100,7 +100,7 @@
     if (pargs.binary) {                                        \
       mojo_metric_time(value);                                 \
     } else {                                                   \
-      fprintf(pargs.output_file, " " TIME_METRIC "\n", value); \
+      fprintf(output_stream(), " " TIME_METRIC "\n", value);   \
     }                                                          \
   }
 
@@ -109,7 +109,7 @@
     if (pargs.binary) {                                       \
       mojo_metric_memory(value);                              \
     } else {                                                  \
-      fprintf(pargs.output_file, " " MEM_METRIC "\n", value); \
+      fprintf(output_stream(), " " MEM_METRIC "\n", value);   \
     }                                                         \
   }
 
@@ -122,7 +122,7 @@
       }                                                                                \
       mojo_metric_memory(memory);                                                      \
     } else {                                                                           \
-      fprintf(pargs.output_file,                                                       \
+      fprintf(output_stream(),                                                         \
               " " TIME_METRIC METRIC_SEP IDLE_METRIC METRIC_SEP MEM_METRIC "\n", time, \
               idle, memory);                                                           \
     }                                                                                  \
@@ -135,7 +135,7 @@
     if (pargs.binary) {                           \
       mojo_frame_kernel(scope);                   \
     } else {                                      \
-      fprintfp(pargs.output_file, format, scope); \
+      fprintfp(output_stream(), format, scope);   \
     }                                             \
   }
 
@@ -146,7 +146,7 @@
 #define emit_frames_left(n)                                \
   {                                                        \
     if (!pargs.binary) {                                   \
-      fprintf(pargs.output_file, ";:%ld FRAMES LEFT:", n); \
+      fprintf(output_stream(), ";:%ld FRAMES LEFT:", n);   \
     }                                                      \
   }
 
@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include <limits.h>
 
 #include "cache.h"
 #include "resources.h"
@@ -45,6 +46,33 @@ typedef struct {
 } py_frame_t;
 
 
+// An entry of a decoded line table. It gives the location of the instructions
+// that end before the given bytecode offset and after the previous entry.
+typedef struct {
+  int          offset;
+  unsigned int line;
+  unsigned int line_end;
+  unsigned int column;
+  unsigned int column_end;
+} line_entry_t;
+
+
+// The information about a code object that is needed to resolve frames. The
+// file and scope names are as they are to be reported in frames, that is
+// either strings or string keys in binary mode. Code objects can be freed and
+// their address reused, so we also keep what identifies the code object.
+typedef struct {
+  key_dt         filename_key;
+  key_dt         scope_key;
+  void         * lnotab_raddr;
+  char         * filename;
+  char         * scope;
+  size_t         size;
+  size_t         capacity;
+  line_entry_t   lines[];
+} code_info_t;
+
+
 // ----------------------------------------------------------------------------
 static inline frame_t *
 frame_new(
@@ -93,6 +121,16 @@ frame__destroy(frame_t * self) {
 
 #define py_frame_key(code, lasti)  (((key_dt) (((key_dt) code) & MOJO_INT32) << 16) | lasti)
 #define py_string_key(code, field) ((key_dt) *((void **) ((void *) &code + py_v->py_code.field)))
+#define py_code_lnotab_raddr(code) (*((void **) ((void *) &code + py_v->py_code.o_lnotab)))
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_code_info__is_of(code_info_t * self, PyCodeObject * code, python_v * py_v) {
+  return self->filename_key == py_string_key((*code), o_filename)
+    && self->scope_key == (V_MIN(3, 11) ? py_string_key((*code), o_qualname) : py_string_key((*code), o_name))
+    && self->lnotab_raddr == py_code_lnotab_raddr((*code));
+}
 
 
 // ----------------------------------------------------------------------------
@@ -116,23 +154,46 @@ _read_signed_varint(unsigned char * lnotab, size_t * i) {
 }
 
 // ----------------------------------------------------------------------------
-static inline frame_t *
-_frame_from_code_raddr(py_proc_t * py_proc, void * code_raddr, int lasti, python_v * py_v) {
-  cu_uchar     * lnotab = NULL;
-  proc_ref_t     pref   = py_proc->proc_ref;
-  PyCodeObject   code;
+static inline int
+_code_info__add_line(
+  code_info_t * self,
+  int           offset,
+  unsigned int  line,
+  unsigned int  line_end,
+  unsigned int  column,
+  unsigned int  column_end
+) {
+  if (self->size >= self->capacity)
+    FAIL;
 
-  if (fail(copy_py(pref, code_raddr, py_code, code))) {
-    log_ie("Cannot read remote PyCodeObject");
+  self->lines[self->size++] = (line_entry_t) {offset, line, line_end, column, column_end};
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline code_info_t *
+_code_info_new(
+  py_proc_t     * py_proc,
+  PyCodeObject  * code,
+  unsigned char * lnotab,
+  ssize_t         len,
+  python_v      * py_v
+) {
+  proc_ref_t      pref  = py_proc->proc_ref;
+  lru_cache_t   * cache = py_proc->string_cache;
+
+  if (!isvalid(lnotab) || (V_MIN(3, 11) ? len == 0 : len % 2)) {
+    log_ie("Cannot get line information from PyCodeObject");
     return NULL;
   }
 
-  lru_cache_t * cache = py_proc->string_cache;
-
-  key_dt string_key = py_string_key(code, o_filename);
+  key_dt filename_key = py_string_key((*code), o_filename);
+  key_dt string_key   = filename_key;
   char * filename = (char *) lru_cache__maybe_hit(cache, string_key);
   if (!isvalid(filename)) {
-    filename = _code__get_filename(&code, pref, py_v);
+    filename = _code__get_filename(code, pref, py_v);
     if (!isvalid(filename)) {
       log_ie("Cannot get file name from PyCodeObject");
       return NULL;
@@ -146,12 +207,13 @@ _frame_from_code_raddr(py_proc_t * py_proc, void * code_raddr, int lasti, python
     filename = (char *) string_key;
   }
 
-  string_key = V_MIN(3, 11) ? py_string_key(code, o_qualname) : py_string_key(code, o_name);
+  key_dt scope_key = V_MIN(3, 11) ? py_string_key((*code), o_qualname) : py_string_key((*code), o_name);
+  string_key = scope_key;
   char * scope = (char *) lru_cache__maybe_hit(cache, string_key);
   if (!isvalid(scope)) {
     scope = V_MIN(3, 11)
-      ? _code__get_qualname(&code, pref, py_v)
-      : _code__get_name(&code, pref, py_v);
+      ? _code__get_qualname(code, pref, py_v)
+      : _code__get_name(code, pref, py_v);
     if (!isvalid(scope)) {
       log_ie("Cannot get scope name from PyCodeObject");
       return NULL;
@@ -165,20 +227,28 @@ _frame_from_code_raddr(py_proc_t * py_proc, void * code_raddr, int lasti, python
     scope = (char *) string_key;
   }
 
-  ssize_t len = 0;
+  // Every entry in the line table takes at least one byte, plus we need one
+  // entry for the state at the end of the table.
+  code_info_t * info = (code_info_t *) malloc(sizeof(code_info_t) + (len + 1) * sizeof(line_entry_t));
+  if (!isvalid(info)) {
+    log_e("Failed to allocate code information");
+    return NULL;
+  }
 
-  unsigned int lineno     = V_FIELD(unsigned int, code, py_code, o_firstlineno);
+  info->filename_key = filename_key;
+  info->scope_key    = scope_key;
+  info->lnotab_raddr = py_code_lnotab_raddr((*code));
+  info->filename     = filename;
+  info->scope        = scope;
+  info->size     = 0;
+  info->capacity = len + 1;
+
+  unsigned int lineno     = V_FIELD_PTR(unsigned int, code, py_code, o_firstlineno);
   unsigned int line_end   = 0;
   unsigned int column     = 0;
   unsigned int column_end = 0;
 
   if (V_MIN(3, 11)) {
-    lnotab = _code__get_lnotab(&code, pref, &len, py_v);
-    if (!isvalid(lnotab) || len == 0) {
-      log_ie("Cannot get line information from PyCodeObject");
-      return NULL;
-    }
-
     for (size_t i = 0, bc = 0; i < len; i++) {
       bc += (lnotab[i] & 7) + 1;
       int code = (lnotab[i] >> 3) & 15;
@@ -216,60 +286,84 @@ _frame_from_code_raddr(py_proc_t * py_proc, void * code_raddr, int lasti, python
           column     = 1 + (code << 3) + ((next_byte >> 4) & 7);
           column_end = column + (next_byte & 15);
       }
-      
-      if (bc > lasti)
-        break;
+
+      _code_info__add_line(info, bc, lineno, line_end, column, column_end);
     }
   }
-  else {
-    lnotab = _code__get_lnotab(&code, pref, &len, py_v);
-    if (!isvalid(lnotab) || len % 2) {
-      log_ie("Cannot get line information from PyCodeObject");
-      return NULL;
-    }
+  else if (V_MIN(3, 10)) {
+    for (int i = 0, bc = 0; i < len; i++) {
+      int sdelta = lnotab[i++];
+      if (sdelta == 0xff)
+        break;
 
-    if (V_MIN(3, 10)) {
-      lasti <<= 1;
-      for (int i = 0, bc = 0; i < len; i++) {
-        int sdelta = lnotab[i++];
-        if (sdelta == 0xff)
-          break;
+      bc += sdelta;
 
-        bc += sdelta;
+      int ldelta = lnotab[i];
+      if (ldelta == 0x80)
+        ldelta = 0;
+      else if (ldelta > 0x80)
+        lineno -= 0x100;
 
-        int ldelta = lnotab[i];
-        if (ldelta == 0x80)
-          ldelta = 0;
-        else if (ldelta > 0x80)
-          lineno -= 0x100;
+      lineno += ldelta;
 
-        lineno += ldelta;
-        if (bc > lasti)
-          break;
-      }
+      _code_info__add_line(info, bc, lineno, line_end, column, column_end);
     }
-    else { // Python < 3.10
-      for (int i = 0, bc = 0; i < len; i++) {
-        bc += lnotab[i++];
-        if (bc > lasti)
-          break;
+  }
+  else { // Python < 3.10
+    for (int i = 0, bc = 0; i < len; i++) {
+      bc += lnotab[i++];
 
-        if (lnotab[i] >= 0x80)
-          lineno -= 0x100;
+      // The line delta applies from the current offset onwards.
+      _code_info__add_line(info, bc, lineno, line_end, column, column_end);
 
-        lineno += lnotab[i];
-      }
+      if (lnotab[i] >= 0x80)
+        lineno -= 0x100;
+
+      lineno += lnotab[i];
     }
   }
 
+  // Instructions past the end of the table keep the last state.
+  info->lines[info->size++] = (line_entry_t) {INT_MAX, lineno, line_end, column, column_end};
+
+  return info;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline line_entry_t *
+_code_info__find_line(code_info_t * self, int offset) {
+  // Find the first entry that ends past the given offset. The offsets are
+  // sorted and the last entry ends at INT_MAX, so this always exists.
+  size_t lo = 0, hi = self->size - 1;
+  while (lo < hi) {
+    size_t mid = (lo + hi) >> 1;
+    if (self->lines[mid].offset > offset)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return self->lines + lo;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline frame_t *
+_frame_from_code_info(code_info_t * info, void * code_raddr, int lasti, python_v * py_v) {
+  if (V_EQ(3, 10))
+    lasti <<= 1;
+
+  line_entry_t * line = _code_info__find_line(info, lasti);
+
   frame_t * frame = frame_new(
     py_frame_key(code_raddr, lasti),
-    filename,
-    scope,
-    lineno,
-    line_end,
-    column,
-    column_end
+    info->filename,
+    info->scope,
+    line->line,
+    line->line_end,
+    line->column,
+    line->column_end
   );
   if (!isvalid(frame)) {
     log_e("Failed to create frame object");
@@ -277,4 +371,32 @@ _frame_from_code_raddr(py_proc_t * py_proc, void * code_raddr, int lasti, python
   }
 
   return frame;
-}
\ No newline at end of file
+}
+
+
+// ----------------------------------------------------------------------------
+static inline frame_t *
+_frame_from_code_raddr(py_proc_t * py_proc, void * code_raddr, int lasti, python_v * py_v) {
+  cu_uchar     * lnotab = NULL;
+  proc_ref_t     pref   = py_proc->proc_ref;
+  PyCodeObject   code;
+  ssize_t        len    = 0;
+
+  if (fail(copy_py(pref, code_raddr, py_code, code))) {
+    log_ie("Cannot read remote PyCodeObject");
+    return NULL;
+  }
+
+  code_info_t * info = (code_info_t *) lru_cache__maybe_hit(py_proc->code_cache, (key_dt) code_raddr);
+  if (!isvalid(info) || !_code_info__is_of(info, &code, py_v)) {
+    lnotab = _code__get_lnotab(&code, pref, &len, py_v);
+
+    info = _code_info_new(py_proc, &code, lnotab, len, py_v);
+    if (!isvalid(info))
+      return NULL;
+
+    lru_cache__store(py_proc->code_cache, (key_dt) code_raddr, info);
+  }
+
+  return _frame_from_code_info(info, code_raddr, lasti, py_v);
+}
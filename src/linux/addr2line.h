@@ -35,13 +35,10 @@
 #include <libiberty/demangle.h>
 #endif
 
+#include "../cache.h"
+#include "../hints.h"
 #include "../logging.h"
-#include "../stack.h"
-
-static asymbol **syms; /* Symbol table.  */
-
-static void slurp_symtab(bfd *);
-static void find_address_in_section(bfd *, asection *, void *);
+#include "../py_string.h"
 
 #define string__startswith(str, head) (strncmp(head, str, strlen(head)) == 0)
 
@@ -90,15 +87,16 @@ demangle_cython(char *function)
 
 /* Read in the symbol table.  */
 
-static void
+static asymbol **
 slurp_symtab(bfd *abfd)
 {
+    asymbol **syms = NULL;
     long storage;
     long symcount;
     bool dynamic = false;
 
     if ((bfd_get_file_flags(abfd) & HAS_SYMS) == 0)
-        return;
+        return NULL;
 
     storage = bfd_get_symtab_upper_bound(abfd);
     if (storage == 0)
@@ -107,15 +105,20 @@ slurp_symtab(bfd *abfd)
         dynamic = true;
     }
     if (storage < 0)
-        return;
+        return NULL;
 
     syms = (asymbol **)malloc(storage);
+    if (syms == NULL)
+        return NULL;
     if (dynamic)
         symcount = bfd_canonicalize_dynamic_symtab(abfd, syms);
     else
         symcount = bfd_canonicalize_symtab(abfd, syms);
     if (symcount < 0)
-        return;
+    {
+        free(syms);
+        return NULL;
+    }
 
     /* If there are no symbols left after canonicalization and
      we have not tried the dynamic symbols then give them a go.  */
@@ -123,6 +126,8 @@ slurp_symtab(bfd *abfd)
     {
         free(syms);
         syms = (asymbol **)malloc(storage);
+        if (syms == NULL)
+            return NULL;
         symcount = bfd_canonicalize_dynamic_symtab(abfd, syms);
     }
 
@@ -133,100 +138,274 @@ slurp_symtab(bfd *abfd)
         free(syms);
         syms = NULL;
     }
+
+    return syms;
 }
 
-static bfd_vma pc;
-static const char *filename;
-static const char *functionname;
-static unsigned int line;
-static unsigned int discriminator;
 
-/* Look for an address in a section.  This is called via
-   bfd_map_over_sections.  */
+// ----------------------------------------------------------------------------
+// -- Persistent symbolizer
+// ----------------------------------------------------------------------------
 
-static void
-find_address_in_section(bfd *abfd, asection *section, void *data ATTRIBUTE_UNUSED)
+// Opening an object file with BFD, checking its format and reading its symbol
+// table is way too expensive to be done for every native frame. Instead, we
+// keep every object that we have opened, together with its symbol table and an
+// index of its allocated sections sorted by VMA, for as long as the symbolizer
+// is alive. Objects that cannot be opened are remembered too, so that we don't
+// keep trying.
+
+typedef struct
 {
     bfd_vma vma;
     bfd_size_type size;
+    asection *section;
+} bfd_section_range_t;
 
-    if ((bfd_section_flags(section) & SEC_ALLOC) == 0)
-        return;
+typedef struct
+{
+    bfd *abfd;
+    asymbol **syms;
+    bfd_section_range_t *sections; /* Sorted by VMA.  */
+    int nsections;
+} bfd_object_t;
 
-    vma = bfd_section_vma(section);
-    if (pc < vma)
+typedef struct
+{
+    const char *filename; /* Owned by the BFD object.  */
+    char scope[1024];
+    unsigned int line;
+} native_symbol_t;
+
+static lookup_t *_bfd_objects = NULL;
+
+static int
+_bfd_section_range__cmp(const void *a, const void *b)
+{
+    bfd_vma vma_a = ((bfd_section_range_t *)a)->vma;
+    bfd_vma vma_b = ((bfd_section_range_t *)b)->vma;
+
+    return (vma_a > vma_b) - (vma_a < vma_b);
+}
+
+static void
+_bfd_object__index_section(bfd *abfd, asection *section, void *data)
+{
+    bfd_object_t *self = (bfd_object_t *)data;
+
+    if ((bfd_section_flags(section) & SEC_ALLOC) == 0 || bfd_section_size(section) == 0)
         return;
 
-    size = bfd_section_size(section);
-    if (pc >= vma + size)
+    bfd_section_range_t *range = self->sections + self->nsections++;
+
+    range->vma = bfd_section_vma(section);
+    range->size = bfd_section_size(section);
+    range->section = section;
+}
+
+static void
+bfd_object__destroy(bfd_object_t *self)
+{
+    if (!isvalid(self))
         return;
 
-    bfd_find_nearest_line_discriminator(abfd, section, syms, pc - vma,
-                                        &filename, &functionname,
-                                        &line, &discriminator);
+    sfree(self->sections);
+    sfree(self->syms);
+    if (isvalid(self->abfd))
+        bfd_close(self->abfd);
+
+    free(self);
 }
 
-static inline frame_t *
-get_native_frame(const char *file_name, bfd_vma addr, key_dt frame_key)
+static bfd_object_t *
+bfd_object_new(const char *file_name)
 {
-    bfd *abfd;
     char **matching;
 
+    bfd_object_t *self = (bfd_object_t *)calloc(1, sizeof(bfd_object_t));
+    if (!isvalid(self))
+        return NULL;
+
     // TODO: This would be much cheaper if we could read directly from memory.
-    abfd = bfd_openr(file_name, NULL);
-    if (abfd == NULL)
+    self->abfd = bfd_openr(file_name, NULL);
+    if (self->abfd == NULL)
     {
         log_e("Failed to open %s", file_name);
-        return NULL;
+        return self;
     }
 
     /* Decompress sections.  */
-    abfd->flags |= BFD_DECOMPRESS;
+    self->abfd->flags |= BFD_DECOMPRESS;
 
-    if (bfd_check_format(abfd, bfd_archive))
+    if (bfd_check_format(self->abfd, bfd_archive))
     {
         log_e("BFD format check failed");
-        return NULL;
+        goto invalid;
     }
 
-    if (!bfd_check_format_matches(abfd, bfd_object, &matching))
+    if (!bfd_check_format_matches(self->abfd, bfd_object, &matching))
     {
         free(matching);
         log_d("BFC format matches check failed.");
-        return NULL;
+        goto invalid;
     }
 
-    slurp_symtab(abfd);
+    self->syms = slurp_symtab(self->abfd);
+
+    self->sections = (bfd_section_range_t *)calloc(
+        bfd_count_sections(self->abfd), sizeof(bfd_section_range_t));
+    if (!isvalid(self->sections))
+        goto invalid;
+
+    bfd_map_over_sections(self->abfd, _bfd_object__index_section, self);
+    qsort(self->sections, self->nsections, sizeof(bfd_section_range_t), _bfd_section_range__cmp);
+
+    log_d("BFD object %s loaded with %d allocated sections", file_name, self->nsections);
+
+    return self;
+
+invalid:
+    bfd_close(self->abfd);
+    self->abfd = NULL;
+    return self;
+}
+
+static inline asection *
+_bfd_object__find_section(bfd_object_t *self, bfd_vma pc, bfd_vma *vma)
+{
+    int lo = 0, hi = self->nsections - 1;
+
+    while (lo <= hi)
+    {
+        int mid = (lo + hi) >> 1;
+        bfd_section_range_t *range = self->sections + mid;
 
-    // Reset global state for a new lookup
-    filename = functionname = NULL;
-    line = discriminator = 0;
-    pc = addr;
+        if (pc < range->vma)
+            hi = mid - 1;
+        else if (pc >= range->vma + range->size)
+            lo = mid + 1;
+        else
+        {
+            *vma = range->vma;
+            return range->section;
+        }
+    }
 
-    bfd_map_over_sections(abfd, find_address_in_section, NULL);
+    return NULL;
+}
 
-    const char *name;
+/**
+ * Get the BFD object for the given object file, opening it if we have never
+ * seen it before.
+ *
+ * @param file_name  the path of the object file
+ *
+ * @return a valid reference to a BFD object, NULL if the object file cannot be
+ *         used for symbolization.
+ */
+static inline bfd_object_t *
+bfd_symbolizer__get_object(const char *file_name)
+{
+    if (!isvalid(_bfd_objects))
+    {
+        bfd_init();
 
-    name = functionname;
+        _bfd_objects = lookup_new(32);
+        if (!isvalid(_bfd_objects))
+            return NULL;
+    }
+
+    key_dt key = (key_dt)string__hash((char *)file_name);
+
+    bfd_object_t *object = lookup__get(_bfd_objects, key);
+    if (!isvalid(object))
+    {
+        object = bfd_object_new(file_name);
+        if (!isvalid(object))
+            return NULL;
+
+        lookup__set(_bfd_objects, key, (value_t)object);
+    }
+
+    return isvalid(object->abfd) ? object : NULL;
+}
+
+/**
+ * Resolve an address within an object file to a function name and a source
+ * location.
+ *
+ * @param file_name  the path of the object file
+ * @param addr       the address relative to the object's load base
+ * @param symbol     the native symbol to fill in
+ *
+ * @return either SUCCESS or FAIL.
+ */
+static inline int
+bfd_symbolizer__resolve(const char *file_name, bfd_vma addr, native_symbol_t *symbol)
+{
+    const char *filename = NULL;
+    const char *functionname = NULL;
+    unsigned int line = 0;
+    unsigned int discriminator = 0;
+    bfd_vma vma = 0;
+
+    bfd_object_t *object = bfd_symbolizer__get_object(file_name);
+    if (!isvalid(object))
+        FAIL;
+
+    asection *section = _bfd_object__find_section(object, addr, &vma);
+    if (!isvalid(section))
+        FAIL;
+
+    if (!bfd_find_nearest_line_discriminator(object->abfd, section, object->syms, addr - vma,
+                                             &filename, &functionname,
+                                             &line, &discriminator) ||
+        !isvalid(filename))
+        FAIL;
+
+    const char *name = functionname;
     if (name == NULL || *name == '\0')
         name = "<unnamed>";
 #ifdef HAVE_LIBERTY
     else
     {
-        char *alloc = bfd_demangle(abfd, name, DMGL_PARAMS | DMGL_ANSI);
+        char *alloc = bfd_demangle(object->abfd, name, DMGL_PARAMS | DMGL_ANSI);
         if (alloc != NULL)
-            name = alloc;
+        {
+            strncpy(symbol->scope, alloc, sizeof(symbol->scope) - 1);
+            symbol->scope[sizeof(symbol->scope) - 1] = '\0';
+            free(alloc);
+            name = NULL;
+        }
     }
 #endif
+    if (name != NULL)
+    {
+        strncpy(symbol->scope, name, sizeof(symbol->scope) - 1);
+        symbol->scope[sizeof(symbol->scope) - 1] = '\0';
+    }
 
-    free(syms);
-    syms = NULL;
+    symbol->filename = filename;
+    symbol->line = line;
 
-    frame_t *frame = isvalid(filename) && isvalid(name)
-        ? frame_new(frame_key, strdup(filename), strdup(name), line, 0, 0, 0)
-        : NULL;
+    SUCCESS;
+}
 
-    bfd_close(abfd);
+/**
+ * Close all the object files opened by the symbolizer.
+ */
+static inline void
+bfd_symbolizer__destroy(void)
+{
+    if (!isvalid(_bfd_objects))
+        return;
+
+    lookup__iteritems_start(_bfd_objects, key_dt, key, bfd_object_t *, object)
+    {
+        (void)key;
+        bfd_object__destroy(object);
+    }
+    lookup__iter_stop(_bfd_objects);
 
-    return frame;
+    lookup__destroy(_bfd_objects);
+    _bfd_objects = NULL;
 }
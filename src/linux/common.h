@@ -23,12 +23,17 @@
 #pragma once
 
 
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ptrace.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "../cache.h"
 #include "../error.h"
 #include "../hints.h"
 #include "../stats.h"
@@ -46,12 +51,46 @@
 #endif
 
 
+// ---- PROCFS HANDLE CACHE ---------------------------------------------------
+
+// The procfs files of each thread that we read periodically.
+typedef enum {
+  PROCFS_TASK_STAT,
+  PROCFS_TASK_STACK,
+  PROCFS_TASK_SCHEDSTAT,
+} procfs_task_file_t;
+
+// The number of samples after which we close the handles that have not been
+// used. This gets rid of the handles of threads that have died.
+#define PROCFS_SWEEP_PERIOD      256
+
+typedef struct {
+  int           fd;
+  unsigned int  last_used;  // The generation at which the handle was last used
+} procfs_handle_t;
+
+// A cache of open file descriptors to the procfs files of a process and its
+// threads. Files are read with pread at offset 0, which gives fresh content
+// without reopening the file on every sample.
+typedef struct {
+  pid_t          pid;
+  int            statm_fd;
+  lookup_t     * handles;     // (tid, file) -> procfs_handle_t *
+  unsigned int   generation;  // Incremented on every sample
+} procfs_cache_t;
+
+
+struct _elf_cache_entry;  // Forward declaration.
+
 struct _proc_extra_info {
-  unsigned int page_size;
-  char         statm_file[24];
-  pthread_t    wait_thread_id;
-  unsigned int pthread_tid_offset;
-  uintptr_t    _pthread_buffer[PTHREAD_BUFFER_ITEMS];
+  unsigned int              page_size;
+  procfs_cache_t          * procfs;
+  clockid_t                 cpu_clock;      // The CPU-time clock of the process
+  int                       has_cpu_clock;
+  pthread_t                 wait_thread_id;
+  unsigned int              pthread_tid_offset;
+  struct _elf_cache_entry * elf_entry;  // The analysis of the Python binary
+  uintptr_t                 _pthread_buffer[PTHREAD_BUFFER_ITEMS];
 };
 
 
@@ -66,6 +105,7 @@ struct _proc_extra_info {
 
 #ifdef NATIVE
 #include <sched.h>
+#include <sys/syscall.h>
 
 static inline int
 wait_ptrace(enum __ptrace_request request, pid_t pid, void * addr, void * data) {
@@ -76,9 +116,11 @@ wait_ptrace(enum __ptrace_request request, pid_t pid, void * addr, void * data)
     sched_yield();
 
   #ifdef DEBUG
+  int error = errno;
   ctime_t wait = gettime() - end + 100000;
   if (wait > 1000)
     log_d("ptrace long wait for request %d: %ld microseconds", request, wait);
+  errno = error;
   #endif
   
   return outcome;
@@ -113,6 +155,168 @@ _procfs(pid_t pid, char * file) {
 }
 
 
+// ----------------------------------------------------------------------------
+static inline procfs_cache_t *
+procfs_cache_new(pid_t pid) {
+  char path[32];
+
+  procfs_cache_t * cache = (procfs_cache_t *) calloc(1, sizeof(procfs_cache_t));
+  if (!isvalid(cache))
+    return NULL;
+
+  cache->handles = lookup_new(64);
+  if (!isvalid(cache->handles)) {
+    free(cache);
+    return NULL;
+  }
+
+  sprintf(path, "/proc/%d/statm", pid);
+  cache->statm_fd = open(path, O_RDONLY);
+  cache->pid      = pid;
+
+  return cache;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline void
+procfs_cache__destroy(procfs_cache_t * self) {
+  if (!isvalid(self))
+    return;
+
+  hash_table__iter_start(self->handles->hash, procfs_handle_t *, handle) {
+    close(handle->fd);
+    free(handle);
+  } hash_table__iter_stop(self->handles->hash);
+  lookup__destroy(self->handles);
+
+  if (self->statm_fd >= 0)
+    close(self->statm_fd);
+
+  free(self);
+}
+
+
+#define _procfs_handle_key(tid, file) ((((key_dt) tid) << 2) | (file))
+
+static const char * _procfs_task_files[] = {"stat", "stack", "schedstat"};
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_procfs_cache__open(procfs_cache_t * self, uintptr_t tid, procfs_task_file_t file) {
+  char path[64];
+
+  sprintf(path, "/proc/%d/task/%lu/%s", self->pid, (unsigned long) tid, _procfs_task_files[file]);
+
+  return open(path, O_RDONLY);
+}
+
+
+/**
+ * Read a procfs file of a thread of the process. The file descriptor is kept
+ * open for subsequent reads. If the read fails, e.g. because the thread has
+ * died, the file is reopened once, in case the TID has been reused.
+ *
+ * @param procfs_cache_t      the procfs handle cache of the process
+ * @param uintptr_t           the thread ID
+ * @param procfs_task_file_t  the file to read
+ * @param char *              the destination buffer
+ * @param size_t              the size of the destination buffer
+ *
+ * @return the number of bytes read, or -1 on failure.
+ */
+static inline ssize_t
+procfs_cache__read_task(
+  procfs_cache_t * self, uintptr_t tid, procfs_task_file_t file, char * buf, size_t size
+) {
+  key_dt            key    = _procfs_handle_key(tid, file);
+  procfs_handle_t * handle = (procfs_handle_t *) lookup__get(self->handles, key);
+  ssize_t           n      = -1;
+
+  if (isvalid(handle)) {
+    n = pread(handle->fd, buf, size, 0);
+    if (n >= 0) {
+      handle->last_used = self->generation;
+      return n;
+    }
+
+    // Stale handle.
+    close(handle->fd);
+    lookup__del(self->handles, key);
+    free(handle);
+  }
+
+  int fd = _procfs_cache__open(self, tid, file);
+  if (fd == -1)
+    return -1;
+
+  n = pread(fd, buf, size, 0);
+  if (n < 0) {
+    close(fd);
+    return -1;
+  }
+
+  handle = (procfs_handle_t *) malloc(sizeof(procfs_handle_t));
+  if (!isvalid(handle)) {
+    close(fd);
+    return n;
+  }
+  handle->fd        = fd;
+  handle->last_used = self->generation;
+  lookup__set(self->handles, key, handle);
+
+  return n;
+}
+
+
+/**
+ * Read the statm file of the process.
+ *
+ * @param procfs_cache_t  the procfs handle cache of the process
+ * @param char *          the destination buffer
+ * @param size_t          the size of the destination buffer
+ *
+ * @return the number of bytes read, or -1 on failure.
+ */
+static inline ssize_t
+procfs_cache__read_statm(procfs_cache_t * self, char * buf, size_t size) {
+  if (self->statm_fd < 0)
+    return -1;
+
+  return pread(self->statm_fd, buf, size, 0);
+}
+
+
+/**
+ * Signal the end of a sample. Every PROCFS_SWEEP_PERIOD samples, the handles
+ * that have not been used since the previous sweep are closed.
+ *
+ * @param procfs_cache_t  the procfs handle cache of the process
+ */
+static inline void
+procfs_cache__tick(procfs_cache_t * self) {
+  if (!isvalid(self) || ++self->generation % PROCFS_SWEEP_PERIOD)
+    return;
+
+  lookup_t * live = lookup_new(self->handles->hash->capacity);
+  if (!isvalid(live))
+    return;
+
+  lookup__iteritems_start(self->handles, key_dt, key, procfs_handle_t *, handle) {
+    if (self->generation - handle->last_used >= PROCFS_SWEEP_PERIOD) {
+      close(handle->fd);
+      free(handle);
+    }
+    else
+      lookup__set(live, key, handle);
+  } lookup__iter_stop(self->handles);
+
+  lookup__destroy(self->handles);
+  self->handles = live;
+}
+
+
 // ----------------------------------------------------------------------------
 static inline char *
 proc_root(pid_t pid, char * file) {
@@ -0,0 +1,300 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// The results of the analysis of the ELF binaries of the Python processes we
+// attach to. The same binaries tend to be analysed over and over, e.g. when
+// sampling child processes, or when attaching to many processes that run the
+// same Python build. Hence we keep the results in memory for the whole run
+// and, if the AUSTIN_CACHE_DIR environment variable is set, we also persist
+// them to disk, keyed by the GNU build ID of the binary, for later runs.
+
+#ifndef ELF_CACHE_H
+#define ELF_CACHE_H
+
+#include <elf.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../austin.h"
+#include "../cache.h"
+#include "../hints.h"
+#include "../logging.h"
+#include "../python/symbols.h"
+#include "elf_file.h"
+
+
+#define ELF_CACHE_DIR_ENV     "AUSTIN_CACHE_DIR"
+#define ELF_CACHE_MAGIC       "AUSTINEC"
+#define ELF_CACHE_FORMAT      1
+#define ELF_CACHE_EXT         ".elf"
+
+
+// The results of the analysis of an ELF binary. Addresses are stored as
+// offsets from the address at which the binary is mapped, so that they apply
+// to any process that loads it. A zero offset means that the item was not
+// found.
+typedef struct {
+  int32_t  has_symbols;                // Whether the analysis was successful
+  int32_t  major, minor, patch;        // The Python version, if known
+  uint64_t symbols[DYNSYM_COUNT];
+  uint64_t runtime_offset;
+  uint64_t runtime_size;
+  uint64_t bss_offset;
+  uint64_t bss_size;
+} elf_info_t;
+
+
+// The identity of a binary file on this host.
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t  mtime_sec;
+  int64_t  mtime_nsec;
+} elf_id_t;
+
+
+// The header of an on-disk record. Records are only valid for the version of
+// Austin that wrote them.
+typedef struct {
+  char     magic[8];
+  uint32_t format;
+  uint32_t size;
+  char     version[16];
+} elf_cache_header_t;
+
+
+typedef struct _elf_cache_entry {
+  elf_id_t                  id;
+  elf_info_t                info;
+  int                       valid;       // Whether info holds analysis results
+  char                    * cache_file;  // The on-disk record, if any
+  struct _elf_cache_entry * next;
+} elf_cache_entry_t;
+
+
+// Entries are only ever added to the cache, and are released all together at
+// the end of the run, so processes can hold references to them. The cache is
+// only accessed by the thread that attaches to processes.
+static lookup_t          * _elf_cache         = NULL;
+static elf_cache_entry_t * _elf_cache_entries = NULL;
+static char              * _elf_cache_dir     = NULL;
+static int                 _elf_cache_dir_set = FALSE;
+
+
+// ----------------------------------------------------------------------------
+static inline uint64_t
+_fnv1a(uint64_t hash, const void * data, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ ((const unsigned char *) data)[i]) * 0x100000001b3ull;
+
+  return hash;
+}
+
+#define FNV1A_INIT 0xcbf29ce484222325ull
+
+
+// ----------------------------------------------------------------------------
+static inline void
+elf_id_from_stat(elf_id_t * self, struct stat * s) {
+  self->dev        = s->st_dev;
+  self->ino        = s->st_ino;
+  self->size       = s->st_size;
+  self->mtime_sec  = s->st_mtim.tv_sec;
+  self->mtime_nsec = s->st_mtim.tv_nsec;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline char *
+_elf_cache__get_dir(void) {
+  if (_elf_cache_dir_set)
+    return _elf_cache_dir;
+
+  _elf_cache_dir_set = TRUE;
+
+  const char * dir = getenv(ELF_CACHE_DIR_ENV);
+  if (!isvalid(dir) || *dir == '\0')
+    return NULL;
+
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    log_w("Cannot create cache directory %s", dir);
+    return NULL;
+  }
+
+  _elf_cache_dir = strdup(dir);
+  log_d("ELF cache directory: %s", _elf_cache_dir);
+
+  return _elf_cache_dir;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_elf_cache_entry__load(elf_cache_entry_t * self) {
+  elf_cache_header_t header;
+
+  cu_FILE * fp = fopen(self->cache_file, "rb");
+  if (!isvalid(fp))
+    FAIL;
+
+  if (
+    fread(&header, sizeof(header), 1, fp) != 1
+    || memcmp(header.magic, ELF_CACHE_MAGIC, sizeof(header.magic))
+    || header.format != ELF_CACHE_FORMAT
+    || header.size != sizeof(elf_info_t)
+    || strncmp(header.version, VERSION, sizeof(header.version))
+    || fread(&self->info, sizeof(elf_info_t), 1, fp) != 1
+  ) {
+    log_d("Ignoring invalid ELF cache record %s", self->cache_file);
+    FAIL;
+  }
+
+  self->valid = TRUE;
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline void
+elf_cache_entry__save(elf_cache_entry_t * self) {
+  char               tmp[1024];
+  elf_cache_header_t header = {0};
+
+  if (!isvalid(self->cache_file) || !self->valid)
+    return;
+
+  memcpy(header.magic, ELF_CACHE_MAGIC, sizeof(header.magic));
+  header.format = ELF_CACHE_FORMAT;
+  header.size   = sizeof(elf_info_t);
+  strncpy(header.version, VERSION, sizeof(header.version) - 1);
+
+  // Write to a temporary file first so that concurrent runs never see a
+  // partial record.
+  snprintf(tmp, sizeof(tmp), "%s.%d", self->cache_file, getpid());
+
+  FILE * fp = fopen(tmp, "wb");
+  if (!isvalid(fp)) {
+    log_w("Cannot write ELF cache record %s", tmp);
+    return;
+  }
+
+  int written = fwrite(&header, sizeof(header), 1, fp) == 1
+    && fwrite(&self->info, sizeof(elf_info_t), 1, fp) == 1;
+
+  if (fclose(fp) != 0 || !written || rename(tmp, self->cache_file) != 0) {
+    log_w("Cannot write ELF cache record %s", self->cache_file);
+    unlink(tmp);
+    return;
+  }
+
+  log_d("ELF cache record written to %s", self->cache_file);
+}
+
+
+// ----------------------------------------------------------------------------
+static inline elf_cache_entry_t *
+elf_cache__get(elf_id_t * id) {
+  if (!isvalid(_elf_cache))
+    return NULL;
+
+  elf_cache_entry_t * entry = (elf_cache_entry_t *) lookup__get(
+    _elf_cache, (key_dt) _fnv1a(FNV1A_INIT, id, sizeof(elf_id_t))
+  );
+
+  return isvalid(entry) && entry->valid && memcmp(&entry->id, id, sizeof(elf_id_t)) == 0
+    ? entry
+    : NULL;
+}
+
+
+// ----------------------------------------------------------------------------
+// Create a new cache entry for the binary with the given identity, mapped at
+// elf_map. If a record for the binary exists on disk, the entry is loaded
+// from it; otherwise the caller is expected to fill in the analysis results.
+static inline elf_cache_entry_t *
+elf_cache__add(elf_id_t * id, const char * path, void * elf_map, size_t size) {
+  if (!isvalid(_elf_cache)) {
+    _elf_cache = lookup_new(16);
+    if (!isvalid(_elf_cache))
+      return NULL;
+  }
+
+  elf_cache_entry_t * entry = (elf_cache_entry_t *) calloc(1, sizeof(elf_cache_entry_t));
+  if (!isvalid(entry))
+    return NULL;
+
+  entry->id   = *id;
+  entry->next = _elf_cache_entries;
+  _elf_cache_entries = entry;
+
+  key_dt key = (key_dt) _fnv1a(FNV1A_INIT, id, sizeof(elf_id_t));
+  if (!isvalid(lookup__get(_elf_cache, key)))
+    lookup__set(_elf_cache, key, entry);
+
+  char * dir = _elf_cache__get_dir();
+  if (isvalid(dir)) {
+    // Use the build ID if the binary has one. Otherwise fall back to the path
+    // and identity of the file, which are only valid on this host.
+    char name[(ELF_BUILD_ID_MAX << 1) + 1];
+    if (fail(_elf_get_build_id(elf_map, size, name)))
+      sprintf(
+        name, "%016lx",
+        (unsigned long) _fnv1a(_fnv1a(FNV1A_INIT, id, sizeof(elf_id_t)), path, strlen(path))
+      );
+
+    entry->cache_file = (char *) malloc(strlen(dir) + strlen(name) + sizeof(ELF_CACHE_EXT) + 1);
+    if (isvalid(entry->cache_file)) {
+      sprintf(entry->cache_file, "%s/%s" ELF_CACHE_EXT, dir, name);
+      if (success(_elf_cache_entry__load(entry)))
+        log_d("ELF analysis of %s loaded from %s", path, entry->cache_file);
+    }
+  }
+
+  return entry;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline void
+elf_cache__destroy(void) {
+  while (isvalid(_elf_cache_entries)) {
+    elf_cache_entry_t * next = _elf_cache_entries->next;
+    sfree(_elf_cache_entries->cache_file);
+    free(_elf_cache_entries);
+    _elf_cache_entries = next;
+  }
+
+  lookup__destroy(_elf_cache);
+  _elf_cache = NULL;
+
+  sfree(_elf_cache_dir);
+  _elf_cache_dir_set = FALSE;
+}
+
+#endif // ELF_CACHE_H
@@ -0,0 +1,286 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Minimal readers for ELF object files on disk. These have no dependencies on
+// the rest of Austin so that they can be shared with the offline tools.
+
+#ifndef ELF_FILE_H
+#define ELF_FILE_H
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../hints.h"
+
+
+#define ELF_BUILD_ID_MAX      64  // bytes
+
+
+// A range of addresses, as offsets from the address at which the object file
+// is loaded.
+typedef struct {
+  uint64_t lo;
+  uint64_t hi;
+} elf_range_t;
+
+
+// ----------------------------------------------------------------------------
+// Write the GNU build ID of the given ELF image as a hex string. The build ID
+// is stored in a note that is part of the loadable segments, so we find it via
+// the program headers.
+static inline int
+_elf_get_build_id(void * elf_map, size_t size, char * hex) {
+  Elf64_Ehdr * ehdr64 = (Elf64_Ehdr *) elf_map;
+  Elf32_Ehdr * ehdr32 = (Elf32_Ehdr *) elf_map;
+  int          is64   = ehdr64->e_ident[EI_CLASS] == ELFCLASS64;
+
+  size_t phoff     = is64 ? ehdr64->e_phoff     : ehdr32->e_phoff;
+  size_t phnum     = is64 ? ehdr64->e_phnum     : ehdr32->e_phnum;
+  size_t phentsize = is64 ? ehdr64->e_phentsize : ehdr32->e_phentsize;
+
+  if (phoff + phnum * phentsize > size)
+    FAIL;
+
+  for (size_t i = 0; i < phnum; i++) {
+    void   * phdr = elf_map + phoff + i * phentsize;
+    size_t   type, offset, filesz, align;
+
+    if (is64) {
+      Elf64_Phdr * p = (Elf64_Phdr *) phdr;
+      type = p->p_type; offset = p->p_offset; filesz = p->p_filesz; align = p->p_align;
+    } else {
+      Elf32_Phdr * p = (Elf32_Phdr *) phdr;
+      type = p->p_type; offset = p->p_offset; filesz = p->p_filesz; align = p->p_align;
+    }
+
+    if (type != PT_NOTE || offset + filesz > size)
+      continue;
+
+    // The note header has the same layout for both ELF classes.
+    align = align == 8 ? 8 : 4;
+    for (size_t off = offset; off + sizeof(Elf64_Nhdr) <= offset + filesz;) {
+      Elf64_Nhdr * note = (Elf64_Nhdr *) (elf_map + off);
+      size_t       name = off + sizeof(Elf64_Nhdr);
+      size_t       desc = name + ((note->n_namesz + align - 1) & ~(align - 1));
+
+      if (desc + note->n_descsz > offset + filesz)
+        break;
+
+      if (
+        note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4
+        && memcmp(elf_map + name, "GNU", 4) == 0
+        && note->n_descsz > 0 && note->n_descsz <= ELF_BUILD_ID_MAX
+      ) {
+        for (size_t j = 0; j < note->n_descsz; j++)
+          sprintf(hex + (j << 1), "%02x", ((unsigned char *) elf_map)[desc + j]);
+        SUCCESS;
+      }
+
+      off = desc + ((note->n_descsz + align - 1) & ~(align - 1));
+    }
+  }
+
+  FAIL;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline void *
+_elf_file__map(const char * path, size_t * size) {
+  struct stat s;
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return NULL;
+
+  void * elf_map = NULL;
+  if (fstat(fd, &s) == 0 && (size_t) s.st_size >= sizeof(Elf64_Ehdr)) {
+    elf_map = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (elf_map == MAP_FAILED)
+      elf_map = NULL;
+    else if (memcmp(elf_map, ELFMAG, SELFMAG) != 0) {
+      munmap(elf_map, s.st_size);
+      elf_map = NULL;
+    }
+    else
+      *size = s.st_size;
+  }
+
+  close(fd);
+
+  return elf_map;
+}
+
+
+// ----------------------------------------------------------------------------
+// The address at which the first loadable segment expects to be loaded. Symbol
+// values are relative to this address.
+static inline uint64_t
+_elf_get_load_base(void * elf_map, size_t size) {
+  Elf64_Ehdr * ehdr64 = (Elf64_Ehdr *) elf_map;
+  Elf32_Ehdr * ehdr32 = (Elf32_Ehdr *) elf_map;
+  int          is64   = ehdr64->e_ident[EI_CLASS] == ELFCLASS64;
+
+  size_t phoff     = is64 ? ehdr64->e_phoff     : ehdr32->e_phoff;
+  size_t phnum     = is64 ? ehdr64->e_phnum     : ehdr32->e_phnum;
+  size_t phentsize = is64 ? ehdr64->e_phentsize : ehdr32->e_phentsize;
+
+  if (phoff + phnum * phentsize > size)
+    return UINT64_MAX;
+
+  for (size_t i = 0; i < phnum; i++) {
+    void * phdr = elf_map + phoff + i * phentsize;
+    if (is64) {
+      Elf64_Phdr * p = (Elf64_Phdr *) phdr;
+      if (p->p_type == PT_LOAD)
+        return p->p_align ? p->p_vaddr - p->p_vaddr % p->p_align : p->p_vaddr;
+    } else {
+      Elf32_Phdr * p = (Elf32_Phdr *) phdr;
+      if (p->p_type == PT_LOAD)
+        return p->p_align ? p->p_vaddr - p->p_vaddr % p->p_align : p->p_vaddr;
+    }
+  }
+
+  return UINT64_MAX;
+}
+
+
+/**
+ * Get the GNU build ID of an object file.
+ *
+ * @param path  the path of the object file
+ * @param hex   the buffer to write the build ID to, as a hex string. This must
+ *              be at least (ELF_BUILD_ID_MAX << 1) + 1 bytes long.
+ *
+ * @return either SUCCESS or FAIL.
+ */
+static inline int
+elf_file__get_build_id(const char * path, char * hex) {
+  size_t size    = 0;
+  void * elf_map = _elf_file__map(path, &size);
+  if (!isvalid(elf_map))
+    FAIL;
+
+  int result = _elf_get_build_id(elf_map, size, hex);
+
+  munmap(elf_map, size);
+
+  return result;
+}
+
+
+/**
+ * Find the ranges of the functions of an object file whose names contain the
+ * given string. Both the static and the dynamic symbol tables are searched.
+ *
+ * @param path    the path of the object file
+ * @param needle  the string to look for in the function names
+ * @param ranges  the array to store the ranges into
+ * @param max     the size of the ranges array
+ *
+ * @return the number of ranges found, or -1 if the object file cannot be read.
+ */
+static inline int
+elf_file__find_functions(const char * path, const char * needle, elf_range_t * ranges, int max) {
+  size_t size    = 0;
+  void * elf_map = _elf_file__map(path, &size);
+  if (!isvalid(elf_map))
+    return -1;
+
+  Elf64_Ehdr * ehdr64 = (Elf64_Ehdr *) elf_map;
+  Elf32_Ehdr * ehdr32 = (Elf32_Ehdr *) elf_map;
+  int          is64   = ehdr64->e_ident[EI_CLASS] == ELFCLASS64;
+
+  size_t   shoff     = is64 ? ehdr64->e_shoff     : ehdr32->e_shoff;
+  size_t   shnum     = is64 ? ehdr64->e_shnum     : ehdr32->e_shnum;
+  size_t   shentsize = is64 ? ehdr64->e_shentsize : ehdr32->e_shentsize;
+  uint64_t base      = _elf_get_load_base(elf_map, size);
+  int      n         = 0;
+
+  if (base == UINT64_MAX || shoff + shnum * shentsize > size)
+    goto done;
+
+  for (size_t i = 0; i < shnum && n < max; i++) {
+    void   * shdr = elf_map + shoff + i * shentsize;
+    size_t   type, offset, secsize, entsize, link;
+
+    if (is64) {
+      Elf64_Shdr * s = (Elf64_Shdr *) shdr;
+      type = s->sh_type; offset = s->sh_offset; secsize = s->sh_size; entsize = s->sh_entsize; link = s->sh_link;
+    } else {
+      Elf32_Shdr * s = (Elf32_Shdr *) shdr;
+      type = s->sh_type; offset = s->sh_offset; secsize = s->sh_size; entsize = s->sh_entsize; link = s->sh_link;
+    }
+
+    if ((type != SHT_SYMTAB && type != SHT_DYNSYM) || entsize == 0 || offset + secsize > size || link >= shnum)
+      continue;
+
+    void * strtab_hdr = elf_map + shoff + link * shentsize;
+    size_t strtab     = is64 ? ((Elf64_Shdr *) strtab_hdr)->sh_offset : ((Elf32_Shdr *) strtab_hdr)->sh_offset;
+    size_t strtab_end = strtab + (is64 ? ((Elf64_Shdr *) strtab_hdr)->sh_size : ((Elf32_Shdr *) strtab_hdr)->sh_size);
+    if (strtab_end > size)
+      continue;
+
+    for (size_t off = offset; off + entsize <= offset + secsize && n < max; off += entsize) {
+      size_t   name, kind;
+      uint64_t value, symsize;
+
+      if (is64) {
+        Elf64_Sym * sym = (Elf64_Sym *) (elf_map + off);
+        name = sym->st_name; kind = ELF64_ST_TYPE(sym->st_info); value = sym->st_value; symsize = sym->st_size;
+      } else {
+        Elf32_Sym * sym = (Elf32_Sym *) (elf_map + off);
+        name = sym->st_name; kind = ELF32_ST_TYPE(sym->st_info); value = sym->st_value; symsize = sym->st_size;
+      }
+
+      if (
+        kind != STT_FUNC || symsize == 0 || value < base || strtab + name >= strtab_end
+        || strnlen(elf_map + strtab + name, strtab_end - strtab - name) == strtab_end - strtab - name
+        || !isvalid(strstr(elf_map + strtab + name, needle))
+      )
+        continue;
+
+      // The same function is likely to appear in both symbol tables.
+      int seen = FALSE;
+      for (int j = 0; j < n && !seen; j++)
+        seen = ranges[j].lo == value - base;
+      if (seen)
+        continue;
+
+      ranges[n].lo   = value - base;
+      ranges[n++].hi = value - base + symsize;
+    }
+  }
+
+done:
+  munmap(elf_map, size);
+
+  return n;
+}
+
+#endif
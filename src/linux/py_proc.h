@@ -36,6 +36,8 @@
 #include <unistd.h>
 
 #include "common.h"
+#include "elf_cache.h"
+#include "elf_file.h"
 #include "futils.h"
 #include "../mem.h"
 #include "../resources.h"
@@ -285,7 +287,116 @@ _elf_check(Elf64_Ehdr * ehdr) {
 
 // ----------------------------------------------------------------------------
 static int
-_py_proc__analyze_elf(py_proc_t * self, char * path, void * elf_base) {
+_py_proc__analyze_elf_map(py_proc_t * self, char * path, void * elf_map, void * elf_base) {
+  Elf64_Ehdr * ehdr = elf_map;
+  log_t("Analysing ELF");
+
+  if (fail(_elf_check(ehdr))) {
+    log_e("Bad ELF header");
+    set_error(EPROC);
+    FAIL;
+  }
+
+  // Dispatch
+  switch (ehdr->e_ident[EI_CLASS]) {
+  case ELFCLASS64:
+    log_d("%s is 64-bit ELF", path);
+    return _py_proc__analyze_elf64(self, elf_map, elf_base);
+
+  case ELFCLASS32:
+    log_d("%s is 32-bit ELF", path);
+    return _py_proc__analyze_elf32(self, elf_map, elf_base);
+
+  default:
+    log_e("%s has invalid ELF class", path);
+    set_error(EPROC);
+    FAIL;
+  }
+} /* _py_proc__analyze_elf_map */
+
+
+// ----------------------------------------------------------------------------
+// Analyse the ELF image and record what we find in the given cache entry, as
+// offsets from the base address. The process state is left as if the analysis
+// had not been done, so that the results can be applied in the same way as
+// those coming from the cache.
+static void
+_py_proc__analyze_elf_into(
+  py_proc_t         * self,
+  char              * path,
+  void              * elf_map,
+  void              * elf_base,
+  elf_cache_entry_t * entry
+) {
+  void   * symbols[DYNSYM_COUNT];
+  void   * runtime_base = self->map.runtime.base;
+  size_t   runtime_size = self->map.runtime.size;
+  void   * bss_base     = self->map.bss.base;
+  size_t   bss_size     = self->map.bss.size;
+
+  memcpy(symbols, self->symbols, sizeof(symbols));
+  memset(self->symbols, 0, sizeof(symbols));
+  self->map.runtime.base = NULL;
+  self->map.runtime.size = 0;
+
+  elf_info_t * info = &entry->info;
+
+  info->has_symbols = success(_py_proc__analyze_elf_map(self, path, elf_map, elf_base));
+
+  for (int i = 0; i < DYNSYM_COUNT; i++)
+    info->symbols[i] = isvalid(self->symbols[i]) ? self->symbols[i] - elf_base : 0;
+
+  if (isvalid(self->map.runtime.base)) {
+    info->runtime_offset = self->map.runtime.base - elf_base;
+    info->runtime_size   = self->map.runtime.size;
+  }
+
+  if (info->has_symbols && isvalid(self->map.bss.base)) {
+    info->bss_offset = self->map.bss.base - elf_base;
+    info->bss_size   = self->map.bss.size;
+  }
+
+  entry->valid = TRUE;
+
+  memcpy(self->symbols, symbols, sizeof(symbols));
+  self->map.runtime.base = runtime_base;
+  self->map.runtime.size = runtime_size;
+  self->map.bss.base     = bss_base;
+  self->map.bss.size     = bss_size;
+} /* _py_proc__analyze_elf_into */
+
+
+// ----------------------------------------------------------------------------
+static int
+_py_proc__apply_elf_info(py_proc_t * self, elf_info_t * info, void * elf_base) {
+  for (int i = 0; i < DYNSYM_COUNT; i++) {
+    if (info->symbols[i]) {
+      self->symbols[i] = elf_base + info->symbols[i];
+      log_d("Symbol %s found @ %p", _dynsym_array[i], self->symbols[i]);
+    }
+  }
+
+  if (info->runtime_offset) {
+    self->map.runtime.base = elf_base + info->runtime_offset;
+    self->map.runtime.size = info->runtime_size;
+  }
+
+  if (!info->has_symbols) {
+    set_error(ESYM);
+    FAIL;
+  }
+
+  // Communicate BSS data back to the caller
+  self->map.bss.base = info->bss_offset ? elf_base + info->bss_offset : NULL;
+  self->map.bss.size = info->bss_size;
+
+  SUCCESS;
+} /* _py_proc__apply_elf_info */
+
+
+// ----------------------------------------------------------------------------
+static int
+_py_proc__analyze_elf(py_proc_t * self, char * path, void * elf_base, elf_cache_entry_t ** entry) {
   cu_fd fd = open(path, O_RDONLY);
   if (fd == -1) {
     log_e("Cannot open binary file %s", path);
@@ -296,6 +407,7 @@ _py_proc__analyze_elf(py_proc_t * self, char * path, void * elf_base) {
   cu_map_t    * binary_map  = NULL;
   size_t        binary_size = 0;
   struct stat   s;
+  elf_id_t      id;
 
   if (fstat(fd, &s) == -1) {
     log_ie("Cannot determine size of binary file");
@@ -303,6 +415,13 @@ _py_proc__analyze_elf(py_proc_t * self, char * path, void * elf_base) {
     FAIL;
   }
 
+  elf_id_from_stat(&id, &s);
+  *entry = elf_cache__get(&id);
+  if (isvalid(*entry)) {
+    log_d("ELF analysis of %s found in cache", path);
+    return _py_proc__apply_elf_info(self, &(*entry)->info, elf_base);
+  }
+
   binary_size = s.st_size;
 
   binary_map = map_new(fd, binary_size, MAP_PRIVATE);
@@ -312,30 +431,17 @@ _py_proc__analyze_elf(py_proc_t * self, char * path, void * elf_base) {
     FAIL;
   }
 
-  Elf64_Ehdr * ehdr = binary_map->addr;
-  log_t("Analysing ELF");
+  *entry = elf_cache__add(&id, path, binary_map->addr, binary_size);
+  if (!isvalid(*entry))
+    // We cannot cache the results, but we can still use them.
+    return _py_proc__analyze_elf_map(self, path, binary_map->addr, elf_base);
 
-  if (fail(_elf_check(ehdr))) {
-    log_e("Bad ELF header");
-    set_error(EPROC);
-    FAIL;
+  if (!(*entry)->valid) {
+    _py_proc__analyze_elf_into(self, path, binary_map->addr, elf_base, *entry);
+    elf_cache_entry__save(*entry);
   }
 
-  // Dispatch
-  switch (ehdr->e_ident[EI_CLASS]) {
-  case ELFCLASS64:
-    log_d("%s is 64-bit ELF", path);
-    return _py_proc__analyze_elf64(self, binary_map->addr, elf_base);
-
-  case ELFCLASS32:
-    log_d("%s is 32-bit ELF", path);
-    return _py_proc__analyze_elf32(self, binary_map->addr, elf_base);
-
-  default:
-    log_e("%s has invalid ELF class", path);
-    set_error(EPROC);
-    FAIL;
-  }
+  return _py_proc__apply_elf_info(self, &(*entry)->info, elf_base);
 } /* _py_proc__analyze_elf */
 
 
@@ -350,7 +456,8 @@ _py_proc__parse_maps_file(py_proc_t * self) {
   size_t    len         = 0;
   int       maps_flag   = 0;
 
-  struct vm_map * map = NULL;
+  struct vm_map     * map                = NULL;
+  elf_cache_entry_t * entries[MAP_COUNT] = {NULL};
 
   fp = _procfs(self->pid, "maps");
   if (fp == NULL) {
@@ -464,7 +571,7 @@ _py_proc__parse_maps_file(py_proc_t * self) {
       map->file_size = _file_size(map->path);
       map->base = (void *) lower;
       map->size = upper - lower;
-      map->has_symbols = success(_py_proc__analyze_elf(self, map->path, (void *) lower));
+      map->has_symbols = success(_py_proc__analyze_elf(self, map->path, (void *) lower, &entries[MAP_BIN]));
       if (map->has_symbols) {
         map->bss_base = self->map.bss.base;
         map->bss_size = self->map.bss.size;
@@ -476,7 +583,7 @@ _py_proc__parse_maps_file(py_proc_t * self) {
     // The first memory map of the shared library (if any)
     char * needle = strstr(pathname, "libpython");
     if (!isvalid(pd->maps[MAP_LIBSYM].path) && isvalid(needle)) {
-      int has_symbols = success(_py_proc__analyze_elf(self, pathname, (void *) lower));
+      int has_symbols = success(_py_proc__analyze_elf(self, pathname, (void *) lower, &entries[MAP_LIBSYM]));
       if (has_symbols) {
         map = &(pd->maps[MAP_LIBSYM]);
         map->path = proc_root(self->pid, pathname);
@@ -531,7 +638,9 @@ _py_proc__parse_maps_file(py_proc_t * self) {
   self->bin_path = pd->maps[MAP_BIN].path;
   self->lib_path = pd->maps[MAP_LIBSYM].path;
 
-  // Work out binary map
+  // Work out binary map. The Python version is a property of the binary that
+  // has the symbols, so that is where we cache it.
+  self->extra->elf_entry = entries[MAP_BIN];
   for (int i = 0; i < MAP_COUNT; i++) {
     map = &(pd->maps[i]);
     if (map->has_symbols) {
@@ -539,6 +648,7 @@ _py_proc__parse_maps_file(py_proc_t * self) {
       self->map.exe.size = map->size;
       maps_flag |= BIN_MAP;
       self->sym_loaded = TRUE;
+      self->extra->elf_entry = entries[i];
       break;
     }
   }
@@ -588,48 +698,81 @@ _py_proc__parse_maps_file(py_proc_t * self) {
 // ----------------------------------------------------------------------------
 static ssize_t
 _py_proc__get_resident_memory(py_proc_t * self) {
-  FILE * statm = fopen(self->extra->statm_file, "rb");
-  if (statm == NULL) {
+  char buffer[128];
+
+  ssize_t n = procfs_cache__read_statm(self->extra->procfs, buffer, sizeof(buffer) - 1);
+  if (n <= 0) {
     set_error(EPROCVM);
     return -1;
   }
+  buffer[n] = '\0';
 
-  int ret = 0;
-
-  ssize_t size, resident;
-  if (fscanf(statm, SIZE_FMT " " SIZE_FMT, &size, &resident) != 2)
-    ret = -1;
+  // The statm file has the format "size resident ...", in pages.
+  char * p = buffer;
+  while (*p >= '0' && *p <= '9') p++;
+  if (*p++ != ' ' || *p < '0' || *p > '9')
+    return -1;
 
-  fclose(statm);
+  ssize_t resident = 0;
+  while (*p >= '0' && *p <= '9')
+    resident = resident * 10 + (*p++ - '0');
 
-  return ret ? ret : resident * self->extra->page_size;
+  return resident * self->extra->page_size;
 } /* _py_proc__get_resident_memory */
 
 
+// ----------------------------------------------------------------------------
+static uint64_t
+_py_proc__get_cpu_time(py_proc_t * self) {
+  struct timespec ts;
+
+  if (!self->extra->has_cpu_clock || clock_gettime(self->extra->cpu_clock, &ts))
+    return 0;
+
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+} /* _py_proc__get_cpu_time */
+
+
 #ifdef NATIVE
 // ----------------------------------------------------------------------------
 char         pathname[1024];
 char         prevpathname[1024];
-vm_range_t * ranges[256];
+
+// In raw mode we emit the VM maps as MOJO events, together with the build ID of
+// the mapped object files, so that the native frames can be resolved offline.
+// When the maps are re-read we only emit the changes.
+static inline void
+_py_proc__emit_map(py_proc_t * self, vm_range_t * range) {
+  char build_id[(ELF_BUILD_ID_MAX << 1) + 1] = "";
+
+  if (fail(elf_file__get_build_id(range->name, build_id)))
+    build_id[0] = '\0';
+
+  addr_t base = (addr_t) hash_table__get(self->base_table, string__hash(range->name));
+
+  mojo_map(self->pid, range->lo, range->hi, base, range->name, build_id);
+}
 
 static int
 _py_proc__get_vm_maps(py_proc_t * self) {
   cu_FILE         * fp    = NULL;
   cu_char         * line  = NULL;
   size_t            len   = 0;
-  vm_range_tree_t * tree  = NULL;
+  vm_range_tree_t * maps  = NULL;
+  vm_range_tree_t * tree  = self->maps_tree;
   hash_table_t    * table = NULL;
   
-  if (pargs.where) {
-    tree  = vm_range_tree_new();
-    table = hash_table_new(256);
-    
-    vm_range_tree__destroy(self->maps_tree);
-    hash_table__destroy(self->base_table);
-    
-    self->maps_tree = tree; 
-    self->base_table = table;
-  }
+  // With BFD support we resolve native frames to source locations while
+  // sampling, so we need the VM maps in all modes. Otherwise we only need them
+  // in `where` mode, and in raw mode to track the changes to the maps. In the
+  // other cases, we emit them as metadata for later resolution.
+  #ifdef HAVE_BFD
+  int build_tree = TRUE;
+  #else
+  int build_tree = pargs.where || pargs.raw;
+  #endif
+  int emit_maps  = pargs.raw;
+  int emit_meta  = !pargs.where && !emit_maps;
 
   fp = _procfs(self->pid, "maps");
   if (!isvalid(fp)) {
@@ -637,64 +780,277 @@ _py_proc__get_vm_maps(py_proc_t * self) {
     FAIL;
   }
 
-  log_d("Rebuilding vm ranges tree");
+  if (build_tree) {
+    if (!isvalid(tree)) {
+      tree = vm_range_tree_new();
+      if (!isvalid(tree)) {
+        set_error(EPROC);
+        FAIL;
+      }
+      self->maps_tree = tree;
+    }
+
+    maps  = vm_range_tree_new();
+    table = hash_table_new(256);
+    if (!isvalid(maps) || !isvalid(table)) {
+      vm_range_tree__destroy(maps);
+      hash_table__destroy(table);
+      set_error(EPROC);
+      FAIL;
+    }
+
+    hash_table__destroy(self->base_table);
+    self->base_table = table;
+  }
+
+  log_d("Reading the VM maps");
+
+  prevpathname[0] = '\0';
 
-  int    nrange  = 0;
-  while (getline(&line, &len, fp) != -1 && nrange < 256) {
+  vm_range_t * last = NULL;
+  while (getline(&line, &len, fp) != -1) {
     ssize_t lower, upper;
 
     if (sscanf(line, ADDR_FMT "-" ADDR_FMT " %*s %*x %*x:%*x %*x %s\n",
       &lower, &upper, // Map bounds
       pathname        // Binary path
     ) == 3 && pathname[0] != '[') {
-      if (pargs.where) {
-        if (strcmp(pathname, prevpathname)) {
-          ranges[nrange++] = vm_range_new(lower, upper, strdup(pathname));
-          key_dt key = string__hash(pathname);
-          if (!isvalid(hash_table__get(table, key)))
-            hash_table__set(table, key, (value_t) lower);
-          strcpy(prevpathname, pathname);
-        } else
-          ranges[nrange-1]->hi = upper;
+      if (!build_tree) {
+        if (emit_meta)
+          // We print the maps too so that we can later resolve the native
+          // frames that we could not resolve while sampling.
+          emit_metadata("map", ADDR_FMT "-" ADDR_FMT " %s", lower, upper, pathname);
+        continue;
+      }
+
+      if (isvalid(last) && strcmp(pathname, prevpathname) == 0) {
+        last->hi = upper;
+        continue;
       }
-      else
-        // We print the maps instead so that we can resolve them later and use
-        // the CPU more efficiently to collect samples.
-        emit_metadata("map", ADDR_FMT "-" ADDR_FMT " %s", lower, upper, pathname);
+
+      // The maps are sorted by address, so this is always an append.
+      last = vm_range_tree__add(maps, lower, upper, strdup(pathname));
+      if (!isvalid(last))
+        break;
+
+      key_dt key = string__hash(pathname);
+      if (!isvalid(hash_table__get(table, key)))
+        hash_table__set(table, key, (value_t) lower);
+      strcpy(prevpathname, pathname);
+    }
+  }
+
+  if (build_tree) {
+    // Update the tree in place with the changes to the maps. We remove the
+    // ranges that are gone first, as new ones might take their place.
+    for (size_t i = tree->size; i-- > 0;) {
+      vm_range_t * range = tree->ranges + i;
+      if (vm_range_tree__has(maps, range))
+        continue;
+      if (emit_maps)
+        mojo_unmap(self->pid, range->lo, range->hi);
+      vm_range_tree__remove(tree, range);
+    }
+
+    for (size_t i = 0; i < maps->size; i++) {
+      vm_range_t * range = maps->ranges + i;
+      if (vm_range_tree__has(tree, range))
+        continue;
+      if (emit_maps)
+        _py_proc__emit_map(self, range);
+      else if (emit_meta)
+        emit_metadata("map", ADDR_FMT "-" ADDR_FMT " %s", range->lo, range->hi, range->name);
+      if (!isvalid(vm_range_tree__add(tree, range->lo, range->hi, strdup(range->name))))
+        break;
     }
+
+    log_d("VM maps: %zu ranges", tree->size);
+
+    vm_range_tree__destroy(maps);
   }
 
-  for (int i = 0; i < nrange; i++)
-    vm_range_tree__add(tree, (vm_range_t *) ranges[i]); 
+  self->maps_timestamp = gettime();
 
   SUCCESS;
 } /* _py_proc__get_vm_maps */
+
+
+// ----------------------------------------------------------------------------
+// Find the frame evaluation functions in the Python binary and library, which
+// are the ones whose names contain PyEval_EvalFrameDefault, like the native
+// frame stack interleaving logic expects. These include any parts that the
+// compiler has split off, like the cold paths.
+static void
+_py_proc__get_eval_ranges(py_proc_t * self) {
+  char       * paths[] = {self->bin_path, self->lib_path};
+  elf_range_t  found[MAX_EVAL_RANGES];
+
+  self->n_eval_ranges = 0;
+
+  for (int i = 0; i < 2; i++) {
+    if (!isvalid(paths[i]))
+      continue;
+
+    addr_t base = (addr_t) hash_table__get(self->base_table, string__hash(paths[i]));
+    if (base == 0)
+      continue;
+
+    int n = elf_file__find_functions(
+      paths[i], "PyEval_EvalFrameDefault", found, MAX_EVAL_RANGES - self->n_eval_ranges
+    );
+    for (int j = 0; j < n; j++) {
+      self->eval_ranges[self->n_eval_ranges].lo   = base + found[j].lo;
+      self->eval_ranges[self->n_eval_ranges++].hi = base + found[j].hi;
+    }
+  }
+
+  if (self->n_eval_ranges == 0)
+    log_w("Cannot find the frame evaluation function; raw native frames will not be interleaved");
+  else
+    log_d("Found %d frame evaluation function ranges", self->n_eval_ranges);
+} /* _py_proc__get_eval_ranges */
 #endif
 
 
 // ----------------------------------------------------------------------------
 static int
-_py_proc__init(py_proc_t * self) {
-  if (!isvalid(self) || fail(_py_proc__parse_maps_file(self))) {
+_py_proc__init_extra(py_proc_t * self) {
+  self->extra->page_size = getpagesize();
+  log_d("Page size: %u", self->extra->page_size);
+
+  self->extra->procfs = procfs_cache_new(self->pid);
+  if (!isvalid(self->extra->procfs)) {
+    log_e("Cannot create procfs handle cache");
     set_error(EPROC);
     FAIL;
   }
 
-  self->extra->page_size = getpagesize();
-  log_d("Page size: %u", self->extra->page_size);
-
-  sprintf(self->extra->statm_file, "/proc/%d/statm", self->pid);
+  self->extra->has_cpu_clock = clock_getcpuclockid(self->pid, &self->extra->cpu_clock) == 0;
+  if (!self->extra->has_cpu_clock)
+    log_d("Cannot get the CPU-time clock of the process");
 
   self->last_resident_memory = _py_proc__get_resident_memory(self);
 
   #ifdef NATIVE
   _py_proc__get_vm_maps(self);
+  if (pargs.raw)
+    _py_proc__get_eval_ranges(self);
   #endif
 
   SUCCESS;
+} /* _py_proc__init_extra */
+
+
+// ----------------------------------------------------------------------------
+static int
+_py_proc__init(py_proc_t * self) {
+  if (!isvalid(self) || fail(_py_proc__parse_maps_file(self))) {
+    set_error(EPROC);
+    FAIL;
+  }
+
+  return _py_proc__init_extra(self);
 } /* _py_proc__init */
 
 
+// ----------------------------------------------------------------------------
+static inline int
+_py_proc__get_cached_version(py_proc_t * self, int * major, int * minor, int * patch) {
+  elf_cache_entry_t * entry = self->extra->elf_entry;
+  if (!isvalid(entry) || entry->info.major == 0)
+    FAIL;
+
+  *major = entry->info.major;
+  *minor = entry->info.minor;
+  *patch = entry->info.patch;
+
+  SUCCESS;
+} /* _py_proc__get_cached_version */
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_py_proc__set_cached_version(py_proc_t * self, int major, int minor, int patch) {
+  elf_cache_entry_t * entry = self->extra->elf_entry;
+  if (
+    !isvalid(entry)
+    || (entry->info.major == major && entry->info.minor == minor && entry->info.patch == patch)
+  ) return;
+
+  entry->info.major = major;
+  entry->info.minor = minor;
+  entry->info.patch = patch;
+
+  elf_cache_entry__save(entry);
+} /* _py_proc__set_cached_version */
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_same_file(const char * a, const char * b) {
+  struct stat sa, sb;
+
+  return isvalid(a) && isvalid(b) && stat(a, &sa) == 0 && stat(b, &sb) == 0
+    && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+
+// ----------------------------------------------------------------------------
+static int
+_py_proc__init_from_parent(py_proc_t * self, py_proc_t * parent) {
+  char      file_name[32];
+  cu_FILE * fp   = NULL;
+  cu_char * line = NULL;
+  size_t    len  = 0;
+  int       found = FALSE;
+
+  if (!isvalid(parent->map.exe.base))
+    FAIL;
+
+  // The child must run the same executable as the parent ...
+  char parent_exe[32];
+  sprintf(file_name, "/proc/%d/exe", self->pid);
+  sprintf(parent_exe, "/proc/%d/exe", parent->pid);
+  if (!_same_file(file_name, parent_exe)) {
+    log_d("Process %d does not share the executable of its parent", self->pid);
+    FAIL;
+  }
+
+  // ... and have the binary with the symbols mapped at the same address. This
+  // rules out children that re-executed the parent's binary, since they would
+  // normally have a different layout.
+  fp = _procfs(self->pid, "maps");
+  if (!isvalid(fp)) {
+    set_error(EPROCVM);
+    FAIL;
+  }
+
+  while (!found && getline(&line, &len, fp) != -1) {
+    ssize_t lower, upper;
+    char    pathname[1024] = {0};
+
+    if (sscanf(line, ADDR_FMT "-" ADDR_FMT " %*s %*x %*x:%*x %*x %s\n",
+      &lower, &upper, pathname
+    ) != 3 || (void *) lower != parent->map.exe.base || pathname[0] != '/')
+      continue;
+
+    cu_char * path = proc_root(self->pid, pathname);
+    found = _same_file(path, parent->bin_path) || _same_file(path, parent->lib_path);
+    break;
+  }
+
+  if (!found) {
+    log_d("Process %d does not share the memory layout of its parent", self->pid);
+    FAIL;
+  }
+
+  self->extra->pthread_tid_offset = parent->extra->pthread_tid_offset;
+  self->extra->elf_entry          = parent->extra->elf_entry;
+
+  return _py_proc__init_extra(self);
+} /* _py_proc__init_from_parent */
+
+
 // ----------------------------------------------------------------------------
 pid_t
 _get_nspid(pid_t pid) {
@@ -36,31 +36,44 @@
 // ----------------------------------------------------------------------------
 static int
 _py_thread__is_idle(py_thread_t * self) {
-  char file_name[64];
-  char buffer[2048] = "";
+  char buffer[512];
 
-  sprintf(file_name, "/proc/%d/task/" SIZE_FMT "/stat", self->proc->pid, self->tid);
-  
-  cu_fd fd = open(file_name, O_RDONLY);
-  if (fd == -1) {
-    log_d("Cannot open %s", file_name);
+  ssize_t n = procfs_cache__read_task(
+    self->proc->extra->procfs, self->tid, PROCFS_TASK_STAT, buffer, sizeof(buffer) - 1
+  );
+  if (n <= 0) {
+    log_d("Cannot read stat file of thread " SIZE_FMT, self->tid);
     return -1;
   }
+  buffer[n] = '\0';
 
-  if (read(fd, buffer, 2047) == 0) {
-    log_d("Cannot read %s", file_name);
+  // The state field follows the command name, which is enclosed in brackets
+  // and might itself contain closing brackets.
+  char * p = strrchr(buffer, ')');
+  if (!isvalid(p) || p[1] != ' ' || p[2] == '\0') {
+    log_d("Invalid format for stat file of thread " SIZE_FMT, self->tid);
     return -1;
   }
 
-  char * p = strchr(buffer, ')');
-  if (!isvalid(p)) {
-    log_d("Invalid format for procfs file %s", file_name);
-    return -1;
-  }
+  return (p[2] != 'R');
+}
+
+
+// ----------------------------------------------------------------------------
+// Get the time, in nanoseconds, that the thread has spent running on a CPU.
+// This changes whenever the thread is scheduled, so it tells whether the
+// thread could have made any progress between two samples. Returns 0 if the
+// information is not available.
+static inline uint64_t
+_py_thread__run_time(py_thread_t * self) {
+  char buffer[64];
 
-  p+=2;
-  if (*p == ' ')
-    p++;
+  ssize_t n = procfs_cache__read_task(
+    self->proc->extra->procfs, self->tid, PROCFS_TASK_SCHEDSTAT, buffer, sizeof(buffer) - 1
+  );
+  if (n <= 0)
+    return 0;
+  buffer[n] = '\0';
 
-  return (*p != 'R');
+  return strtoull(buffer, NULL, 10);
 }
@@ -25,168 +25,166 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "../hints.h"
 
 typedef uintptr_t addr_t;
 
-typedef struct _vmrange {
-  addr_t            lo, hi;
-  char            * name;
-  struct _vmrange * left;
-  struct _vmrange * right;
-  int               height;
+typedef struct {
+  addr_t   lo, hi;
+  char   * name;
 } vm_range_t;
 
-typedef struct{
-  vm_range_t *root;
+// The VM ranges are kept in an array sorted by their lower bound, so that a
+// look-up is a binary search over contiguous memory. The VM maps of a process
+// change rarely, and when they do the changes are small, so the cost of
+// shifting the array on insertions and removals is negligible.
+typedef struct {
+  vm_range_t * ranges;
+  size_t       size;
+  size_t       capacity;
 } vm_range_tree_t;
 
-#define max(a, b) ((a > b) ? a : b)
-#define vm_range__height(r) (isvalid(r) ? r->height : 0)
 
-#ifdef PY_PROC_C
+// Return the index of the first range whose lower bound is greater than the
+// given address. The search is branchless, as the outcome of each comparison is
+// essentially random.
+static inline size_t
+_vm_range_tree__bisect(vm_range_tree_t *self, addr_t addr) {
+  vm_range_t *base = self->ranges;
+  size_t      n    = self->size;
 
-/**
- * Create a new VM range.
- * 
- * @param lo    the range lower bound
- * @param hi    the range upper bound
- * @param name  the name of the VM map (takes ownership)
- * 
- * @return a valid reference to a VM range object, NULL otherwise.
- */
-vm_range_t *
-vm_range_new(addr_t lo, addr_t hi, char *name) {
-  vm_range_t *range = (vm_range_t *)malloc(sizeof(vm_range_t));
+  if (n == 0)
+    return 0;
 
-  range->lo = lo;
-  range->hi = hi;
-  range->name = name;
-  range->left = NULL;
-  range->right = NULL;
-  range->height = 1;
+  while (n > 1) {
+    size_t half = n >> 1;
+    base = base[half].lo <= addr ? base + half : base;
+    n -= half;
+  }
 
-  return range;
+  return (base - self->ranges) + (base->lo <= addr);
 }
 
-/**
- * Deallocate a VM range.
- * 
- * @param self  the VM range to deallocate.
- */
-void
-vm_range__destroy(vm_range_t *self) {
-  if (!isvalid(self))
-    return;
-
-  sfree(self->name);
-  
-  vm_range__destroy(self->left);
-  vm_range__destroy(self->right);
 
-  free(self);
-}
+static inline vm_range_t *
+_vm_range_tree__find(vm_range_tree_t *self, addr_t addr) {
+  size_t i = _vm_range_tree__bisect(self, addr);
+  if (i == 0)
+    return NULL;
 
+  vm_range_t *range = self->ranges + i - 1;
 
-static inline vm_range_t *
-_vm_range__rrot(vm_range_t *self) {
-  vm_range_t *x = self->left;
-  vm_range_t *T2 = x->right;
+  return addr < range->hi ? range : NULL;
+}
 
-  x->right = self;
-  self->left = T2;
 
-  self->height = max(vm_range__height(self->left), vm_range__height(self->right)) + 1;
-  x->height = max(vm_range__height(x->left), vm_range__height(x->right)) + 1;
+#ifdef PY_PROC_C
 
-  return x;
+/**
+ * Create a new VM range tree. This is a sorted array that is meant to store
+ * *non-overlapping* VM ranges for a fast look-up.
+ * 
+ * @return a valid reference to a new VM range tree, NULL otherwise.
+ */
+vm_range_tree_t *
+vm_range_tree_new() {
+  return (vm_range_tree_t *)calloc(1, sizeof(vm_range_tree_t));
 }
 
 
-static inline vm_range_t *
-_vm_range__lrot(vm_range_t *self) {
-  vm_range_t *y = self->right;
-  vm_range_t *T2 = y->left;
+/**
+ * Add a new range to the VM range tree.
+ * 
+ * The callee has the responsibility of ensuring that all the VM ranges that
+ * are added to this data structure are *non-overlapping*. Failure to comply to
+ * this constraint will make lookups fairly pointless.
+ *
+ * @param self  the VM range tree.
+ * @param lo    the range lower bound
+ * @param hi    the range upper bound
+ * @param name  the name of the VM map (takes ownership)
+ *
+ * @return a reference to the added range, NULL otherwise. The reference is
+ *         only valid until the next change to the tree.
+ */
+vm_range_t *
+vm_range_tree__add(vm_range_tree_t *self, addr_t lo, addr_t hi, char *name) {
+  if (self->size == self->capacity) {
+    size_t      capacity = self->capacity ? self->capacity << 1 : 64;
+    vm_range_t *ranges   = (vm_range_t *) realloc(self->ranges, capacity * sizeof(vm_range_t));
+    if (!isvalid(ranges)) {
+      sfree(name);
+      return NULL;
+    }
+    self->ranges   = ranges;
+    self->capacity = capacity;
+  }
 
-  y->left = self;
-  self->right = T2;
+  size_t      i     = _vm_range_tree__bisect(self, lo);
+  vm_range_t *range = self->ranges + i;
 
-  self->height = max(vm_range__height(self->left), vm_range__height(self->right)) + 1;
-  y->height = max(vm_range__height(y->left), vm_range__height(y->right)) + 1;
+  memmove(range + 1, range, (self->size - i) * sizeof(vm_range_t));
+  self->size++;
 
-  return y;
+  range->lo   = lo;
+  range->hi   = hi;
+  range->name = name;
+
+  return range;
 }
 
 
-static inline int
-_vm_range__bf(vm_range_t *self) {
-  return isvalid(self)
-             ? vm_range__height(self->left) - vm_range__height(self->right)
-             : 0;
-}
+/**
+ * Remove a range from the VM range tree.
+ *
+ * @param self   the VM range tree.
+ * @param range  a reference to a range within the tree, as returned by a
+ *               look-up.
+ */
+void
+vm_range_tree__remove(vm_range_tree_t *self, vm_range_t *range) {
+  size_t i = range - self->ranges;
 
-static inline vm_range_t *
-_vm_range__add(vm_range_t *self, vm_range_t *range) {
-  if (!isvalid(self))
-    return range;
-
-  if (range->lo < self->lo)
-    self->left = _vm_range__add(self->left, range);
-  else
-    self->right = _vm_range__add(self->right, range);
-
-  self->height = 1 + max(vm_range__height(self->left), vm_range__height(self->right));
-
-  // Balance the tree
-  int balance = _vm_range__bf(self);
-  if (balance > 1)
-  {
-    if (range->lo < self->left->lo)
-      return _vm_range__rrot(self);
-    else
-    {
-      self->left = _vm_range__lrot(self->left);
-      return _vm_range__rrot(self);
-    }
-  }
-  else if (balance < -1)
-  {
-    if (range->lo > self->right->lo)
-      return _vm_range__lrot(self);
-    else
-    {
-      self->right = _vm_range__rrot(self->right);
-      return _vm_range__lrot(self);
-    }
-  }
+  sfree(range->name);
 
-  return self;
+  memmove(range, range + 1, (self->size - i - 1) * sizeof(vm_range_t));
+  self->size--;
 }
 
 
 /**
- * Create a new VM range tree. This is an implementation of an AVL tree that
- * is meant to store *non-overlapping* VM ranges for a fast look-up.
- * 
- * @return a valid reference to a new VM range tree, NULL otherwise.
+ * Check whether the VM range tree contains a range with the same bounds and
+ * name as the given one.
+ *
+ * @param self   the VM range tree to query.
+ * @param range  the range to look for.
+ *
+ * @return TRUE if the range is in the tree, FALSE otherwise.
  */
-vm_range_tree_t *
-vm_range_tree_new() {
-  return (vm_range_tree_t *)calloc(1, sizeof(vm_range_tree_t));
+int
+vm_range_tree__has(vm_range_tree_t *self, vm_range_t *range) {
+  vm_range_t *other = _vm_range_tree__find(self, range->lo);
+
+  return isvalid(other)
+    && other->lo == range->lo
+    && other->hi == range->hi
+    && strcmp(other->name, range->name) == 0;
 }
 
 
 /**
- * Add a new range to the VM range tree.
- * 
- * The callee has the responsibility of ensuring that all the VM ranges that
- * are added to this data structure are *non-overlapping*. Failure to comply to
- * this constraint will make lookups fairly pointless.
+ * Remove all the ranges from the VM range tree.
+ *
+ * @param self  the VM range tree.
  */
 void
-vm_range_tree__add(vm_range_tree_t *self, vm_range_t *range) {
-  self->root = _vm_range__add(self->root, range);
+vm_range_tree__clear(vm_range_tree_t *self) {
+  for (size_t i = 0; i < self->size; i++)
+    sfree(self->ranges[i].name);
+
+  self->size = 0;
 }
 
 
@@ -195,8 +193,9 @@ vm_range_tree__destroy(vm_range_tree_t *self) {
   if (!isvalid(self))
     return;
 
-  vm_range__destroy(self->root);
+  vm_range_tree__clear(self);
 
+  sfree(self->ranges);
   free(self);
 }
 
@@ -204,18 +203,6 @@ vm_range_tree__destroy(vm_range_tree_t *self) {
 
 #ifdef PY_THREAD_C
 
-static inline vm_range_t *
-_vm_range__find(vm_range_t *self, addr_t addr) {
-  if (!isvalid(self))
-    return NULL;
-
-  if (addr >= self->lo && addr < self->hi)
-    return self;
-
-  return _vm_range__find(addr < self->lo ? self->left : self->right, addr);
-}
-
-
 /**
  * Query the tree for the range that contains the given address (if any).
  * 
@@ -229,7 +216,7 @@ _vm_range__find(vm_range_t *self, addr_t addr) {
  */
 vm_range_t *
 vm_range_tree__find(vm_range_tree_t *self, addr_t addr) {
-  return _vm_range__find(self->root, addr);
+  return _vm_range_tree__find(self, addr);
 }
 
 #endif // PY_THREAD_C
@@ -212,6 +212,7 @@ void
 log_meta_header(void) {
   emit_metadata("austin", VERSION);
   emit_metadata("interval", "%lu", pargs.t_sampling_interval);
+  if (pargs.budget > 0) { emit_metadata("budget", "%.2f%%", pargs.budget * 100); }
 
   if (pargs.full)           { emit_metadata("mode", "full"); }
   else if (pargs.memory)    { emit_metadata("mode", "memory"); }
@@ -34,13 +34,13 @@
 #define META_HEAD "# "
 #define META_SEP  ": "
 
-#define NL {if (!pargs.binary) fputc('\n', pargs.output_file);}
+#define NL {if (!pargs.binary) fputc('\n', output_stream());}
 
 #define meta(key, ...)                     \
-  fputs(META_HEAD, pargs.output_file);     \
-  fputs(key, pargs.output_file);           \
-  fputs(META_SEP, pargs.output_file);      \
-  fprintf(pargs.output_file, __VA_ARGS__); \
+  fputs(META_HEAD, output_stream());       \
+  fputs(key, output_stream());             \
+  fputs(META_SEP, output_stream());        \
+  fprintf(output_stream(), __VA_ARGS__);   \
   NL;
 
 #if defined __clang__
@@ -660,6 +660,17 @@ _py_proc__get_resident_memory(py_proc_t * self) {
 } // _py_proc__get_resident_memory
 
 
+// ----------------------------------------------------------------------------
+static uint64_t
+_py_proc__get_cpu_time(py_proc_t * self) {
+  struct proc_taskinfo info;
+
+  return proc_pidinfo(self->pid, PROC_PIDTASKINFO, 0, &info, sizeof(info)) == sizeof(info)
+    ? info.pti_total_user + info.pti_total_system
+    : 0;
+} // _py_proc__get_cpu_time
+
+
 // ----------------------------------------------------------------------------
 static int
 _py_proc__init(py_proc_t * self) {
@@ -106,4 +106,29 @@ _py_thread__is_idle(py_thread_t * self) {
     return ti.pth_run_state != TH_STATE_RUNNING;
 }
 
+
+// ----------------------------------------------------------------------------
+// Get the CPU time, in nanoseconds, consumed by the thread. Returns 0 if the
+// information is not available.
+static inline uint64_t
+_py_thread__run_time(py_thread_t * self) {
+    struct proc_threadinfo ti;
+
+    if (unlikely(_silly_offset == 0)) {
+        _infer_thread_id_offset(self);
+    }
+
+    if (proc_pidinfo(
+            self->proc->pid,
+            PROC_PIDTHREADINFO,
+            self->tid + _silly_offset,
+            &ti,
+            sizeof(ti))
+    != sizeof(ti)) {
+        return 0;
+    }
+
+    return ti.pth_user_time + ti.pth_system_time;
+}
+
 #endif
\ No newline at end of file
@@ -29,6 +29,7 @@
 #include "platform.h"
 
 #if defined PL_LINUX
+  #include <limits.h>
   #include <sys/uio.h>
   #include <unistd.h>
   ssize_t process_vm_readv(
@@ -49,9 +50,20 @@
 
 #endif
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "error.h"
 #include "logging.h"
 
+#ifndef IOV_MAX
+#define IOV_MAX                 1024
+#endif
+
+// The maximum number of remote ranges that can be read in a single batch.
+#define MAX_MEM_BATCH_SIZE   IOV_MAX
+
 
 /**
  * Copy a data structure from the given remote address structure.
@@ -104,9 +116,45 @@ typedef struct {
 } raddr_t;
 
 
+// ---- PAGE CACHE ------------------------------------------------------------
+
+// The granularity of the page cache. This need not match the actual page size
+// of the system, provided it is a divisor of it.
+#define MEM_PAGE_SIZE                       4096
+
+// The number of pages held by the page cache of each sampling thread.
+#define MEM_CACHE_SIZE                        64
+
+// Reads larger than this are not served by the page cache.
+#define MAX_MEM_CACHE_READ   (MEM_PAGE_SIZE << 1)
+
+#define mem_page_of(addr)   ((void *) (((uintptr_t) (addr)) & ~((uintptr_t) MEM_PAGE_SIZE - 1)))
+
+typedef struct {
+  void          * addr;      // The remote page address, or NULL if unused
+  unsigned char   data[MEM_PAGE_SIZE];
+} mem_page_t;
+
+// A direct-mapped cache of remote pages. It is only active for the duration
+// of a single sample, so that the data served from it is as fresh as the data
+// read from the remote process directly.
+typedef struct {
+  proc_ref_t      pref;
+  int             active;
+  mem_page_t    * pages;
+  unsigned long   hits;
+  unsigned long   misses;
+} mem_cache_t;
+
+#ifndef AUSTIN_C
+extern
+#endif
+__thread mem_cache_t _mem_cache;
+
+
 /**
  * Copy a chunk of memory from a portion of the virtual memory of another
- * process.
+ * process, bypassing the page cache.
  * @param proc_ref_t  the process reference (platform-dependent)
  * @param void *      the remote address
  * @param ssize_t     the number of bytes to read
@@ -116,7 +164,7 @@ typedef struct {
  * @return  zero on success, otherwise non-zero.
  */
 static inline int
-copy_memory(proc_ref_t proc_ref, void * addr, ssize_t len, void * buf) {
+_copy_memory(proc_ref_t proc_ref, void * addr, ssize_t len, void * buf) {
   ssize_t result = -1;
 
   #if defined(PL_LINUX)                                              /* LINUX */
@@ -190,6 +238,319 @@ copy_memory(proc_ref_t proc_ref, void * addr, ssize_t len, void * buf) {
   return result != len;
 }
 
+
+// ----------------------------------------------------------------------------
+static inline mem_page_t *
+_mem_cache__get_page(mem_cache_t * self, void * page_addr) {
+  mem_page_t * page = self->pages + (((uintptr_t) page_addr / MEM_PAGE_SIZE) % MEM_CACHE_SIZE);
+
+  if (page->addr == page_addr) {
+    self->hits++;
+    return page;
+  }
+
+  self->misses++;
+  if (fail(_copy_memory(self->pref, page_addr, MEM_PAGE_SIZE, page->data))) {
+    page->addr = NULL;
+    return NULL;
+  }
+  page->addr = page_addr;
+
+  return page;
+}
+
+
+/**
+ * Start caching remote pages of the given process. Pages are cached until
+ * mem_cache_end is called.
+ *
+ * @param proc_ref_t  the process reference (platform-dependent)
+ */
+static inline void
+mem_cache_begin(proc_ref_t pref) {
+  if (!isvalid(_mem_cache.pages)) {
+    _mem_cache.pages = (mem_page_t *) malloc(MEM_CACHE_SIZE * sizeof(mem_page_t));
+    if (!isvalid(_mem_cache.pages))
+      // We can do without the cache.
+      return;
+  }
+
+  for (int i = 0; i < MEM_CACHE_SIZE; i++)
+    _mem_cache.pages[i].addr = NULL;
+
+  _mem_cache.pref   = pref;
+  _mem_cache.active = TRUE;
+}
+
+
+/**
+ * Stop caching remote pages and invalidate the page cache.
+ */
+#define mem_cache_end()     {_mem_cache.active = FALSE;}
+
+
+/**
+ * Release the page cache of the current thread.
+ */
+#define mem_cache_free()    {_mem_cache.active = FALSE; sfree(_mem_cache.pages);}
+
+
+/**
+ * Copy a chunk of memory from a portion of the virtual memory of another
+ * process. Small reads are served from the page cache, when active. Any read
+ * that cannot be served from the cache is retried against the remote process
+ * directly, so that errors are reported consistently.
+ * @param proc_ref_t  the process reference (platform-dependent)
+ * @param void *      the remote address
+ * @param ssize_t     the number of bytes to read
+ * @param void *      the destination buffer, expected to be at least as large
+ *                    as the number of bytes to read.
+ * 
+ * @return  zero on success, otherwise non-zero.
+ */
+static inline int
+copy_memory(proc_ref_t proc_ref, void * addr, ssize_t len, void * buf) {
+  if (!_mem_cache.active || _mem_cache.pref != proc_ref || len <= 0 || len > MAX_MEM_CACHE_READ)
+    return _copy_memory(proc_ref, addr, len, buf);
+
+  unsigned char * dest = (unsigned char *) buf;
+  void          * end  = addr + len;
+
+  for (void * page_addr = mem_page_of(addr); page_addr < end; page_addr += MEM_PAGE_SIZE) {
+    mem_page_t * page = _mem_cache__get_page(&_mem_cache, page_addr);
+    if (!isvalid(page))
+      return _copy_memory(proc_ref, addr, len, buf);
+
+    void * from = addr > page_addr ? addr : page_addr;
+    void * to   = end < page_addr + MEM_PAGE_SIZE ? end : page_addr + MEM_PAGE_SIZE;
+
+    memcpy(dest, page->data + (from - page_addr), to - from);
+    dest += to - from;
+  }
+
+  SUCCESS;
+}
+
+// ---- BATCHED READS ---------------------------------------------------------
+
+// A batch of remote memory ranges to be read in one go. On Linux, all the
+// ranges are read with a single call to process_vm_readv in most cases. The
+// outcome of each read is reported individually, so that the failure to read
+// a range does not invalidate the others.
+typedef struct {
+  proc_ref_t      pref;
+  size_t          size;      // Number of queued ranges
+  size_t          capacity;  // Maximum number of ranges
+  #if defined PL_LINUX
+  struct iovec  * local;
+  struct iovec  * remote;
+  #else
+  struct {
+    void        * addr;
+    ssize_t       len;
+    void        * buf;
+  }             * ranges;
+  #endif
+  unsigned char * failed;    // Per-range outcome of the last flush
+} mem_batch_t;
+
+
+/**
+ * Create a new batch of remote memory reads.
+ *
+ * @param size_t  the maximum number of ranges in the batch. This is capped
+ *                to MAX_MEM_BATCH_SIZE.
+ *
+ * @return a pointer to the new batch, or NULL on failure.
+ */
+static inline mem_batch_t *
+mem_batch_new(size_t capacity) {
+  mem_batch_t * batch = (mem_batch_t *) calloc(1, sizeof(mem_batch_t));
+  if (!isvalid(batch))
+    return NULL;
+
+  if (capacity > MAX_MEM_BATCH_SIZE)
+    capacity = MAX_MEM_BATCH_SIZE;
+
+  batch->capacity = capacity;
+  #if defined PL_LINUX
+  batch->local  = (struct iovec *) calloc(capacity, sizeof(struct iovec));
+  batch->remote = (struct iovec *) calloc(capacity, sizeof(struct iovec));
+  if (!isvalid(batch->local) || !isvalid(batch->remote))
+    goto error;
+  #else
+  batch->ranges = calloc(capacity, sizeof(*batch->ranges));
+  if (!isvalid(batch->ranges))
+    goto error;
+  #endif
+  batch->failed = (unsigned char *) calloc(capacity, sizeof(unsigned char));
+  if (!isvalid(batch->failed))
+    goto error;
+
+  return batch;
+
+error:
+  #if defined PL_LINUX
+  sfree(batch->local);
+  sfree(batch->remote);
+  #else
+  sfree(batch->ranges);
+  #endif
+  free(batch);
+  return NULL;
+}
+
+
+/**
+ * Destroy a batch of remote memory reads.
+ *
+ * @param mem_batch_t  the batch.
+ */
+static inline void
+mem_batch__destroy(mem_batch_t * self) {
+  if (!isvalid(self))
+    return;
+
+  #if defined PL_LINUX
+  sfree(self->local);
+  sfree(self->remote);
+  #else
+  sfree(self->ranges);
+  #endif
+  sfree(self->failed);
+  free(self);
+}
+
+
+/**
+ * Clear the batch and prepare it for reading from the given process.
+ *
+ * @param mem_batch_t  the batch.
+ * @param proc_ref_t   the process reference (platform-dependent).
+ */
+static inline void
+mem_batch__reset(mem_batch_t * self, proc_ref_t pref) {
+  self->pref = pref;
+  self->size = 0;
+}
+
+
+#define mem_batch__is_full(self)    ((self)->size >= (self)->capacity)
+
+
+/**
+ * Check whether the range with the given index was read successfully by the
+ * last flush.
+ */
+#define mem_batch__ok(self, i)      (!(self)->failed[i])
+
+
+/**
+ * Queue a remote memory range.
+ *
+ * @param mem_batch_t the batch.
+ * @param void *      the remote address
+ * @param ssize_t     the number of bytes to read
+ * @param void *      the destination buffer, expected to be at least as large
+ *                    as the number of bytes to read.
+ *
+ * @return the index of the range within the batch, or -1 if the batch is full.
+ */
+static inline int
+mem_batch__add(mem_batch_t * self, void * addr, ssize_t len, void * buf) {
+  if (mem_batch__is_full(self))
+    return -1;
+
+  size_t i = self->size++;
+
+  #if defined PL_LINUX
+  self->local[i].iov_base  = buf;
+  self->local[i].iov_len   = len;
+  self->remote[i].iov_base = addr;
+  self->remote[i].iov_len  = len;
+  #else
+  self->ranges[i].addr = addr;
+  self->ranges[i].len  = len;
+  self->ranges[i].buf  = buf;
+  #endif
+  self->failed[i] = FALSE;
+
+  return i;
+}
+
+
+/**
+ * Read all the queued ranges.
+ *
+ * On Linux, process_vm_readv stops at the first range that cannot be read in
+ * full. In this case we mark the range as failed and carry on from the next
+ * one, so that each failure costs one extra system call at most.
+ *
+ * @param mem_batch_t  the batch.
+ *
+ * @return SUCCESS if all the ranges were read successfully, FAIL otherwise.
+ *         The outcome of each read can be checked with mem_batch__ok.
+ */
+static inline int
+mem_batch__flush(mem_batch_t * self) {
+  int failed = 0;
+
+  #if defined PL_LINUX
+  size_t i = 0;
+  while (i < self->size) {
+    ssize_t result = process_vm_readv(
+      self->pref, self->local + i, self->size - i, self->remote + i, self->size - i, 0
+    );
+    if (result == -1) {
+      switch (errno) {
+      case ESRCH:
+      case EPERM:
+        // No point in trying with the other ranges.
+        set_error(errno == ESRCH ? EPROCNPID : EPROCPERM);
+        for (; i < self->size; i++)
+          self->failed[i] = TRUE;
+        FAIL;
+      default:
+        self->failed[i++] = TRUE;
+        failed++;
+        continue;
+      }
+    }
+
+    for (; i < self->size && (size_t) result >= self->remote[i].iov_len; i++)
+      result -= self->remote[i].iov_len;
+
+    if (i < self->size) {
+      // Partial read
+      self->failed[i++] = TRUE;
+      failed++;
+    }
+  }
+
+  #else
+  for (size_t i = 0; i < self->size; i++) {
+    if (fail(_copy_memory(self->pref, self->ranges[i].addr, self->ranges[i].len, self->ranges[i].buf))) {
+      if (austin_errno == EPROCNPID || austin_errno == EPROCPERM) {
+        for (; i < self->size; i++)
+          self->failed[i] = TRUE;
+        FAIL;
+      }
+      self->failed[i] = TRUE;
+      failed++;
+    }
+  }
+
+  #endif
+
+  if (failed) {
+    set_error(EMEMCOPY);
+    FAIL;
+  }
+
+  SUCCESS;
+}
+
+
 /**
  * Return the total physical memory installed on the system, in KB.
  * @return  the total physical memory installed on the system, in KB.
@@ -24,12 +24,13 @@
 #define MOJO_H
 
 #include <stdio.h>
+#include <string.h>
 
 #include "argparse.h"
 #include "cache.h"
 #include "platform.h"
 
-#define MOJO_VERSION 3
+#define MOJO_VERSION 5
 
 enum {
   MOJO_RESERVED,
@@ -45,6 +46,10 @@ enum {
   MOJO_METRIC_MEMORY,
   MOJO_STRING,
   MOJO_STRING_REF,
+  MOJO_STACK_DEF,
+  MOJO_STACK_REF,
+  MOJO_MAP,
+  MOJO_UNMAP,
   MOJO_MAX,
 };
 
@@ -65,21 +70,94 @@ typedef unsigned long long mojo_int_t;
 // Bitmask to ensure that we encode at most 4 bytes for an integer.
 #define MOJO_INT32 ((mojo_int_t)(1 << (6 + 7 * 3)) - 1)
 
+// Output buffer
+//
+// Events are encoded in a per-thread buffer, which is written to the output
+// stream in one go when it is full, or when flushed explicitly at the end of a
+// sample. The buffer is large enough to hold any event but strings, which are
+// written straight to the output stream when they do not fit.
+
+#define MOJO_BUFFER_SIZE  (1 << 14)
+
+// The largest integer takes 10 bytes to encode.
+#define MOJO_INTEGER_SIZE 10
+
+typedef struct {
+  size_t        size;
+  unsigned char data[MOJO_BUFFER_SIZE];
+} mojo_buffer_t;
+
+extern __thread mojo_buffer_t _mojo_buffer;
+
+
+/**
+ * Write the content of the buffer of the calling thread to its output stream.
+ */
+void
+mojo_flush(void);
+
+
+static inline void
+_mojo_reserve(size_t size) {
+  if (_mojo_buffer.size + size > MOJO_BUFFER_SIZE)
+    mojo_flush();
+}
+
+
 // Primitives
 
-#define mojo_event(event) \
-  { fputc(event, pargs.output_file); }
+#define mojo_event(event)                                  \
+  {                                                        \
+    _mojo_reserve(1);                                      \
+    _mojo_buffer.data[_mojo_buffer.size++] = (event);      \
+  }
+
+static inline void _mojo_string(const char * string) {
+  size_t size = strlen(string) + 1;
+
+  _mojo_reserve(size);
+  if (size > MOJO_BUFFER_SIZE) {
+    fwrite(string, 1, size, output_stream());
+    return;
+  }
 
-#define mojo_string(string)         \
-  fputs(string, pargs.output_file); \
-  fputc('\0', pargs.output_file);
+  memcpy(_mojo_buffer.data + _mojo_buffer.size, string, size);
+  _mojo_buffer.size += size;
+}
 
-#define mojo_fstring(...)                  \
-  fprintf(pargs.output_file, __VA_ARGS__); \
-  fputc('\0', pargs.output_file);
+#define mojo_string(string) _mojo_string(string);
+
+// The terminating null character written by snprintf is the string
+// terminator. Strings that do not fit in an empty buffer are written straight
+// to the output stream.
+#define mojo_fstring(...)                                                     \
+  {                                                                           \
+    size_t _avail = MOJO_BUFFER_SIZE - _mojo_buffer.size;                     \
+    int    _len   = snprintf(                                                 \
+      (char *) _mojo_buffer.data + _mojo_buffer.size, _avail, __VA_ARGS__     \
+    );                                                                        \
+    if (_len >= 0 && (size_t) _len >= _avail && _mojo_buffer.size > 0) {      \
+      mojo_flush();                                                           \
+      _avail = MOJO_BUFFER_SIZE;                                              \
+      _len   = snprintf((char *) _mojo_buffer.data, _avail, __VA_ARGS__);     \
+    }                                                                         \
+    if (_len < 0) {                                                           \
+      mojo_event('\0');                                                       \
+    }                                                                         \
+    else if ((size_t) _len >= _avail) {                                       \
+      fprintf(output_stream(), __VA_ARGS__);                                  \
+      fputc('\0', output_stream());                                           \
+    }                                                                         \
+    else {                                                                    \
+      _mojo_buffer.size += _len + 1;                                          \
+    }                                                                         \
+  }
 
 static inline void mojo_integer(mojo_int_t integer, int sign) {
-  unsigned char byte = integer & 0x3f;
+  _mojo_reserve(MOJO_INTEGER_SIZE);
+
+  unsigned char * cursor = _mojo_buffer.data + _mojo_buffer.size;
+  unsigned char   byte   = integer & 0x3f;
   if (sign) {
     byte |= 0x40;
   }
@@ -89,7 +167,7 @@ static inline void mojo_integer(mojo_int_t integer, int sign) {
     byte |= 0x80;
   }
 
-  fputc(byte, pargs.output_file);
+  *cursor++ = byte;
 
   while (integer) {
     byte = integer & 0x7f;
@@ -97,8 +175,10 @@ static inline void mojo_integer(mojo_int_t integer, int sign) {
     if (integer) {
       byte |= 0x80;
     }
-    fputc(byte, pargs.output_file);
+    *cursor++ = byte;
   }
+
+  _mojo_buffer.size = cursor - _mojo_buffer.data;
 }
 
 // We expect the least significant bits to be varied enough to provide a valid
@@ -109,9 +189,12 @@ static inline void mojo_integer(mojo_int_t integer, int sign) {
 
 #define mojo_header()                \
   {                                  \
-    fputs("MOJ", pargs.output_file); \
+    mojo_event('M');                 \
+    mojo_event('O');                 \
+    mojo_event('J');                 \
     mojo_integer(MOJO_VERSION, 0);   \
-    fflush(pargs.output_file);       \
+    mojo_flush();                    \
+    fflush(output_stream());         \
   }
 
 #define mojo_metadata(label, ...) \
@@ -160,4 +243,36 @@ static inline void mojo_integer(mojo_int_t integer, int sign) {
   mojo_event(MOJO_STRING_REF); \
   mojo_ref(key);
 
+// A stack definition is followed by the keys of its frames, from the bottom
+// to the top of the stack. A stack reference stands for the references to all
+// the frames of the stack. Stack keys are scoped to the process of the stack
+// event that precedes them, as each process keeps its own stack definitions.
+#define mojo_stack_def(key, size) \
+  mojo_event(MOJO_STACK_DEF);     \
+  mojo_ref(key);                  \
+  mojo_integer(size, 0);
+
+#define mojo_stack_ref(key)   \
+  mojo_event(MOJO_STACK_REF); \
+  mojo_ref(key);
+
+// A map event describes a range of the VM of a process that maps an object
+// file, the address at which the object file is loaded, its path and its GNU
+// build ID (empty if unknown). An unmap event removes a range that was mapped
+// earlier. These are used to resolve the raw native frames offline.
+#define mojo_map(pid, lo, hi, base, path, build_id) \
+  mojo_event(MOJO_MAP);                             \
+  mojo_integer(pid, 0);                             \
+  mojo_integer(lo, 0);                              \
+  mojo_integer(hi, 0);                              \
+  mojo_integer(base, 0);                            \
+  mojo_string(path);                                \
+  mojo_string(build_id);
+
+#define mojo_unmap(pid, lo, hi) \
+  mojo_event(MOJO_UNMAP);       \
+  mojo_integer(pid, 0);         \
+  mojo_integer(lo, 0);          \
+  mojo_integer(hi, 0);
+
 #endif
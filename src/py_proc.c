@@ -259,6 +259,16 @@ _py_proc__infer_python_version(py_proc_t * self) {
     }
   }
 
+  #if defined PL_LINUX
+  // The version found for the same binary before spares us the guesswork
+  // below, which might involve running the binary.
+  if (success(_py_proc__get_cached_version(self, &major, &minor, &patch))) {
+    log_d("Python version (from cache): %d.%d.%d", major, minor, patch);
+    self->py_v = get_version_descriptor(major, minor, patch);
+    SUCCESS;
+  }
+  #endif
+
   // Starting with Python 3.11 we can rely on the Py_Version symbol
   if (isvalid(self->symbols[DYNSYM_HEX_VERSION])) {
     unsigned long py_version = 0;
@@ -273,10 +283,7 @@ _py_proc__infer_python_version(py_proc_t * self) {
     patch = (py_version>>8)  & 0xFF;
 
     log_d("Python version (from symbol): %d.%d.%d", major, minor, patch);
-
-    self->py_v = get_version_descriptor(major, minor, patch);
-    
-    SUCCESS;
+    goto set_version;
   }
 
   // Try to infer the Python version from the library file name.
@@ -331,6 +338,9 @@ from_filename:
   goto set_version;
 
 set_version:
+  #if defined PL_LINUX
+  _py_proc__set_cached_version(self, major, minor, patch);
+  #endif
   self->py_v = get_version_descriptor(major, minor, patch);
   SUCCESS;
 }
@@ -662,6 +672,22 @@ _py_proc__find_interpreter_state(py_proc_t * self) {
   SUCCESS;
 }
 
+// ----------------------------------------------------------------------------
+// Start the thread that resolves the frames of the samples, if requested. This
+// is done once the process is running, so that we never fork with it.
+static inline void
+_py_proc__start_resolver(py_proc_t * self) {
+  #ifndef NATIVE
+  if (!pargs.deferred || isvalid(self->resolver))
+    return;
+
+  self->resolver = resolver_new(self, (resolver_emit_t) py_thread__emit_deferred_stack);
+  if (!isvalid(self->resolver))
+    log_w("Cannot start the frame resolver of process %d. Frames will be resolved while sampling.", self->pid);
+  #endif
+}
+
+
 // ----------------------------------------------------------------------------
 static int
 _py_proc__run(py_proc_t * self) {
@@ -749,6 +775,8 @@ _py_proc__run(py_proc_t * self) {
   self->unwind.as = unw_create_addr_space(&_UPT_accessors, 0);
   #endif
 
+  _py_proc__start_resolver(self);
+
   log_d("Python process initialization successful");
 
   SUCCESS;
@@ -781,19 +809,47 @@ py_proc_new(int child) {
     log_e("Failed to allocate frame cache");
     goto error;
   }
-  #ifdef DEBUG
   py_proc->frame_cache->name = "frame cache";
-  #endif
 
   py_proc->string_cache = lru_cache_new(MAX_STRING_CACHE_SIZE, (void (*)(value_t)) free);
   if (!isvalid(py_proc->string_cache)) {
     log_e("Failed to allocate string cache");
     goto error;
   }
-  #ifdef DEBUG
   py_proc->string_cache->name = "string cache";
+
+  py_proc->code_cache = lru_cache_new(MAX_CODE_CACHE_SIZE, (void (*)(value_t)) free);
+  if (!isvalid(py_proc->code_cache)) {
+    log_e("Failed to allocate code cache");
+    goto error;
+  }
+  py_proc->code_cache->name = "code cache";
+
+  #ifndef NATIVE
+  if (pargs.binary) {
+    py_proc->stack_cache = lru_cache_new(MAX_STACK_CACHE_SIZE, (void (*)(value_t)) free);
+    if (!isvalid(py_proc->stack_cache)) {
+      log_e("Failed to allocate stack cache");
+      goto error;
+    }
+    py_proc->stack_cache->name = "stack cache";
+  }
+
+  if (pargs.aggregate) {
+    py_proc->aggregate = aggregate_new();
+    if (!isvalid(py_proc->aggregate)) {
+      log_e("Failed to allocate aggregated profile");
+      goto error;
+    }
+  }
   #endif
 
+  py_proc->threads = lookup_new(64);
+  if (!isvalid(py_proc->threads)) {
+    log_e("Failed to allocate thread lookup");
+    goto error;
+  }
+
   py_proc->extra = (proc_extra_info *) calloc(1, sizeof(proc_extra_info));
   if (!isvalid(py_proc->extra))
     goto error;
@@ -841,6 +897,132 @@ py_proc__attach(py_proc_t * self, pid_t pid) {
 }
 
 
+// ----------------------------------------------------------------------------
+static void
+_py_proc__copy_caches(py_proc_t * self, py_proc_t * parent) {
+  // In text mode, frames and code objects refer to the strings in the string
+  // cache directly, so we map the parent's strings to our copies. In binary
+  // mode they refer to them by key.
+  lookup_t * strings = pargs.binary ? NULL : lookup_new(1024);
+  if (!pargs.binary && !isvalid(strings))
+    return;
+
+  #define _copy_of(string) \
+    (pargs.binary ? (string) : (char *) lookup__get(strings, (key_dt) (string)))
+
+  lru_cache__iteritems_start(parent->string_cache, key, char *, string) {
+    char * copy = strdup(string);
+    if (!isvalid(copy))
+      goto release;
+    lru_cache__store(self->string_cache, key, copy);
+    if (isvalid(strings))
+      lookup__set(strings, (key_dt) string, copy);
+  } lru_cache__iter_stop(parent->string_cache);
+
+  lru_cache__iteritems_start(parent->code_cache, key, code_info_t *, info) {
+    char * filename = _copy_of(info->filename);
+    char * scope    = _copy_of(info->scope);
+    if (!isvalid(filename) || !isvalid(scope))
+      continue;
+
+    size_t        size = sizeof(code_info_t) + info->size * sizeof(line_entry_t);
+    code_info_t * copy = (code_info_t *) malloc(size);
+    if (!isvalid(copy))
+      goto release;
+    memcpy(copy, info, size);
+    copy->filename = filename;
+    copy->scope    = scope;
+    copy->capacity = copy->size;
+
+    lru_cache__store(self->code_cache, key, copy);
+  } lru_cache__iter_stop(parent->code_cache);
+
+  lru_cache__iteritems_start(parent->frame_cache, key, frame_t *, frame) {
+    char * filename = _copy_of(frame->filename);
+    char * scope    = _copy_of(frame->scope);
+    if (!isvalid(filename) || !isvalid(scope))
+      continue;
+
+    frame_t * copy = frame_new(
+      frame->key, filename, scope,
+      frame->line, frame->line_end, frame->column, frame->column_end
+    );
+    if (!isvalid(copy))
+      goto release;
+
+    lru_cache__store(self->frame_cache, key, copy);
+  } lru_cache__iter_stop(parent->frame_cache);
+
+  #undef _copy_of
+
+release:
+  lookup__destroy(strings);
+}
+
+
+// ----------------------------------------------------------------------------
+int
+py_proc__attach_from(py_proc_t * self, py_proc_t * parent, pid_t pid) {
+  #if defined PL_LINUX
+  if (!isvalid(parent) || !isvalid(parent->py_v) || !isvalid(parent->is_raddr))
+    FAIL;
+
+  log_d("Attaching to process with PID %d from its parent %d", pid, parent->pid);
+
+  self->pid      = pid;
+  self->proc_ref = pid;
+
+  if (fail(_py_proc__init_from_parent(self, parent)))
+    FAIL;
+
+  if (isvalid(parent->bin_path) && !isvalid(self->bin_path = strdup(parent->bin_path)))
+    FAIL;
+  if (isvalid(parent->lib_path) && !isvalid(self->lib_path = strdup(parent->lib_path)))
+    FAIL;
+
+  self->map                   = parent->map;
+  self->sym_loaded            = parent->sym_loaded;
+  self->py_v                  = parent->py_v;
+  self->gc_state_raddr        = parent->gc_state_raddr;
+  self->is_raddr              = parent->is_raddr;
+  self->tstate_current_offset = parent->tstate_current_offset;
+  memcpy(self->symbols, parent->symbols, sizeof(self->symbols));
+
+  if (fail(_py_proc__init_local_buffers(self)))
+    FAIL;
+
+  V_DESC(self->py_v);
+
+  // The interpreter state is where the parent has it, unless the child has
+  // re-initialised the runtime. The rest is validated as we sample.
+  if (fail(py_proc__copy_v(self, is, self->is_raddr, self->is))) {
+    log_d("Cannot read the interpreter state inherited from the parent");
+    FAIL;
+  }
+
+  // The parent's resolver uses its caches, so we keep it on hold while we
+  // copy them.
+  resolver__pause(parent->resolver);
+  _py_proc__copy_caches(self, parent);
+  resolver__resume(parent->resolver);
+
+  self->timestamp = gettime();
+
+  #ifdef NATIVE
+  self->unwind.as = unw_create_addr_space(&_UPT_accessors, 0);
+  #endif
+
+  _py_proc__start_resolver(self);
+
+  log_d("Process %d attached from its parent", pid);
+
+  SUCCESS;
+  #else
+  FAIL;
+  #endif
+}
+
+
 // ----------------------------------------------------------------------------
 int
 py_proc__start(py_proc_t * self, const char * exec, char * argv[]) {
@@ -1126,6 +1308,10 @@ _py_proc__interrupt_threads(py_proc_t * self, raddr_t * tstate_head_raddr) {
       FAIL;
 
     if (fail(wait_ptrace(PTRACE_INTERRUPT, py_thread.tid, 0, 0))) {
+      // The thread is gone, or its TID has been reused by a thread that we
+      // have not seized.
+      if (errno == ESRCH)
+        py_thread__forget(&py_thread);
       log_e("ptrace: failed to interrupt thread %d", py_thread.tid);
       set_error(EPROC);
       FAIL;
@@ -1260,8 +1446,8 @@ _py_proc__sample_interpreter(py_proc_t * self, PyInterpreterState * is, ctime_t
 
 
 // ----------------------------------------------------------------------------
-int
-py_proc__sample(py_proc_t * self) {
+static inline int
+_py_proc__sample(py_proc_t * self) {
   ctime_t   time_delta     = gettime() - self->timestamp;  // Time delta since last sample.
   void    * current_interp = self->is_raddr;
 
@@ -1308,6 +1494,79 @@ py_proc__sample(py_proc_t * self) {
   #endif
 
   SUCCESS;
+} /* _py_proc__sample */
+
+
+// ----------------------------------------------------------------------------
+// The CPU time of a running thread might be accounted for only on scheduler
+// ticks, so a process is considered idle only if its CPU time has not changed
+// for longer than the tick period of any of the supported platforms.
+#define PROC_IDLE_WINDOW      20000
+
+static inline int
+_py_proc__is_idle(py_proc_t * self) {
+  uint64_t cpu_time = _py_proc__get_cpu_time(self);
+  ctime_t  now      = gettime();
+
+  if (cpu_time == 0)
+    return FALSE;
+
+  if (cpu_time != self->cpu_time) {
+    self->cpu_time            = cpu_time;
+    self->cpu_time_changed    = now;
+    self->cpu_time_generation = self->generation + 1;
+    return FALSE;
+  }
+
+  return now - self->cpu_time_changed >= PROC_IDLE_WINDOW;
+}
+
+
+// ----------------------------------------------------------------------------
+int
+py_proc__sample(py_proc_t * self) {
+  int result = 0;
+
+  self->idle = unlikely(pargs.where) ? FALSE : _py_proc__is_idle(self);
+
+  if (self->idle && pargs.sleepless && !pargs.full) {
+    // All the threads are idle so the whole sample would be thrown away. We
+    // still move the timestamp forward so that the idle time is not accounted
+    // for in the next sample.
+    self->timestamp = gettime();
+    stats_count_skipped();
+  }
+  else {
+    // Many of the remote reads performed while sampling are for structures
+    // that lie close to each other, like consecutive thread states or code
+    // objects. We collect a sample with the page cache on to save system
+    // calls.
+    mem_cache_begin(self->proc_ref);
+
+    py_thread_prefetch(self);
+
+    result = _py_proc__sample(self);
+
+    mem_cache_end();
+
+    #if defined PL_LINUX
+    procfs_cache__tick(self->extra->procfs);
+    #endif
+
+    stats_page_cache(_mem_cache.hits, _mem_cache.misses);
+    _mem_cache.hits = _mem_cache.misses = 0;
+  }
+
+  if (isvalid(self->aggregate) && aggregate__is_due(self->aggregate))
+    aggregate__flush(self->aggregate);
+
+  // Write out the MOJO events of the sample in one go.
+  mojo_flush();
+
+  // Write out the samples that have been resolved in the meantime.
+  resolver__collect(self->resolver);
+
+  return result;
 } /* py_proc__sample */
 
 
@@ -1374,12 +1633,44 @@ py_proc__terminate(py_proc_t * self) {
   py_proc__signal(self, SIGTERM);
 }
 
+#ifdef NATIVE
+// ----------------------------------------------------------------------------
+// Addresses that are not in any of the VM maps are not necessarily the result
+// of a new object file being loaded, e.g. JIT code, so we don't re-read the maps
+// on every miss.
+#define VM_MAPS_REFRESH_INTERVAL  1000000  // 1 second
+
+int
+py_proc__refresh_vm_maps(py_proc_t * self) {
+  if (gettime() - self->maps_timestamp < VM_MAPS_REFRESH_INTERVAL)
+    FAIL;
+
+  return _py_proc__get_vm_maps(self);
+}
+
+
+// ----------------------------------------------------------------------------
+int
+py_proc__is_eval_addr(py_proc_t * self, addr_t addr) {
+  for (int i = 0; i < self->n_eval_ranges; i++)
+    if (addr >= self->eval_ranges[i].lo && addr < self->eval_ranges[i].hi)
+      return TRUE;
+
+  return FALSE;
+}
+#endif
+
+
 // ----------------------------------------------------------------------------
 void
 py_proc__destroy(py_proc_t * self) {
   if (!isvalid(self))
     return;
 
+  // Emit whatever is left of the deferred samples and the aggregated profile.
+  resolver__destroy(self->resolver);
+  aggregate__destroy(self->aggregate);
+
   #ifdef NATIVE
   unw_destroy_addr_space(self->unwind.as);
   vm_range_tree__destroy(self->maps_tree);
@@ -1388,12 +1679,41 @@ py_proc__destroy(py_proc_t * self) {
 
   _py_proc__free_local_buffers(self);
 
+  #if defined PL_LINUX
+  if (isvalid(self->extra))
+    procfs_cache__destroy(self->extra->procfs);
+  #endif
+
   sfree(self->bin_path);
   sfree(self->lib_path);
   sfree(self->extra);
 
+  stats_lru_cache(self->stack_cache);
+  stats_lru_cache(self->code_cache);
+  stats_lru_cache(self->string_cache);
+  stats_lru_cache(self->frame_cache);
+
+  lru_cache__destroy(self->stack_cache);
+  lru_cache__destroy(self->code_cache);
   lru_cache__destroy(self->string_cache);
   lru_cache__destroy(self->frame_cache);
 
+  if (isvalid(self->threads)) {
+    hash_table__iter_start(self->threads->hash, py_thread_info_t *, info) {
+      sfree(info->stack);
+      free(info);
+    } hash_table__iter_stop(self->threads->hash);
+    lookup__destroy(self->threads);
+  }
+
   free(self);
 }
+
+
+// ----------------------------------------------------------------------------
+void
+py_proc_free(void) {
+  #if defined PL_LINUX
+  elf_cache__destroy();
+  #endif
+}
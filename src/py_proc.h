@@ -30,12 +30,16 @@
 #include <libunwind-ptrace.h>
 #include "linux/vm-range-tree.h"
 #include "cache.h"
+
+#define MAX_EVAL_RANGES 8
 #endif
 
 #include "python/symbols.h"
+#include "aggregate.h"
 #include "cache.h"
 #include "heap.h"
 #include "platform.h"
+#include "resolver.h"
 #include "stats.h"
 #include "version.h"
 
@@ -56,6 +60,30 @@ typedef struct {
 
 typedef struct _proc_extra_info proc_extra_info;  // Forward declaration.
 
+
+// Information about a thread that is retained across samples, keyed by the
+// remote address of its PyThreadState.
+typedef struct {
+  uintptr_t       thread_id;   // The thread ID stored in the thread state
+  uintptr_t       tid;         // The resolved OS thread ID
+  unsigned int    last_seen;   // The last sample in which the thread was seen
+  unsigned int    last_valid;  // The sample in which the TID was resolved
+  unsigned int    prefetched;  // The sample for which ts was prefetched
+  PyThreadState   ts;          // The thread state prefetched for the sample
+
+  // The fingerprint of the stack unwound in the last sample, which is reused
+  // for as long as the thread does not run.
+  void          * top_frame;   // The remote address of the top frame
+  void          * top_code;
+  int             top_lasti;
+  int             idle;
+  uint64_t        run_time;    // The run time of the thread, if known
+  size_t          stack_size;  // The number of frames, or 0 if not reusable
+  size_t          stack_capacity;
+  void          * stack;       // The unwound frames (py_frame_t), from the top
+  unsigned int    unwound;     // The sample in which the stack was unwound
+} py_thread_info_t;
+
 typedef struct {
   pid_t           pid;
   proc_ref_t      proc_ref;
@@ -77,10 +105,32 @@ typedef struct {
 
   lru_cache_t   * frame_cache;
   lru_cache_t   * string_cache;
+  lru_cache_t   * code_cache;
+  lru_cache_t   * stack_cache;   // Stacks emitted in binary mode
+
+  // The samples collected in aggregation mode
+  aggregate_t   * aggregate;
+
+  // The thread that resolves the frames of the samples in deferred mode, and
+  // the type of the code objects that it has resolved.
+  resolver_t    * resolver;
+  void          * code_type;
+
+  // Threads seen in the previous samples
+  lookup_t      * threads;
+  unsigned int    generation;  // Incremented on every sample
 
   // Temporal profiling support
   ctime_t         timestamp;
 
+  // Idle process detection. The process is idle when its CPU time has not
+  // changed for a while, in which case no thread has run since the sample in
+  // which the last change was seen.
+  int             idle;
+  uint64_t        cpu_time;
+  ctime_t         cpu_time_changed;     // When the CPU time last changed
+  unsigned int    cpu_time_generation;  // The first sample after the change
+
   // Memory profiling support
   ssize_t         last_resident_memory;
 
@@ -97,6 +147,16 @@ typedef struct {
   }                 unwind;
   vm_range_tree_t * maps_tree;
   hash_table_t    * base_table;
+  ctime_t           maps_timestamp;  // When the VM maps were last read
+
+  // The address ranges of the frame evaluation functions. In raw mode we use
+  // these to tell which native frames evaluate Python frames, since we don't
+  // resolve the native symbols.
+  struct {
+    addr_t lo;
+    addr_t hi;
+  }                 eval_ranges[MAX_EVAL_RANGES];
+  int               n_eval_ranges;
   #endif
 
   // Local buffers
@@ -146,6 +206,25 @@ int
 py_proc__attach(py_proc_t *, pid_t);
 
 
+/**
+ * Attach the child process with the given PID by inheriting the state of its
+ * parent.
+ *
+ * This is only possible if the child has been forked from the parent and still
+ * runs the same executable with the same memory layout. The caches of the
+ * parent are copied over, as the child starts with the same objects at the same
+ * addresses.
+ *
+ * @param py_proc_t *  the process object.
+ * @param py_proc_t *  the attached parent process object.
+ * @param pid_t        the PID of the child process to attach.
+ *
+ * @return 0 on success.
+ */
+int
+py_proc__attach_from(py_proc_t *, py_proc_t *, pid_t);
+
+
 /**
  * Wait for the process to terminate.
  *
@@ -254,7 +333,43 @@ void
 py_proc__terminate(py_proc_t *);
 
 
+#ifdef NATIVE
+/**
+ * Re-read the VM maps of the process. This is meant to be called when an
+ * address cannot be found in the current maps, e.g. because an object file has
+ * been loaded since they were last read. Hence the refreshes are rate-limited.
+ *
+ * @param py_proc_t * the process object.
+ *
+ * @return 0 if the maps have been refreshed; 1 otherwise.
+ */
+int
+py_proc__refresh_vm_maps(py_proc_t *);
+
+
+/**
+ * Check whether the given address is within a frame evaluation function.
+ *
+ * @param py_proc_t * the process object.
+ * @param addr_t      the address to check, e.g. a program counter.
+ *
+ * @return TRUE if the address is within a frame evaluation function, FALSE
+ *         otherwise.
+ */
+int
+py_proc__is_eval_addr(py_proc_t *, addr_t);
+#endif
+
+
 void
 py_proc__destroy(py_proc_t *);
 
+
+/**
+ * Release the resources that are shared by all the process objects, like the
+ * results of the analysis of the Python binaries.
+ */
+void
+py_proc_free(void);
+
 #endif // PY_PROC_H
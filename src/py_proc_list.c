@@ -24,6 +24,16 @@
 
 #if defined PL_LINUX
 #include <dirent.h>
+#include <sys/socket.h>
+
+#if defined __has_include
+#if __has_include(<linux/cn_proc.h>)
+#define PROC_CONNECTOR
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#endif
+#endif
 
 #include "linux/common.h"
 #elif defined PL_MACOS
@@ -33,12 +43,19 @@
 #include <tlhelp32.h>
 #endif
 
+#if defined PL_UNIX
+#include <pthread.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "hints.h"
 #include "logging.h"
+#include "mojo.h"
+#include "py_thread.h"
+#include "stats.h"
 #include "resources.h"
 #include "timing.h"
 
@@ -47,6 +64,250 @@
 
 #define UPDATE_INTERVAL           100000  // 0.1s
 
+// Sampling with multiple threads requires each thread to be able to read from
+// any process. This is not the case in native mode, where ptrace ties every
+// tracee to the thread that seized it.
+#if defined PL_UNIX && !defined NATIVE
+#define SAMPLER_POOL
+#endif
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_py_proc_list__sample_item(py_proc_item_t * item) {
+  log_t("Sampling process with PID %d", item->py_proc->pid);
+  stopwatch_start();
+  item->failed = !isvalid(item->py_proc->py_v) || fail(py_proc__sample(item->py_proc));
+} /* _py_proc_list__sample_item */
+
+
+// ---- SAMPLER POOL ----------------------------------------------------------
+
+#ifdef SAMPLER_POOL
+
+typedef struct {
+  pthread_t        thread;
+  sampler_pool_t * pool;
+  FILE           * stream;     // Private output stream
+  char           * buffer;     // Buffer backing the output stream
+  size_t           size;       // Size of the content of the output buffer
+  int              ready;      // Whether the sampler has started successfully
+} sampler_t;
+
+
+struct _sampler_pool {
+  sampler_t        * samplers;
+  int                size;     // Number of sampler threads
+  int                running;  // Number of sampler threads that started
+  py_proc_item_t  ** items;    // The processes to sample in the current round
+  int                n_items;
+  int                max_items;
+  int                next;     // Index of the next item to sample
+  int                pending;  // Number of samplers still busy in the round
+  unsigned long      round;
+  int                stop;
+  pthread_mutex_t    lock;
+  pthread_cond_t     start;
+  pthread_cond_t     done;
+};
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_sampler_pool__drain(sampler_pool_t * self) {
+  for (;;) {
+    int i = __atomic_fetch_add(&self->next, 1, __ATOMIC_RELAXED);
+    if (i >= self->n_items)
+      break;
+
+    _py_proc_list__sample_item(self->items[i]);
+  }
+} /* _sampler_pool__drain */
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_sampler_pool__report(sampler_pool_t * self) {
+  pthread_mutex_lock(&self->lock);
+  if (--self->pending == 0)
+    pthread_cond_signal(&self->done);
+  pthread_mutex_unlock(&self->lock);
+} /* _sampler_pool__report */
+
+
+// ----------------------------------------------------------------------------
+static void *
+_sampler__run(void * arg) {
+  sampler_t      * self  = (sampler_t *) arg;
+  sampler_pool_t * pool  = self->pool;
+  unsigned long    round = 0;
+
+  self->stream = open_memstream(&self->buffer, &self->size);
+  if (!isvalid(self->stream) || fail(py_thread_allocate_local())) {
+    log_e("Failed to initialise sampler thread");
+    if (isvalid(self->stream))
+      fclose(self->stream);
+    sfree(self->buffer);
+    _sampler_pool__report(pool);
+    return NULL;
+  }
+
+  _output_file = self->stream;
+  self->ready  = TRUE;
+  _sampler_pool__report(pool);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->round == round && !pool->stop)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    round = pool->round;
+    int stop = pool->stop;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (stop)
+      break;
+
+    _sampler_pool__drain(pool);
+
+    // Make the output buffer available to the main thread.
+    mojo_flush();
+    fflush(self->stream);
+    _sampler_pool__report(pool);
+  }
+
+  py_thread_free_local();
+  fclose(self->stream);
+  sfree(self->buffer);
+
+  return NULL;
+} /* _sampler__run */
+
+
+// ----------------------------------------------------------------------------
+static void
+_sampler_pool__destroy(sampler_pool_t * self) {
+  if (!isvalid(self))
+    return;
+
+  if (isvalid(self->samplers)) {
+    pthread_mutex_lock(&self->lock);
+    self->stop = TRUE;
+    pthread_cond_broadcast(&self->start);
+    pthread_mutex_unlock(&self->lock);
+
+    for (int i = 0; i < self->size; i++)
+      pthread_join(self->samplers[i].thread, NULL);
+
+    free(self->samplers);
+  }
+
+  pthread_cond_destroy(&self->done);
+  pthread_cond_destroy(&self->start);
+  pthread_mutex_destroy(&self->lock);
+
+  sfree(self->items);
+  free(self);
+} /* _sampler_pool__destroy */
+
+
+// ----------------------------------------------------------------------------
+static sampler_pool_t *
+_sampler_pool_new(int size) {
+  sampler_pool_t * pool = (sampler_pool_t *) calloc(1, sizeof(sampler_pool_t));
+  if (!isvalid(pool))
+    return NULL;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  pool->samplers = (sampler_t *) calloc(size, sizeof(sampler_t));
+  if (!isvalid(pool->samplers))
+    goto error;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->pending = size;
+  for (int i = 0; i < size; i++) {
+    pool->samplers[i].pool = pool;
+    if (pthread_create(&pool->samplers[i].thread, NULL, _sampler__run, &pool->samplers[i])) {
+      pool->pending -= size - i;
+      break;
+    }
+    pool->size++;
+  }
+
+  // Wait for the samplers to be ready.
+  while (pool->pending)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->size; i++)
+    pool->running += pool->samplers[i].ready;
+
+  if (pool->running == 0)
+    goto error;
+
+  return pool;
+
+error:
+  _sampler_pool__destroy(pool);
+
+  return NULL;
+} /* _sampler_pool_new */
+
+
+// ----------------------------------------------------------------------------
+static int
+_sampler_pool__sample(sampler_pool_t * self, py_proc_list_t * list) {
+  if (list->count > self->max_items) {
+    py_proc_item_t ** items = (py_proc_item_t **) realloc(
+      self->items, list->count * sizeof(py_proc_item_t *)
+    );
+    if (!isvalid(items))
+      FAIL;
+
+    self->items     = items;
+    self->max_items = list->count;
+  }
+
+  self->n_items = 0;
+  for (py_proc_item_t * item = list->first; item != NULL; item = item->next)
+    self->items[self->n_items++] = item;
+  self->next = 0;
+
+  pthread_mutex_lock(&self->lock);
+  self->pending = self->running;
+  self->round++;
+  pthread_cond_broadcast(&self->start);
+  pthread_mutex_unlock(&self->lock);
+
+  // The main thread takes part in the round too, writing straight to the
+  // output stream.
+  _sampler_pool__drain(self);
+
+  pthread_mutex_lock(&self->lock);
+  while (self->pending)
+    pthread_cond_wait(&self->done, &self->lock);
+  pthread_mutex_unlock(&self->lock);
+
+  // Merge the sampler buffers into the output stream, after what the main
+  // thread has emitted in the round.
+  mojo_flush();
+  for (int i = 0; i < self->size; i++) {
+    sampler_t * sampler = &self->samplers[i];
+    if (!sampler->ready || sampler->size == 0)
+      continue;
+
+    fwrite(sampler->buffer, 1, sampler->size, output_stream());
+    rewind(sampler->stream);
+  }
+
+  SUCCESS;
+} /* _sampler_pool__sample */
+
+#endif /* SAMPLER_POOL */
+
+
 
 // ----------------------------------------------------------------------------
 static void
@@ -57,6 +318,7 @@ _py_proc_list__add(py_proc_list_t * self, py_proc_t * py_proc) {
 
   // Insert at the beginning of the list
   item->py_proc = py_proc;
+  item->failed  = FALSE;
 
   item->next = self->first;
   item->prev = NULL;
@@ -109,103 +371,173 @@ _py_proc_list__remove(py_proc_list_t * self, py_proc_item_t * item) {
 } /* _py_proc_list__remove */
 
 
-// ----------------------------------------------------------------------------
-py_proc_list_t *
-py_proc_list_new(py_proc_t * parent_py_proc) {
-  py_proc_list_t * list = (py_proc_list_t *) calloc(1, sizeof(py_proc_list_t));
-  if (!isvalid(list))
-    return NULL;
+// ---- CHILD PROCESS DISCOVERY -----------------------------------------------
 
-  log_t("Maximum number of PIDs: %d", list->pids);
+static const char * _discovery_names[] = {"netlink", "children", "scan"};
 
-  list->py_proc_for_pid = lookup_new(256);
-  if (!isvalid(list->py_proc_for_pid))
-    goto error;
 
-  list->ppid_for_pid = lookup_new(1024);
-  if (!isvalid(list->ppid_for_pid)) {
+#define _py_proc_list__is_tracked(self, pid) (                                 \
+  (pid) == (self)->root                                                        \
+  || isvalid(lookup__get((self)->ppid_for_pid, pid))                           \
+  || _py_proc_list__has_pid(self, pid)                                         \
+)
+
+
+#ifdef PROC_CONNECTOR
+// ----------------------------------------------------------------------------
+static int
+_proc_connector_open(void) {
+  struct sockaddr_nl addr = {
+    .nl_family = AF_NETLINK,
+    .nl_groups = CN_IDX_PROC,
+    .nl_pid    = 0,
+  };
+
+  struct __attribute__((aligned(NLMSG_ALIGNTO))) {
+    struct nlmsghdr header;
+    struct __attribute__((__packed__)) {
+      struct cn_msg          message;
+      enum proc_cn_mcast_op  op;
+    };
+  } request;
+
+  int sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+  if (sock == -1)
+    return -1;
+
+  // Subscribing to the proc connector requires CAP_NET_ADMIN.
+  if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == -1)
     goto error;
-  }
 
-  // Add the parent process to the list.
-  _py_proc_list__add(list, parent_py_proc);
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len  = sizeof(request);
+  request.header.nlmsg_type = NLMSG_DONE;
+  request.header.nlmsg_pid  = getpid();
+  request.message.id.idx    = CN_IDX_PROC;
+  request.message.id.val    = CN_VAL_PROC;
+  request.message.len       = sizeof(enum proc_cn_mcast_op);
+  request.op                = PROC_CN_MCAST_LISTEN;
 
-  return list;
+  if (send(sock, &request, sizeof(request), 0) == -1)
+    goto error;
+
+  return sock;
 
 error:
-  py_proc_list__destroy(list);
-  
-  return NULL;
-} /* py_proc_list_new */
+  close(sock);
+  return -1;
+} /* _proc_connector_open */
 
 
 // ----------------------------------------------------------------------------
-void
-py_proc_list__add_proc_children(py_proc_list_t * self, uintptr_t ppid) {
-  lookup__iteritems_start(self->ppid_for_pid, key_dt, pid, value_t, pid_ppid) {
-    if (pid_ppid == (value_t) ppid && !_py_proc_list__has_pid(self, pid)) {
-      py_proc_t * child_proc = py_proc_new(TRUE);
-      if (child_proc == NULL)
+static int
+_py_proc_list__read_events(py_proc_list_t * self) {
+  char buffer[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+  for (;;) {
+    ssize_t n = recv(self->events, buffer, sizeof(buffer), 0);
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+
+      // Most likely ENOBUFS, which means that we have lost some events.
+      log_d("Failed to read proc connector events (errno %d)", errno);
+      FAIL;
+    }
+
+    for (
+      struct nlmsghdr * header = (struct nlmsghdr *) buffer;
+      NLMSG_OK(header, n);
+      header = NLMSG_NEXT(header, n)
+    ) {
+      if (header->nlmsg_type == NLMSG_ERROR || header->nlmsg_type == NLMSG_NOOP)
         continue;
 
-      if (py_proc__attach(child_proc, pid)) {
-        py_proc__destroy(child_proc);
+      struct cn_msg * message = (struct cn_msg *) NLMSG_DATA(header);
+      if (message->id.idx != CN_IDX_PROC || message->id.val != CN_VAL_PROC)
         continue;
-      }
 
-      _py_proc_list__add(self, child_proc);
-      py_proc__log_version(child_proc, FALSE);
-      py_proc_list__add_proc_children(self, pid);
+      struct proc_event * event = (struct proc_event *) message->data;
+      switch (event->what) {
+      case PROC_EVENT_FORK:
+        // We are only interested in new processes, not new threads, and only
+        // within the process tree that we are tracking.
+        if (event->event_data.fork.child_pid != event->event_data.fork.child_tgid)
+          break;
+        if (_py_proc_list__is_tracked(self, event->event_data.fork.parent_tgid))
+          lookup__set(
+            self->ppid_for_pid,
+            event->event_data.fork.child_tgid,
+            (value_t) (uintptr_t) event->event_data.fork.parent_tgid
+          );
+        break;
+
+      case PROC_EVENT_EXIT:
+        if (event->event_data.exit.process_pid == event->event_data.exit.process_tgid)
+          lookup__del(self->ppid_for_pid, event->event_data.exit.process_tgid);
+        break;
+
+      default:
+        break;
+      }
     }
-  } lookup__iter_stop(self->ppid_for_pid);
-} /* py_proc_list__add_proc_children */
+  }
+
+  SUCCESS;
+} /* _py_proc_list__read_events */
+#endif
 
 
+#if defined PL_LINUX
 // ----------------------------------------------------------------------------
-int
-py_proc_list__is_empty(py_proc_list_t * self) {
-  return !isvalid(self->first);
-} /* py_proc_list__is_empty */
+static int
+_has_children_files(void) {
+  char path[64];
+
+  sprintf(path, "/proc/%d/task/%d/children", getpid(), getpid());
+
+  return access(path, R_OK) == 0;
+} /* _has_children_files */
 
 
 // ----------------------------------------------------------------------------
-void
-py_proc_list__sample(py_proc_list_t * self) {
-  log_t("Sampling from process list");
+static void
+_py_proc_list__walk_children(py_proc_list_t * self, pid_t pid) {
+  char            path[320];
+  struct dirent * ent;
 
-  for (py_proc_item_t * item = self->first; item != NULL; /* item = item->next */) {
-    log_t("Sampling process with PID %d", item->py_proc->pid);
-    stopwatch_start();
-    if (!isvalid(item->py_proc->py_v) || fail(py_proc__sample(item->py_proc))) {
-      py_proc__wait(item->py_proc);
-      py_proc_item_t * next = item->next;
-      _py_proc_list__remove(self, item);
-      item = next;
-    }
-    else
-      item = item->next;
-    stopwatch_duration();
-  }
-} /* py_proc_list__sample */
+  sprintf(path, "/proc/%d/task", pid);
+  cu_DIR * task_dir = opendir(path);
+  if (!isvalid(task_dir))
+    return;
 
+  while (isvalid(ent = readdir(task_dir))) {
+    if (*ent->d_name < '0' || *ent->d_name > '9')
+      continue;
 
-// ----------------------------------------------------------------------------
-int
-py_proc_list__size(py_proc_list_t * self) {
-  return self->count;
-}
+    sprintf(path, "/proc/%d/task/%s/children", pid, ent->d_name);
+    cu_FILE * children = fopen(path, "r");
+    if (!isvalid(children))
+      continue;
+
+    int child;
+    while (fscanf(children, "%d", &child) == 1) {
+      if (isvalid(lookup__get(self->ppid_for_pid, child)))
+        continue;
 
+      lookup__set(self->ppid_for_pid, child, (value_t) (uintptr_t) pid);
+      _py_proc_list__walk_children(self, child);
+    }
+  }
+} /* _py_proc_list__walk_children */
+#endif
 
-// ----------------------------------------------------------------------------
-void
-py_proc_list__update(py_proc_list_t * self) {
-  ctime_t now = gettime();
-  if (now - self->timestamp < UPDATE_INTERVAL)
-    return;  // Do not update too frequently as this is an expensive operation.
 
+// ----------------------------------------------------------------------------
+static void
+_py_proc_list__scan(py_proc_list_t * self) {
   lookup__clear(self->ppid_for_pid);
 
-  // Update PID table
   #if defined PL_LINUX                                               /* LINUX */
   char            buffer[1024];
   struct dirent * ent;
@@ -303,6 +635,191 @@ py_proc_list__update(py_proc_list_t * self) {
   }
   #endif
 
+} /* _py_proc_list__scan */
+
+
+// ----------------------------------------------------------------------------
+static void
+_py_proc_list__rebuild(py_proc_list_t * self) {
+  #if defined PL_LINUX
+  if (self->discovery != DISCOVERY_SCAN && _has_children_files()) {
+    lookup__clear(self->ppid_for_pid);
+
+    // Processes whose parent has died are reparented, so we also walk from the
+    // processes that we are already sampling.
+    _py_proc_list__walk_children(self, self->root);
+    for (py_proc_item_t * item = self->first; item != NULL; item = item->next)
+      _py_proc_list__walk_children(self, item->py_proc->pid);
+
+    return;
+  }
+  #endif
+
+  _py_proc_list__scan(self);
+} /* _py_proc_list__rebuild */
+
+
+// ----------------------------------------------------------------------------
+py_proc_list_t *
+py_proc_list_new(py_proc_t * parent_py_proc) {
+  py_proc_list_t * list = (py_proc_list_t *) calloc(1, sizeof(py_proc_list_t));
+  if (!isvalid(list))
+    return NULL;
+
+  // Make sure that we don't close stdin if we bail out early.
+  list->events = -1;
+
+  log_t("Maximum number of PIDs: %d", list->pids);
+
+  list->py_proc_for_pid = lookup_new(256);
+  if (!isvalid(list->py_proc_for_pid))
+    goto error;
+
+  list->ppid_for_pid = lookup_new(1024);
+  if (!isvalid(list->ppid_for_pid)) {
+    goto error;
+  }
+
+  // Add the parent process to the list.
+  _py_proc_list__add(list, parent_py_proc);
+  list->root = parent_py_proc->pid;
+
+  // Pick the cheapest child process discovery strategy available.
+  list->discovery = DISCOVERY_SCAN;
+  #ifdef PROC_CONNECTOR
+  if ((list->events = _proc_connector_open()) >= 0)
+    list->discovery = DISCOVERY_NETLINK;
+  else
+  #endif
+  #if defined PL_LINUX
+  if (_has_children_files())
+    list->discovery = DISCOVERY_CHILDREN;
+  #endif
+  log_i("Child process discovery strategy: %s", _discovery_names[list->discovery]);
+
+  if (pargs.jobs > 1) {
+    #ifdef SAMPLER_POOL
+    list->pool = _sampler_pool_new(pargs.jobs - 1);
+    if (!isvalid(list->pool))
+      log_w("Failed to create the sampler pool. Sampling with a single thread.");
+    else
+      log_i("Sampling child processes with %d threads", list->pool->running + 1);
+    #else
+    log_w("Sampling with multiple threads is not supported. Sampling with a single thread.");
+    #endif
+  }
+
+  return list;
+
+error:
+  py_proc_list__destroy(list);
+  
+  return NULL;
+} /* py_proc_list_new */
+
+
+// ----------------------------------------------------------------------------
+void
+py_proc_list__add_proc_children(py_proc_list_t * self, uintptr_t ppid) {
+  lookup__iteritems_start(self->ppid_for_pid, key_dt, pid, value_t, pid_ppid) {
+    if (pid_ppid == (value_t) ppid && !_py_proc_list__has_pid(self, pid)) {
+      py_proc_t * child_proc = NULL;
+
+      // Forked children can inherit the state of their parent, which saves us
+      // from analysing the same binaries all over again.
+      py_proc_t * parent_proc = lookup__get(self->py_proc_for_pid, ppid);
+      if (isvalid(parent_proc)) {
+        child_proc = py_proc_new(TRUE);
+        if (isvalid(child_proc) && fail(py_proc__attach_from(child_proc, parent_proc, pid))) {
+          py_proc__destroy(child_proc);
+          child_proc = NULL;
+        }
+      }
+
+      if (!isvalid(child_proc)) {
+        child_proc = py_proc_new(TRUE);
+        if (child_proc == NULL)
+          continue;
+
+        if (py_proc__attach(child_proc, pid)) {
+          py_proc__destroy(child_proc);
+          continue;
+        }
+      }
+
+      _py_proc_list__add(self, child_proc);
+      py_proc__log_version(child_proc, FALSE);
+      py_proc_list__add_proc_children(self, pid);
+    }
+  } lookup__iter_stop(self->ppid_for_pid);
+} /* py_proc_list__add_proc_children */
+
+
+// ----------------------------------------------------------------------------
+int
+py_proc_list__is_empty(py_proc_list_t * self) {
+  return !isvalid(self->first);
+} /* py_proc_list__is_empty */
+
+
+// ----------------------------------------------------------------------------
+void
+py_proc_list__sample(py_proc_list_t * self) {
+  log_t("Sampling from process list");
+
+  #ifdef SAMPLER_POOL
+  if (!isvalid(self->pool) || self->count < 2 || fail(_sampler_pool__sample(self->pool, self)))
+  #endif
+  for (py_proc_item_t * item = self->first; item != NULL; item = item->next)
+    _py_proc_list__sample_item(item);
+
+  // Remove the processes that we failed to sample.
+  for (py_proc_item_t * item = self->first; item != NULL; /* item = item->next */) {
+    if (item->failed) {
+      py_proc__wait(item->py_proc);
+      py_proc_item_t * next = item->next;
+      _py_proc_list__remove(self, item);
+      item = next;
+    }
+    else
+      item = item->next;
+  }
+} /* py_proc_list__sample */
+
+
+// ----------------------------------------------------------------------------
+int
+py_proc_list__size(py_proc_list_t * self) {
+  return self->count;
+}
+
+
+// ----------------------------------------------------------------------------
+void
+py_proc_list__update(py_proc_list_t * self) {
+  ctime_t now = gettime();
+  if (now - self->timestamp < UPDATE_INTERVAL)
+    return;  // Do not update too frequently.
+
+  // Update PID table
+  switch (self->discovery) {
+  #ifdef PROC_CONNECTOR
+  case DISCOVERY_NETLINK:
+    // We rebuild the PID table from scratch on the first update, and every
+    // time we lose some events.
+    if (!self->synced || fail(_py_proc_list__read_events(self))) {
+      _py_proc_list__rebuild(self);
+      self->synced = TRUE;
+    }
+    break;
+  #endif
+
+  default:
+    _py_proc_list__rebuild(self);
+  }
+
+  stats_discovery_time(gettime() - now);
+
   log_t("PID table populated");
 
   // Attach to new PIDs.
@@ -338,6 +855,11 @@ py_proc_list__wait(py_proc_list_t * self) {
 // ----------------------------------------------------------------------------
 void
 py_proc_list__destroy(py_proc_list_t * self) {
+  #ifdef SAMPLER_POOL
+  _sampler_pool__destroy(self->pool);
+  self->pool = NULL;
+  #endif
+
   // Remove all items first
   while (self->first)
     _py_proc_list__remove(self, self->first);
@@ -347,6 +869,11 @@ py_proc_list__destroy(py_proc_list_t * self) {
 
   lookup__destroy(self->ppid_for_pid);
   self->ppid_for_pid = NULL;
+
+  #if defined PL_LINUX
+  if (self->events >= 0)
+    close(self->events);
+  #endif
   
   free(self);
 } /* py_proc_list__destroy */
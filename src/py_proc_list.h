@@ -30,17 +30,35 @@
 
 typedef struct _py_proc_item {
   py_proc_t            * py_proc;
+  int                    failed;     // Whether the last sample failed
   struct _py_proc_item * next;
   struct _py_proc_item * prev;
 } py_proc_item_t;
 
 
+typedef struct _sampler_pool sampler_pool_t;
+
+
+// The strategies for discovering child processes, from the cheapest to the
+// most expensive one.
+typedef enum {
+  DISCOVERY_NETLINK,   // Fork/exit events from the kernel proc connector
+  DISCOVERY_CHILDREN,  // Walk of the procfs children files from the root
+  DISCOVERY_SCAN,      // Full scan of all the running processes
+} discovery_t;
+
+
 typedef struct {
   int              count;            // Number of entries in the list
   py_proc_item_t * first;            // First item in the list
   lookup_t       * py_proc_for_pid;  // PID to py_proc_t lookup table
   lookup_t       * ppid_for_pid;     // PID to PPID lookup table
   ctime_t          timestamp;        // Timestamp of the last update
+  sampler_pool_t * pool;             // Pool of additional sampler threads
+  pid_t            root;             // PID of the parent process
+  discovery_t      discovery;        // Child process discovery strategy
+  int              events;           // Proc connector socket, if any
+  int              synced;           // Whether the PID table is up to date
 } py_proc_list_t;
 
 
@@ -91,6 +109,11 @@ py_proc_list__size(py_proc_list_t *);
 /**
  * Sample from all the processes in the list.
  *
+ * If more than one job was requested, the processes are shared among a pool of
+ * sampler threads. Each thread writes to a private output buffer and all the
+ * buffers are then merged into the output stream once every process has been
+ * sampled. Processes that could not be sampled are removed from the list.
+ *
  * @param  py_proc_list_t  the list.
  */
 void
@@ -104,8 +127,8 @@ py_proc_list__sample(py_proc_list_t *);
  * running processes in the list. Old processes that are not running anymore
  * are removed.
  *
- * This method is quite expensive so it is executed no more frequently than
- * once every 0.1s.
+ * The PID table is refreshed with the cheapest discovery strategy available.
+ * This method is executed no more frequently than once every 0.1s.
  *
  * @param  py_proc_list_t  the list.
  */
@@ -69,15 +69,29 @@
 
 #define NULL_HEAP ((_heap_t) {NULL, 0})
 
-static _heap_t      _frames      = NULL_HEAP;
-static _heap_t      _frames_heap = NULL_HEAP;
+static __thread _heap_t _frames      = NULL_HEAP;
+static __thread _heap_t _frames_heap = NULL_HEAP;
+
+// The maximum number of frames to resolve with a single batch of reads.
+#define MAX_BATCHED_FRAMES 32
+
+static __thread mem_batch_t * _batch = NULL;
 
 static size_t           max_pid    = 0;
 #ifdef NATIVE
-static void          ** _tids      = NULL;
-static unsigned char *  _tids_idle = NULL;
-static unsigned char *  _tids_int  = NULL;
-static char          ** _kstacks   = NULL;
+// The state of the threads that we have seen in native mode. This is keyed by
+// TID so that its size depends on the number of live threads, rather than on
+// the largest possible TID. The state of a thread is dropped once the thread
+// is gone.
+typedef struct {
+  pid_t           pid;          // The process that the thread belongs to
+  void          * context;      // The libunwind context, once seized
+  int             idle;
+  int             interrupted;
+  char          * kstack;       // The last kernel stack that has been read
+} tid_state_t;
+
+static lookup_t        * _tids      = NULL;
 #endif
 
 // ----------------------------------------------------------------------------
@@ -90,6 +104,10 @@ _py_thread__read_frames(py_thread_t * self) {
 
   size_t newsize;
   size_t maxsize = pargs.heap >> 1;
+  int    frames_index = -1, frames_heap_index = -1;
+
+  // Both frame areas are fetched with a single batch of reads.
+  mem_batch__reset(_batch, self->raddr.pref);
 
   if (isvalid(self->proc->frames.newhi)) {
     newsize = self->proc->frames.newhi - self->proc->frames.newlo;
@@ -102,12 +120,7 @@ _py_thread__read_frames(py_thread_t * self) {
       self->proc->frames.hi = self->proc->frames.newhi;
       self->proc->frames.lo = self->proc->frames.newlo;
     }
-    if (fail(copy_memory(self->raddr.pref, self->proc->frames.lo, newsize, _frames.content))) {
-      log_d("Failed to read remote frame area; will reset");
-      sfree(_frames.content);
-      _frames = NULL_HEAP;
-      self->proc->frames = NULL_MEM_BLOCK;
-    }
+    frames_index = mem_batch__add(_batch, self->proc->frames.lo, newsize, _frames.content);
   }
 
   if (isvalid(self->proc->frames_heap.newhi)) {
@@ -121,13 +134,24 @@ _py_thread__read_frames(py_thread_t * self) {
       self->proc->frames_heap.hi = self->proc->frames_heap.newhi;
       self->proc->frames_heap.lo = self->proc->frames_heap.newlo;
     }
-    if (fail(copy_memory(self->raddr.pref, self->proc->frames_heap.lo, newsize, _frames_heap.content))) {
-      log_d("Failed to read remote frame area near heap; will reset");
-      sfree(_frames_heap.content);
-      _frames_heap = NULL_HEAP;
-      self->proc->frames_heap = NULL_MEM_BLOCK;
+    frames_heap_index = mem_batch__add(_batch, self->proc->frames_heap.lo, newsize, _frames_heap.content);
+  }
 
-    }
+  if (success(mem_batch__flush(_batch)))
+    return;
+
+  if (frames_index >= 0 && !mem_batch__ok(_batch, frames_index)) {
+    log_d("Failed to read remote frame area; will reset");
+    sfree(_frames.content);
+    _frames = NULL_HEAP;
+    self->proc->frames = NULL_MEM_BLOCK;
+  }
+
+  if (frames_heap_index >= 0 && !mem_batch__ok(_batch, frames_heap_index)) {
+    log_d("Failed to read remote frame area near heap; will reset");
+    sfree(_frames_heap.content);
+    _frames_heap = NULL_HEAP;
+    self->proc->frames_heap = NULL_MEM_BLOCK;
   }
 } /* _py_thread__read_frames */
 
@@ -155,39 +179,222 @@ _py_thread__read_stack(py_thread_t * self) {
 
 
 // ----------------------------------------------------------------------------
-static inline int
-_py_thread__resolve_py_stack(py_thread_t * self) {
-  lru_cache_t * cache = self->proc->frame_cache;
+typedef struct {
+  int             index;   // Position within the stack
+  int             alias;   // Index of the miss with the same code, or -1
+  key_dt          key;
+  py_frame_t      py_frame;
+  PyCodeObject    code;
+  PyBytesObject   bytes;
+  unsigned char * lnotab;
+  ssize_t         len;
+  int             failed;
+  code_info_t   * info;
+} _frame_miss_t;
 
-  for (int i = 0; i < stack_pointer(); i++) {
-    py_frame_t py_frame = stack_py_get(i);
 
-    #ifdef NATIVE
-    if (py_frame.origin == CFRAME_MAGIC) {
-      stack_set(i, CFRAME_MAGIC);
+// ----------------------------------------------------------------------------
+#define _code_type(code) ((void *) ((PyObject *) &(code))->ob_type)
+
+static inline void
+_py_thread__read_frame_misses(py_thread_t * self, _frame_miss_t * misses, int n) {
+  V_DESC(self->proc->py_v);
+
+  int indices[MAX_BATCHED_FRAMES];
+
+  // Read all the code objects in one go ...
+  mem_batch__reset(_batch, self->raddr.pref);
+  for (int j = 0; j < n; j++) {
+    if (misses[j].alias >= 0)
+      continue;
+    indices[j] = mem_batch__add(_batch, misses[j].py_frame.code, py_v->py_code.size, &misses[j].code);
+  }
+  if (fail(mem_batch__flush(_batch))) {
+    for (int j = 0; j < n; j++)
+      if (misses[j].alias < 0 && !mem_batch__ok(_batch, indices[j]))
+        misses[j].failed = TRUE;
+  }
+
+  // Deferred samples are resolved some time after they have been taken, so
+  // their code objects might have been freed in the meantime.
+  if (isvalid(self->proc->code_type)) {
+    for (int j = 0; j < n; j++)
+      if (misses[j].alias < 0 && !misses[j].failed && _code_type(misses[j].code) != self->proc->code_type)
+        misses[j].failed = TRUE;
+  }
+
+  // ... then check whether we already have the information about them ...
+  for (int j = 0; j < n; j++) {
+    if (misses[j].alias >= 0 || misses[j].failed)
+      continue;
+    code_info_t * info = lru_cache__maybe_hit(self->proc->code_cache, (key_dt) misses[j].py_frame.code);
+    if (isvalid(info) && _code_info__is_of(info, &misses[j].code, py_v))
+      misses[j].info = info;
+  }
+
+  // ... otherwise read the headers of the line tables ...
+  mem_batch__reset(_batch, self->raddr.pref);
+  for (int j = 0; j < n; j++) {
+    if (misses[j].alias >= 0 || misses[j].failed || isvalid(misses[j].info))
+      continue;
+    void * lnotab_raddr = py_code_lnotab_raddr(misses[j].code);
+    indices[j] = mem_batch__add(_batch, lnotab_raddr, sizeof(PyBytesObject), &misses[j].bytes);
+  }
+  if (fail(mem_batch__flush(_batch))) {
+    for (int j = 0; j < n; j++)
+      if (misses[j].alias < 0 && !misses[j].failed && !mem_batch__ok(_batch, indices[j]))
+        misses[j].failed = TRUE;
+  }
+
+  // ... and finally their content.
+  mem_batch__reset(_batch, self->raddr.pref);
+  for (int j = 0; j < n; j++) {
+    if (misses[j].alias >= 0 || misses[j].failed || isvalid(misses[j].info))
+      continue;
+    ssize_t len = misses[j].bytes.ob_base.ob_size + 1; // Include null-terminator
+    if (len < 1) {
+      log_e("PyBytesObject is too short");
+      misses[j].failed = TRUE;
       continue;
     }
-    #endif
-    int       lasti     = py_frame.lasti;
-    key_dt    frame_key = py_frame_key(py_frame.code, lasti);
-    frame_t * frame     = lru_cache__maybe_hit(cache, frame_key);
+    misses[j].lnotab = (unsigned char *) malloc(len + 1);
+    if (!isvalid(misses[j].lnotab)) {
+      misses[j].failed = TRUE;
+      continue;
+    }
+    misses[j].lnotab[len] = 0;
+    misses[j].len         = len - 1;
 
-    if (!isvalid(frame)) {
-      frame = _frame_from_code_raddr(self->proc, py_frame.code, lasti, self->proc->py_v);
-      if (!isvalid(frame)) {
-        log_ie("Failed to get frame from code object");
-        // Truncate the stack to the point where we have successfully resolved.
-        _stack->pointer = i;
-        set_error(ETHREAD);
-        FAIL;
+    void * lnotab_raddr = py_code_lnotab_raddr(misses[j].code);
+    indices[j] = mem_batch__add(
+      _batch, lnotab_raddr + offsetof(PyBytesObject, ob_sval), len, misses[j].lnotab
+    );
+  }
+  if (fail(mem_batch__flush(_batch))) {
+    for (int j = 0; j < n; j++)
+      if (misses[j].alias < 0 && isvalid(misses[j].lnotab) && !mem_batch__ok(_batch, indices[j]))
+        misses[j].failed = TRUE;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_py_thread__store_frame(py_thread_t * self, ssize_t index, key_dt key, frame_t * frame) {
+  if (!isvalid(frame)) {
+    log_ie("Failed to get frame from code object");
+    // Truncate the stack to the point where we have successfully resolved.
+    _stack->pointer = index;
+    set_error(ETHREAD);
+    FAIL;
+  }
+
+  lru_cache__store(self->proc->frame_cache, key, frame);
+  if (pargs.binary) {
+    mojo_frame(frame);
+  }
+
+  stack_set(index, frame);
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_py_thread__resolve_py_stack(py_thread_t * self) {
+  lru_cache_t   * cache      = self->proc->frame_cache;
+  lru_cache_t   * code_cache = self->proc->code_cache;
+  _frame_miss_t   misses[MAX_BATCHED_FRAMES];
+  int             n = 0;
+  int             i = 0;
+
+  V_DESC(self->proc->py_v);
+
+  // Frames that are not in the cache are collected and resolved in batches,
+  // so that the remote reads that they require are done with as few system
+  // calls as possible. Code objects that we have seen already only need to be
+  // read to check that they are still the same.
+  while (i < stack_pointer()) {
+    for (n = 0; i < stack_pointer() && n < MAX_BATCHED_FRAMES; i++) {
+      py_frame_t py_frame = stack_py_get(i);
+
+      #ifdef NATIVE
+      if (py_frame.origin == CFRAME_MAGIC) {
+        stack_set(i, CFRAME_MAGIC);
+        continue;
       }
-      lru_cache__store(cache, frame_key, frame);
-      if (pargs.binary) {
-        mojo_frame(frame);
+      #endif
+      key_dt    frame_key = py_frame_key(py_frame.code, py_frame.lasti);
+      frame_t * frame     = lru_cache__maybe_hit(cache, frame_key);
+
+      if (isvalid(frame)) {
+        stack_set(i, frame);
+        continue;
       }
+
+      _frame_miss_t * miss = &misses[n];
+      miss->index    = i;
+      miss->alias    = -1;
+      miss->key      = frame_key;
+      miss->py_frame = py_frame;
+      miss->lnotab   = NULL;
+      miss->len      = 0;
+      miss->failed   = FALSE;
+      miss->info     = NULL;
+
+      // Code objects that occur multiple times (e.g. with recursion) are read
+      // only once.
+      for (int j = 0; j < n; j++) {
+        if (misses[j].key == frame_key) {
+          miss->alias = j;
+          break;
+        }
+        if (miss->alias < 0 && misses[j].py_frame.code == py_frame.code)
+          miss->alias = j;
+      }
+      n++;
     }
 
-    stack_set(i, frame);
+    if (n == 0)
+      continue;
+
+    _py_thread__read_frame_misses(self, misses, n);
+
+    for (int j = 0; j < n; j++) {
+      _frame_miss_t * miss  = &misses[j];
+      frame_t       * frame = NULL;
+
+      if (miss->alias >= 0) {
+        _frame_miss_t * alias = &misses[miss->alias];
+        if (alias->key == miss->key) {
+          stack_set(miss->index, stack_get(alias->index));
+          continue;
+        }
+        miss->info = alias->info;
+      }
+      else if (!miss->failed && !isvalid(miss->info)) {
+        miss->info = _code_info_new(self->proc, &miss->code, miss->lnotab, miss->len, py_v);
+        sfree(miss->lnotab);
+        if (isvalid(miss->info)) {
+          lru_cache__store(code_cache, (key_dt) miss->py_frame.code, miss->info);
+
+          // Remember the type of code objects to validate the ones of the
+          // samples that are resolved later on.
+          if (isvalid(self->proc->resolver) && !isvalid(self->proc->code_type))
+            self->proc->code_type = _code_type(miss->code);
+        }
+      }
+
+      if (isvalid(miss->info))
+        frame = _frame_from_code_info(miss->info, miss->py_frame.code, miss->py_frame.lasti, py_v);
+
+      if (fail(_py_thread__store_frame(self, miss->index, miss->key, frame))) {
+        for (; j < n; j++)
+          sfree(misses[j].lnotab);
+        FAIL;
+      }
+    }
   }
 
   SUCCESS;
@@ -383,20 +590,12 @@ _py_thread__push_iframe(py_thread_t * self, void ** prev) {
 
 
 // ----------------------------------------------------------------------------
+// Unwind the frames from the given one, assuming that the frames above it are
+// on the stack already.
 static inline int
-_py_thread__unwind_frame_stack(py_thread_t * self) {
+_py_thread__unwind_frame_chain(py_thread_t * self, void * prev) {
   int invalid = FALSE;
 
-  _py_thread__read_frames(self);
-  
-  stack_reset();
-
-  void * prev = self->top_frame;
-  if (fail(_py_thread__push_frame(self, &prev))) {
-    log_ie("Failed to fill top frame");
-    FAIL;
-  }
-
   while (isvalid(prev)) {
     if (fail(_py_thread__push_frame(self, &prev))) {
       log_d("Failed to retrieve frame #%d (from top).", stack_pointer());
@@ -419,6 +618,23 @@ _py_thread__unwind_frame_stack(py_thread_t * self) {
 }
 
 
+// ----------------------------------------------------------------------------
+static inline int
+_py_thread__unwind_frame_stack(py_thread_t * self) {
+  _py_thread__read_frames(self);
+  
+  stack_reset();
+
+  void * prev = self->top_frame;
+  if (fail(_py_thread__push_frame(self, &prev))) {
+    log_ie("Failed to fill top frame");
+    FAIL;
+  }
+
+  return _py_thread__unwind_frame_chain(self, prev);
+}
+
+
 // ----------------------------------------------------------------------------
 static inline int
 _py_thread__unwind_iframe_stack(py_thread_t * self, void * iframe_raddr) {
@@ -444,8 +660,6 @@ _py_thread__unwind_iframe_stack(py_thread_t * self, void * iframe_raddr) {
       break;
     }
   }
-  
-  invalid = fail(_py_thread__resolve_py_stack(self)) || invalid;
 
   return invalid;
 }
@@ -474,37 +688,105 @@ _py_thread__unwind_cframe_stack(py_thread_t * self) {
 
 #ifdef NATIVE
 // ----------------------------------------------------------------------------
-int
-py_thread__set_idle(py_thread_t * self) {
-  unsigned char bit   = 1 << (self->tid & 7);
-  size_t        index = self->tid >> 3;
+static inline void
+_tid_state__destroy(tid_state_t * self) {
+  if (isvalid(self->context))
+    _UPT_destroy(self->context);
+  sfree(self->kstack);
+  free(self);
+}
 
-  if (index > (max_pid >> 3)) {
-    log_e("Invalid TID");
-    set_error(ETHREAD);
-    FAIL;
+
+// ----------------------------------------------------------------------------
+// Get the state of the thread, creating it if this is the first time we see
+// the thread. A state left behind by a thread of another process with the same
+// TID is replaced.
+static inline tid_state_t *
+_py_thread__get_state(py_thread_t * self) {
+  tid_state_t * state = (tid_state_t *) lookup__get(_tids, (key_dt) self->tid);
+  if (isvalid(state)) {
+    if (state->pid == self->proc->pid)
+      return state;
+
+    lookup__del(_tids, (key_dt) self->tid);
+    _tid_state__destroy(state);
   }
 
-  if (_py_thread__is_idle(self)) {
-    _tids_idle[index] |= bit;
-  } else {
-    _tids_idle[index] &= ~bit;
+  state = (tid_state_t *) calloc(1, sizeof(tid_state_t));
+  if (!isvalid(state)) {
+    log_e("Cannot allocate state for thread %d", self->tid);
+    set_error(ETHREAD);
+    return NULL;
   }
 
+  state->pid = self->proc->pid;
+
+  lookup__set(_tids, (key_dt) self->tid, state);
+
+  return state;
+}
+
+
+// ----------------------------------------------------------------------------
+#define _py_thread__find_state(self) \
+  ((tid_state_t *) lookup__get(_tids, (key_dt) (self)->tid))
+
+
+// ----------------------------------------------------------------------------
+void
+py_thread__forget(py_thread_t * self) {
+  tid_state_t * state = _py_thread__find_state(self);
+  if (!isvalid(state))
+    return;
+
+  lookup__del(_tids, (key_dt) self->tid);
+  _tid_state__destroy(state);
+
+  log_d("Forgot the state of thread %d", self->tid);
+}
+
+
+// ----------------------------------------------------------------------------
+// Drop the state of the threads that no longer exist. Their tracees are gone
+// with them, so there is nothing to detach from.
+static inline void
+_py_thread__sweep_states(void) {
+  lookup_t * live = lookup_new(_tids->hash->capacity);
+  if (!isvalid(live))
+    return;
+
+  lookup__iteritems_start(_tids, pid_t, tid, tid_state_t *, state) {
+    if (syscall(SYS_tgkill, state->pid, tid, 0) == -1 && errno == ESRCH)
+      _tid_state__destroy(state);
+    else
+      lookup__set(live, (key_dt) tid, state);
+  } lookup__iter_stop(_tids);
+
+  lookup__destroy(_tids);
+  _tids = live;
+}
+
+
+// ----------------------------------------------------------------------------
+int
+py_thread__set_idle(py_thread_t * self) {
+  tid_state_t * state = _py_thread__get_state(self);
+  if (!isvalid(state))
+    FAIL;
+
+  state->idle = !!_py_thread__is_idle(self);
+
   SUCCESS;
 }
 
 // ----------------------------------------------------------------------------
 int
-py_thread__set_interrupted(py_thread_t * self, int state) {
-  unsigned char bit   = 1 << (self->tid & 7);
-  size_t        index = self->tid >> 3;
+py_thread__set_interrupted(py_thread_t * self, int interrupted) {
+  tid_state_t * state = _py_thread__get_state(self);
+  if (!isvalid(state))
+    FAIL;
 
-  if (state) {
-    _tids_int[index] |= bit;
-  } else {
-    _tids_int[index] &= ~bit;
-  }
+  state->interrupted = interrupted;
 
   SUCCESS;
 }
@@ -512,7 +794,9 @@ py_thread__set_interrupted(py_thread_t * self, int state) {
 // ----------------------------------------------------------------------------
 int
 py_thread__is_interrupted(py_thread_t * self) {
-  return _tids_int[self->tid >> 3] & (1 << (self->tid & 7));
+  tid_state_t * state = _py_thread__find_state(self);
+
+  return isvalid(state) && state->interrupted;
 }
 
 // ----------------------------------------------------------------------------
@@ -526,30 +810,28 @@ py_thread__is_interrupted(py_thread_t * self) {
 
 int
 py_thread__save_kernel_stack(py_thread_t * self) {
-  char  stack_path[48];
-
-  if (!isvalid(_kstacks)) {
-    log_e("Invalid kernel stack");
-    set_error(ETHREAD);
+  tid_state_t * state = _py_thread__get_state(self);
+  if (!isvalid(state))
     FAIL;
-  }
-
-  sfree(_kstacks[self->tid]);
 
-  sprintf(stack_path, "/proc/%d/task/" TID_FMT "/stack", self->proc->pid, self->tid);
-  cu_fd fd = open(stack_path, O_RDONLY);
-  if (fd == -1) {
-    log_e("Failed to open %s", stack_path);
-    set_error(ETHREAD);
-    FAIL;
+  if (!isvalid(state->kstack)) {
+    state->kstack = (char *) malloc(MAX_STACK_FILE_SIZE);
+    if (!isvalid(state->kstack)) {
+      set_error(ETHREAD);
+      FAIL;
+    }
   }
 
-  _kstacks[self->tid] = (char *) calloc(1, MAX_STACK_FILE_SIZE);
-  if (read(fd, _kstacks[self->tid], MAX_STACK_FILE_SIZE) == -1) {
-    log_e("stack: failed to read %s", stack_path);
+  ssize_t n = procfs_cache__read_task(
+    self->proc->extra->procfs, self->tid, PROCFS_TASK_STACK, state->kstack, MAX_STACK_FILE_SIZE - 1
+  );
+  if (n < 0) {
+    log_e("Failed to read kernel stack of thread " TID_FMT, self->tid);
+    sfree(state->kstack);
     set_error(ETHREAD);
     FAIL;
-  };
+  }
+  state->kstack[n] = '\0';
 
   SUCCESS;
 }
@@ -557,10 +839,12 @@ py_thread__save_kernel_stack(py_thread_t * self) {
 // ----------------------------------------------------------------------------
 static inline int
 _py_thread__unwind_kernel_frame_stack(py_thread_t * self) {
-  char * line = _kstacks[self->tid];
-  if (!isvalid(line))
+  tid_state_t * state = _py_thread__find_state(self);
+  if (!isvalid(state) || !isvalid(state->kstack))
     SUCCESS;
 
+  char * line = state->kstack;
+
   log_t("linux: unwinding kernel stack");
 
   stack_kernel_reset();
@@ -589,6 +873,49 @@ _py_thread__unwind_kernel_frame_stack(py_thread_t * self) {
 // ----------------------------------------------------------------------------
 static char _native_buf[MAXLEN];
 
+// In raw mode we leave the resolution of the native frames to austin-symbolize.
+// We still need to tell which native frames evaluate Python frames, so we fall
+// back to resolving the native frames of processes for which we could not find
+// the frame evaluation functions.
+#define _py_thread__is_raw(self)  (pargs.raw && self->proc->n_eval_ranges > 0)
+
+static inline char *
+_py_thread__native_string(lru_cache_t * string_cache, const char * string) {
+  key_dt key    = (key_dt) string__hash((char *) string);
+  char * cached = lru_cache__maybe_hit(string_cache, key);
+  if (!isvalid(cached)) {
+    cached = strdup(string);
+    if (!isvalid(cached))
+      return NULL;
+    lru_cache__store(string_cache, key, cached);
+    if (pargs.binary) {
+      mojo_string_event(key, cached);
+    }
+  }
+  return pargs.binary ? (char *) key : cached;
+}
+
+#ifdef HAVE_BFD
+static native_symbol_t _native_symbol;
+
+static inline frame_t *
+_py_thread__resolve_native_frame(py_thread_t * self, vm_range_t * range, bfd_vma addr, key_dt frame_key) {
+  lru_cache_t * string_cache = self->proc->string_cache;
+
+  if (fail(bfd_symbolizer__resolve(range->name, addr, &_native_symbol)))
+    return NULL;
+
+  // The strings are interned in the string cache, like those of any other
+  // native frame, so that the frame does not own them.
+  char * filename = _py_thread__native_string(string_cache, _native_symbol.filename);
+  char * scope    = _py_thread__native_string(string_cache, _native_symbol.scope);
+  if (!isvalid(filename) || !isvalid(scope))
+    return NULL;
+
+  return frame_new(frame_key, filename, scope, _native_symbol.line, 0, 0, 0);
+}
+#endif
+
 static inline int
 wait_unw_init_remote(unw_cursor_t * c, unw_addr_space_t as, void * arg) {
   int outcome = 0;
@@ -607,23 +934,22 @@ _py_thread__unwind_native_frame_stack(py_thread_t * self) {
 
   lru_cache_t * cache        = self->proc->frame_cache;
   lru_cache_t * string_cache = self->proc->string_cache;
-  void        * context      = _tids[self->tid];
+  tid_state_t * state        = _py_thread__get_state(self);
 
   stack_native_reset();
 
-  if (!isvalid(context)) {
-    _tids[self->tid] = _UPT_create(self->tid);
-    if (!isvalid(_tids[self->tid])) {
+  if (!isvalid(state))
+    FAIL;
+
+  if (!isvalid(state->context)) {
+    state->context = _UPT_create(self->tid);
+    if (!isvalid(state->context)) {
       log_e("libunwind: failed to re-create context for thread %d", self->tid);
       set_error(ETHREAD);
       FAIL;
     }
-    if (!isvalid(context)) {
-      log_e("libunwind: unexpected invalid context");
-      set_error(ETHREAD);
-      FAIL;
-    }
   }
+  void * context = state->context;
 
   if (fail(wait_unw_init_remote(&cursor, self->proc->unwind.as, context))) {
     log_e("libunwind: failed to initialize remote cursor");
@@ -645,27 +971,34 @@ _py_thread__unwind_native_frame_stack(py_thread_t * self) {
       char       * scope    = NULL;
       char       * filename = NULL;
       vm_range_t * range    = NULL;
-      if (pargs.where) {
+      if (_py_thread__is_raw(self)) {
+        // We only make sure that the VM maps that we have emitted cover the
+        // program counter, so that the frame can be resolved offline.
+        if (!isvalid(vm_range_tree__find(self->proc->maps_tree, pc)))
+          py_proc__refresh_vm_maps(self->proc);
+        scope  = _py_thread__native_string(string_cache, "<unknown>");
+        offset = 0;
+      }
+      else if (isvalid(self->proc->maps_tree)) {
         range = vm_range_tree__find(self->proc->maps_tree, pc);
-        // TODO: A failed attempt to find a range is an indication that we need
-        // to regenerate the VM maps. This would be of no use at the moment,
-        // since we only use them in `where` mode where we sample just once. If
-        // we resort to improving addr2line and use the VM range tree for
-        // normal mode, then we should consider catching the case
-        // !isvalid(range) and regenerate the VM range tree with fresh data.
+        // A failed attempt to find a range is an indication that we need to
+        // re-read the VM maps, e.g. because a new extension module has been
+        // loaded since we last read them.
+        if (!isvalid(range) && success(py_proc__refresh_vm_maps(self->proc)))
+          range = vm_range_tree__find(self->proc->maps_tree, pc);
         #ifdef HAVE_BFD
         if (isvalid(range)) {
           unw_word_t base = (unw_word_t) hash_table__get(
             self->proc->base_table, string__hash(range->name)
           );
           if (base > 0)
-            frame = get_native_frame(range->name, pc - base, frame_key);
+            frame = _py_thread__resolve_native_frame(self, range, pc - base, frame_key);
         }
         #endif
       }
       if (!isvalid(frame)) {
         unw_proc_info_t pi;
-        if (success(unw_get_proc_info(&cursor, &pi))) {
+        if (!isvalid(scope) && success(unw_get_proc_info(&cursor, &pi))) {
           key_dt scope_key = (key_dt) pi.start_ip;
           scope = lru_cache__maybe_hit(string_cache, scope_key);
           if (!isvalid(scope)) {
@@ -685,7 +1018,7 @@ _py_thread__unwind_native_frame_stack(py_thread_t * self) {
           scope = UNKNOWN_SCOPE;
           offset = 0;
         }
-        if (isvalid(range))  // For now this is only relevant in `where` mode
+        if (pargs.where && isvalid(range))
           filename = strdup(range->name);
         else {
           // The program counter carries information about the file name *and*
@@ -733,18 +1066,26 @@ _py_thread__unwind_native_frame_stack(py_thread_t * self) {
 // ----------------------------------------------------------------------------
 static inline int
 _py_thread__seize(py_thread_t * self) {
-  // TODO: If a TID is reused we will never seize it!
-  if (!isvalid(_tids[self->tid])) {
+  tid_state_t * state = _py_thread__get_state(self);
+  if (!isvalid(state))
+    FAIL;
+
+  // If the TID has been reused by a thread that we have not seized, we fail
+  // to interrupt it and forget its state, so that we seize it the next time.
+  if (!isvalid(state->context)) {
     if (fail(wait_ptrace(PTRACE_SEIZE, self->tid, 0, 0))) {
-      log_e("ptrace: cannot seize thread %d: %d\n", self->tid, errno);
+      int error = errno;
+      log_e("ptrace: cannot seize thread %d: %d\n", self->tid, error);
+      if (error == ESRCH)
+        py_thread__forget(self);
       set_error(ETHREAD);
       FAIL;
     }
     else {
       log_d("ptrace: thread %d seized", self->tid);
     }
-    _tids[self->tid] = _UPT_create(self->tid);
-    if (!isvalid(_tids[self->tid])) {
+    state->context = _UPT_create(self->tid);
+    if (!isvalid(state->context)) {
       log_e("libunwind: failed to create context for thread %d", self->tid);
       set_error(ETHREAD);
       FAIL;
@@ -757,52 +1098,593 @@ _py_thread__seize(py_thread_t * self) {
 
 
 
-// ---- PUBLIC ----------------------------------------------------------------
+// ---- THREAD INFO -----------------------------------------------------------
+
+// The number of samples after which the TID of a thread is resolved again,
+// in case the thread has been replaced by a new one with the same thread state
+// address and thread ID.
+#define THREAD_INFO_TTL       64
 
 // ----------------------------------------------------------------------------
-int
-py_thread__fill_from_raddr(py_thread_t * self, raddr_t * raddr, py_proc_t * proc) {
-  if (!isvalid(self)) {
-    log_e("Cannot fill invalid thread");
-    set_error(ETHREAD);
-    FAIL;
-  }
+static inline py_thread_info_t *
+_py_thread_info__get(py_proc_t * proc, void * raddr, py_thread_info_t * info) {
+  if (isvalid(info))
+    return info;
 
-  V_DESC(proc->py_v);
+  info = (py_thread_info_t *) calloc(1, sizeof(py_thread_info_t));
+  if (!isvalid(info))
+    return NULL;
 
-  PyThreadState ts;
-  _PyStackChunk chunk;
+  lookup__set(proc->threads, (key_dt) raddr, info);
 
-  self->invalid = TRUE;
+  return info;
+}
 
-  if (fail(copy_from_raddr(raddr, ts))) {
-    log_ie("Cannot read remote PyThreadState");
-    FAIL;
-  }
-  
-  self->stack = NULL;
 
-  if (pargs.heap && V_MIN(3, 11)) {
-    // Get the thread stack information.
-    void * stack_raddr = V_FIELD(void *, ts, py_thread, o_stack);
-    
-    if (fail(copy_datatype(self->raddr.pref, stack_raddr, chunk))) {
-      // Best effort
-      log_d("Cannot read thread data stack");
+// ----------------------------------------------------------------------------
+// A resolved TID is reused only if the thread was seen in the previous sample
+// with the same thread ID, and the TID is not too old.
+#define _py_thread_info__has_tid(info, id, proc) (                             \
+  isvalid(info)                                                                \
+  && (info)->tid                                                               \
+  && (info)->thread_id == (id)                                                 \
+  && (info)->last_seen + 1 == (proc)->generation                               \
+  && (proc)->generation - (info)->last_valid < THREAD_INFO_TTL                 \
+)
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_py_thread_info__sweep(py_proc_t * proc) {
+  lookup_t * live = lookup_new(proc->threads->hash->capacity);
+  if (!isvalid(live))
+    return;
+
+  hash_table__iteritems_start(proc->threads->hash, key_dt, raddr, py_thread_info_t *, info) {
+    if (proc->generation - info->last_seen >= THREAD_INFO_TTL) {
+      sfree(info->stack);
+      free(info);
     }
-    else {
-      self->stack = stack_raddr;
-      self->stack_size = chunk.size;
+    else
+      lookup__set(live, raddr, info);
+  } hash_table__iter_stop(proc->threads->hash);
+
+  lookup__destroy(proc->threads);
+  proc->threads = live;
+}
+
+
+#ifndef NATIVE
+// ---- STACK DICTIONARY ------------------------------------------------------
+
+// A stack that has been defined in the MOJO output, as the sequence of the
+// keys of its frames, from the bottom to the top.
+typedef struct {
+  size_t size;
+  key_dt keys[];
+} stack_def_t;
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_stack_def__is_current(stack_def_t * self) {
+  if (self->size != (size_t) stack_pointer())
+    return FALSE;
+
+  for (size_t i = 0; i < self->size; i++)
+    if (self->keys[i] != stack_get(self->size - 1 - i)->key)
+      return FALSE;
+
+  return TRUE;
+}
+
+
+// ----------------------------------------------------------------------------
+// Emit the current stack as a single reference to a stack definition, emitting
+// the definition first if the stack has not been seen before. Stacks are keyed
+// by the hash of their frame keys; a definition with the same key as an older
+// one replaces it. The keys are only meaningful within the process, since
+// every process keeps track of the stacks that it has defined.
+static inline void
+_py_thread__emit_stack_ref(py_thread_t * self) {
+  lru_cache_t * cache = self->proc->stack_cache;
+  size_t        size  = stack_pointer();
+  uint64_t      hash  = 0xcbf29ce484222325ull;
+
+  for (ssize_t i = size - 1; i >= 0; i--)
+    hash = (hash ^ stack_get(i)->key) * 0x100000001b3ull;
+
+  key_dt        key = (key_dt) (hash & MOJO_INT32);
+  stack_def_t * def = (stack_def_t *) lru_cache__maybe_hit(cache, key);
+
+  if (!isvalid(def) || !_stack_def__is_current(def)) {
+    def = (stack_def_t *) malloc(sizeof(stack_def_t) + size * sizeof(key_dt));
+    if (!isvalid(def))
+      // The caller falls back to emitting the frame references.
+      return;
+
+    def->size = size;
+    mojo_stack_def(key, size);
+    for (size_t i = 0; i < size; i++) {
+      def->keys[i] = stack_get(size - 1 - i)->key;
+      mojo_integer(def->keys[i], 0);
     }
+
+    lru_cache__store(cache, key, def);
   }
-  
-  self->proc = proc;
 
-  self->raddr = *raddr;
-  
-  self->top_frame = V_FIELD(void*, ts, py_thread, o_frame);
+  mojo_stack_ref(key);
 
-  self->status = V_FIELD(tstate_status_t, ts, py_thread, o_status);
+  stack_reset();
+}
+
+
+// ----------------------------------------------------------------------------
+// Emit the resolved frames on the stack, from the bottom.
+static inline void
+_py_thread__emit_py_stack(py_thread_t * self) {
+  if (isvalid(self->proc->stack_cache) && !stack_is_empty()) {
+    _py_thread__emit_stack_ref(self);
+  }
+  while (!stack_is_empty()) {
+    frame_t * frame = stack_pop();
+    emit_frame_ref(pargs.format, frame);
+  }
+}
+
+#endif /* !NATIVE */
+
+
+// ----------------------------------------------------------------------------
+// Unwind the whole Python frame stack.
+static inline int
+_py_thread__unwind_full_py_stack(py_thread_t * self) {
+  int invalid = 0;
+
+  V_DESC(self->proc->py_v);
+
+  if (V_MIN(3, 13)) {
+    if (fail(_py_thread__unwind_iframe_stack(self, self->top_frame)))
+      invalid++;
+  }
+  else if (V_MIN(3, 11)) {
+    if (fail(_py_thread__unwind_cframe_stack(self)))
+      invalid++;
+  }
+  else {
+    if (fail(_py_thread__unwind_frame_stack(self)))
+      invalid++;
+  }
+
+  return invalid;
+}
+
+
+#ifndef NATIVE
+// ---- UNCHANGED STACKS ------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// Push the top frame of the Python stack, read straight from the remote
+// process, and return the address of the frame below it in prev. The stack
+// might be left empty, e.g. if the top frame is a shim frame.
+static inline int
+_py_thread__push_top_frame(py_thread_t * self, void ** prev) {
+  V_DESC(self->proc->py_v);
+
+  stack_reset();
+
+  *prev = self->top_frame;
+
+  if (V_MIN(3, 11)) {
+    if (!V_MIN(3, 13)) {
+      PyCFrame cframe;
+
+      if (fail(copy_py(self->raddr.pref, self->top_frame, py_cframe, cframe))) {
+        log_ie("Cannot read remote PyCFrame");
+        FAIL;
+      }
+      *prev = V_FIELD(void *, cframe, py_cframe, o_current_frame);
+      if (!isvalid(*prev))
+        SUCCESS;
+    }
+
+    return _py_thread__push_iframe_from_raddr(self, prev);
+  }
+
+  return _py_thread__push_frame_from_raddr(self, prev);
+}
+
+
+// ----------------------------------------------------------------------------
+// Unwind the frames below the top frame, which is on the stack already.
+static inline int
+_py_thread__unwind_rest_py_stack(py_thread_t * self, void * prev) {
+  V_DESC(self->proc->py_v);
+
+  if (V_MIN(3, 11)) {
+    if (!V_MIN(3, 13))
+      _py_thread__read_stack(self);
+
+    return _py_thread__unwind_iframe_stack(self, prev);
+  }
+
+  _py_thread__read_frames(self);
+
+  return _py_thread__unwind_frame_chain(self, prev);
+}
+
+
+// ----------------------------------------------------------------------------
+// Check whether the top frame matches the one of the last sample of the thread.
+#define _py_thread_info__is_top(info, frame, is_idle) (                        \
+  (info)->stack_size                                                           \
+  && (info)->top_frame == (frame).origin                                       \
+  && (info)->top_code  == (frame).code                                         \
+  && (info)->top_lasti == (frame).lasti                                        \
+  && (info)->idle      == (is_idle)                                            \
+)
+
+
+// ----------------------------------------------------------------------------
+// Keep the unwound stack for the next sample of the thread.
+static inline void
+_py_thread_info__save_stack(py_thread_info_t * self, py_proc_t * proc, int is_idle, uint64_t run_time) {
+  size_t size = stack_pointer();
+
+  self->stack_size = 0;
+  if (size == 0)
+    return;
+
+  if (size > self->stack_capacity) {
+    void * stack = realloc(self->stack, size * sizeof(py_frame_t));
+    if (!isvalid(stack))
+      return;
+    self->stack          = stack;
+    self->stack_capacity = size;
+  }
+  memcpy(self->stack, _stack->py_base, size * sizeof(py_frame_t));
+
+  self->top_frame  = stack_py_get(0).origin;
+  self->top_code   = stack_py_get(0).code;
+  self->top_lasti  = stack_py_get(0).lasti;
+  self->idle       = is_idle;
+  self->run_time   = run_time;
+  self->unwound    = proc->generation;
+  self->stack_size = size;
+}
+
+
+// ----------------------------------------------------------------------------
+// Unwind the Python frame stack, unless the thread has not run since its last
+// sample. Threads that are blocked, e.g. on I/O or on a lock, keep the same
+// top frame across samples, so this is checked first with a single read. The
+// run time of the thread then tells whether the whole stack is unchanged, in
+// which case the frames of the last sample are put back on the stack. The top
+// frame is not read again when the stack has to be unwound. When the whole
+// process is idle, not even the top frame is read.
+static inline int
+_py_thread__unwind_idle_py_stack(py_thread_t * self, int is_idle) {
+  py_thread_info_t * info     = self->info;
+  uint64_t           run_time = 0;
+  void             * prev     = NULL;
+  int                invalid  = 0;
+
+  // If the process is idle, no thread has run since the sample in which its
+  // CPU time last changed, so any stack unwound since then is still current.
+  if (self->proc->idle && info->stack_size && info->unwound >= self->proc->cpu_time_generation)
+    goto unchanged;
+
+  if (fail(_py_thread__push_top_frame(self, &prev))) {
+    info->stack_size = 0;
+    return 1;
+  }
+
+  if (!stack_is_empty() && _py_thread_info__is_top(info, stack_py_get(0), is_idle)) {
+    // The run time is read only for threads that look idle, so that busy
+    // threads are not slowed down by an extra system call.
+    run_time = _py_thread__run_time(self);
+    if (run_time && run_time == info->run_time) {
+      info->unwound = self->proc->generation;
+      goto unchanged;
+    }
+  }
+
+  invalid = _py_thread__unwind_rest_py_stack(self, prev);
+
+  if (invalid)
+    info->stack_size = 0;
+  else
+    _py_thread_info__save_stack(info, self->proc, is_idle, run_time);
+
+  return invalid;
+
+unchanged:
+  stack_reset();
+  memcpy(_stack->py_base, info->stack, info->stack_size * sizeof(py_frame_t));
+  _stack->pointer = info->stack_size;
+  stats_count_unchanged();
+
+  return invalid;
+}
+
+#endif /* !NATIVE */
+
+
+// ----------------------------------------------------------------------------
+// Unwind the Python frame stack without resolving the frames. Returns the
+// number of failures, each of which is to be reported as an invalid frame.
+static inline int
+_py_thread__unwind_py_stack(py_thread_t * self, int is_idle) {
+  if (!isvalid(self->top_frame))
+    return 0;
+
+  #ifndef NATIVE
+  if (isvalid(self->info))
+    return _py_thread__unwind_idle_py_stack(self, is_idle);
+  #endif
+
+  return _py_thread__unwind_full_py_stack(self);
+}
+
+
+// ----------------------------------------------------------------------------
+// Unwind and resolve the Python frame stack. Returns the number of failures.
+static inline int
+_py_thread__get_py_stack(py_thread_t * self, int is_idle) {
+  int invalid = _py_thread__unwind_py_stack(self, is_idle);
+
+  if (fail(_py_thread__resolve_py_stack(self)))
+    invalid++;
+
+  return invalid;
+}
+
+
+// ----------------------------------------------------------------------------
+// Finish off a sample with the metric(s).
+static inline void
+_py_thread__emit_metrics(ctime_t time_delta, ssize_t mem_delta, int is_idle) {
+  if (pargs.full) {
+    emit_full_metrics(time_delta, !!is_idle, mem_delta);
+  }
+  else {
+    if (pargs.memory) {
+      emit_memory_metric(mem_delta);
+    } else {
+      emit_time_metric(time_delta);
+    }
+  }
+}
+
+
+#ifndef NATIVE
+
+// ---- AGGREGATION -----------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// Render the frames on the stack as they would be emitted in text mode.
+static char *
+_py_thread__render_stack(void) {
+  size_t len = 1;
+
+  for (ssize_t i = stack_pointer() - 1; i >= 0; i--) {
+    frame_t * frame = stack_get(i);
+    len += snprintf(NULL, 0, pargs.format, frame->filename, frame->scope, frame->line);
+  }
+
+  char * text = (char *) malloc(len);
+  if (!isvalid(text))
+    return NULL;
+
+  char * cursor = text;
+  *cursor = '\0';
+  for (ssize_t i = stack_pointer() - 1; i >= 0; i--) {
+    frame_t * frame = stack_get(i);
+    cursor += sprintf(cursor, pargs.format, frame->filename, frame->scope, frame->line);
+  }
+
+  return text;
+}
+
+
+// ----------------------------------------------------------------------------
+// Add the sample to the aggregated profile of the process instead of emitting
+// it. The frames are identified by their keys, so that the text of a sample
+// is rendered only the first time it is seen.
+static inline void
+_py_thread__aggregate_stack(
+  py_thread_t * self,
+  int64_t       interp_id,
+  ctime_t       time_delta,
+  ssize_t       mem_delta,
+  int           is_idle
+) {
+  key_dt keys[MAX_STACK_SIZE];
+
+  aggregate_sample_t sample = {
+    .pid     = self->proc->pid,
+    .iid     = interp_id,
+    .tid     = self->tid,
+    .idle    = !!is_idle,
+    .gc      = FALSE,
+    .invalid = _py_thread__get_py_stack(self, is_idle),
+    .size    = stack_pointer(),
+    .keys    = keys,
+  };
+
+  for (size_t i = 0; i < sample.size; i++)
+    keys[i] = stack_get(sample.size - 1 - i)->key;
+
+  if (pargs.gc && py_proc__is_gc_collecting(self->proc) == TRUE) {
+    sample.gc = TRUE;
+    stats_gc_time(time_delta);
+  }
+
+  aggregate__add(
+    self->proc->aggregate, &sample, time_delta, mem_delta,
+    pargs.binary ? NULL : _py_thread__render_stack
+  );
+
+  stack_reset();
+
+  // Update sampling stats
+  stats_count_sample();
+  if (sample.invalid) stats_count_error();
+  stats_check_duration(stopwatch_duration());
+}
+
+
+// ---- DEFERRED RESOLUTION ---------------------------------------------------
+
+// ----------------------------------------------------------------------------
+// Hand the unwound stack over to the resolver of the process, which resolves
+// the frames and emits the sample later on. No code objects are read here.
+static inline void
+_py_thread__defer_stack(
+  py_thread_t * self,
+  int64_t       interp_id,
+  ctime_t       time_delta,
+  ssize_t       mem_delta,
+  int           is_idle
+) {
+  int invalid = _py_thread__unwind_py_stack(self, is_idle);
+  int gc      = FALSE;
+
+  if (pargs.gc && py_proc__is_gc_collecting(self->proc) == TRUE) {
+    gc = TRUE;
+    stats_gc_time(time_delta);
+  }
+
+  resolver_sample_t * sample = resolver__reserve(self->proc->resolver, stack_pointer());
+  if (isvalid(sample)) {
+    sample->iid     = interp_id;
+    sample->tid     = self->tid;
+    sample->time    = time_delta;
+    sample->memory  = mem_delta;
+    sample->idle    = !!is_idle;
+    sample->gc      = gc;
+    sample->invalid = invalid;
+    for (size_t i = 0; i < sample->size; i++) {
+      py_frame_t py_frame = stack_py_get(i);
+      sample->frames[i] = (resolver_frame_t) {py_frame.code, py_frame.lasti};
+    }
+
+    resolver__commit(self->proc->resolver);
+  }
+
+  stack_reset();
+
+  // Update sampling stats. Errors while resolving are accounted for by the
+  // resolver.
+  stats_count_sample();
+  if (!isvalid(sample)) stats_count_error();
+  stats_check_duration(stopwatch_duration());
+}
+
+#endif /* !NATIVE */
+
+
+// ---- PUBLIC ----------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+void
+py_thread_prefetch(py_proc_t * proc) {
+  if (!isvalid(proc->py_v))
+    return;
+
+  V_DESC(proc->py_v);
+
+  unsigned int generation = ++proc->generation;
+  if (generation % THREAD_INFO_TTL == 0) {
+    _py_thread_info__sweep(proc);
+    #ifdef NATIVE
+    _py_thread__sweep_states();
+    #endif
+  }
+
+  py_thread_info_t * batched[MAX_BATCHED_FRAMES << 1];
+  int                n = 0;
+
+  mem_batch__reset(_batch, proc->proc_ref);
+
+  hash_table__iteritems_start(proc->threads->hash, key_dt, raddr, py_thread_info_t *, info) {
+    if (info->last_seen + 1 != generation)
+      continue;
+
+    if (mem_batch__is_full(_batch)) {
+      mem_batch__flush(_batch);
+      for (int i = 0; i < n; i++)
+        if (mem_batch__ok(_batch, i))
+          batched[i]->prefetched = generation;
+      mem_batch__reset(_batch, proc->proc_ref);
+      n = 0;
+    }
+
+    mem_batch__add(_batch, (void *) raddr, py_v->py_thread.size, &info->ts);
+    batched[n++] = info;
+  } hash_table__iter_stop(proc->threads->hash);
+
+  if (n) {
+    mem_batch__flush(_batch);
+    for (int i = 0; i < n; i++)
+      if (mem_batch__ok(_batch, i))
+        batched[i]->prefetched = generation;
+  }
+} /* py_thread_prefetch */
+
+
+// ----------------------------------------------------------------------------
+int
+py_thread__fill_from_raddr(py_thread_t * self, raddr_t * raddr, py_proc_t * proc) {
+  if (!isvalid(self)) {
+    log_e("Cannot fill invalid thread");
+    set_error(ETHREAD);
+    FAIL;
+  }
+
+  V_DESC(proc->py_v);
+
+  PyThreadState ts;
+  _PyStackChunk chunk;
+
+  self->invalid = TRUE;
+  self->info    = NULL;
+
+  py_thread_info_t * info = (py_thread_info_t *) lookup__get(proc->threads, (key_dt) raddr->addr);
+  if (isvalid(info) && info->prefetched == proc->generation) {
+    memcpy(&ts, &info->ts, py_v->py_thread.size);
+    info->prefetched = 0;
+  }
+  else if (fail(copy_from_raddr(raddr, ts))) {
+    log_ie("Cannot read remote PyThreadState");
+    FAIL;
+  }
+  
+  self->stack = NULL;
+
+  if (pargs.heap && V_MIN(3, 11)) {
+    // Get the thread stack information.
+    void * stack_raddr = V_FIELD(void *, ts, py_thread, o_stack);
+    
+    if (fail(copy_datatype(raddr->pref, stack_raddr, chunk))) {
+      // Best effort
+      log_d("Cannot read thread data stack");
+    }
+    else {
+      self->stack = stack_raddr;
+      self->stack_size = chunk.size;
+    }
+  }
+  
+  self->proc = proc;
+
+  // The given remote address might be the one of the next thread state, which
+  // is overwritten below, so we refer to self->raddr from here on.
+  self->raddr = *raddr;
+  
+  self->top_frame = V_FIELD(void*, ts, py_thread, o_frame);
+
+  self->status = V_FIELD(tstate_status_t, ts, py_thread, o_status);
 
   self->next_raddr = (raddr_t) {
     raddr->pref,
@@ -838,10 +1720,21 @@ py_thread__fill_from_raddr(py_thread_t * self, raddr_t * raddr, py_proc_t * proc
       }
       #endif
     }
+    else if (_py_thread_info__has_tid(info, self->tid, proc)) {
+      // The thread was alive in the previous sample so we can reuse the TID
+      // that we have resolved already.
+      self->tid = info->tid;
+      #ifdef NATIVE
+      if (fail(_py_thread__seize(self))) {
+        FAIL;
+      }
+      #endif
+    }
     else if (
       likely(proc->extra->pthread_tid_offset)
       && success(read_pthread_t(self->proc, (void *) self->tid
     ))) {
+      uintptr_t thread_id = self->tid;
       int o = proc->extra->pthread_tid_offset;
       self->tid = o > 0
         ? proc->extra->_pthread_buffer[o]
@@ -851,6 +1744,11 @@ py_thread__fill_from_raddr(py_thread_t * self, raddr_t * raddr, py_proc_t * proc
         self->tid = 0;
         FAIL;
       }
+      if (isvalid(info = _py_thread_info__get(proc, self->raddr.addr, info))) {
+        info->thread_id  = thread_id;
+        info->tid        = self->tid;
+        info->last_valid = proc->generation;
+      }
       #ifdef NATIVE
       if (fail(_py_thread__seize(self))) {
         FAIL;
@@ -860,6 +1758,11 @@ py_thread__fill_from_raddr(py_thread_t * self, raddr_t * raddr, py_proc_t * proc
   }
   #endif
 
+  // Keep track of the thread for the next sample.
+  if (isvalid(info = _py_thread_info__get(proc, self->raddr.addr, info)))
+    info->last_seen = proc->generation;
+  self->info = info;
+
   self->invalid = FALSE;
   SUCCESS;
 } /* py_thread__fill_from_raddr */
@@ -900,18 +1803,30 @@ py_thread__emit_collapsed_stack(py_thread_t * self, int64_t interp_id, ctime_t t
   int is_idle = FALSE;
   if (pargs.full || pargs.sleepless || unlikely(pargs.where)) {
     #ifdef NATIVE
-    size_t index  = self->tid >> 3;
-    int    offset = self->tid & 7;
+    tid_state_t * state = _py_thread__find_state(self);
 
-    is_idle = _tids_idle[index] & (1 << offset);
+    is_idle = isvalid(state) && state->idle;
     #else
-    is_idle = _py_thread__is_idle(self);
+    // No thread of an idle process has run since the last sample.
+    is_idle = self->proc->idle ? TRUE : _py_thread__is_idle(self);
     #endif
     if (!pargs.full && is_idle && pargs.sleepless) {
       return;
     }
   }
 
+  #ifndef NATIVE
+  if (isvalid(self->proc->aggregate)) {
+    _py_thread__aggregate_stack(self, interp_id, time_delta, mem_delta, is_idle);
+    return;
+  }
+
+  if (isvalid(self->proc->resolver)) {
+    _py_thread__defer_stack(self, interp_id, time_delta, mem_delta, is_idle);
+    return;
+  }
+  #endif
+
   // Group entries by thread.
   emit_stack(
     pargs.head_format, self->proc->pid, interp_id, self->tid,
@@ -941,36 +1856,15 @@ py_thread__emit_collapsed_stack(py_thread_t * self, int64_t interp_id, ctime_t t
   py_thread__fill_from_raddr(self, &self->raddr, self->proc);
   #endif
 
-  V_DESC(self->proc->py_v);
-
-  if (isvalid(self->top_frame)) {
-    if (V_MIN(3, 13)) {
-      if (fail(_py_thread__unwind_iframe_stack(self, self->top_frame))) {
-        emit_invalid_frame();
-        error = TRUE;
-      }
-    }  
-    else if (V_MIN(3, 11)) {
-      if (fail(_py_thread__unwind_cframe_stack(self))) {
-        emit_invalid_frame();
-        error = TRUE;
-      }
-    }
-    else {
-      if (fail(_py_thread__unwind_frame_stack(self))) {
-        emit_invalid_frame();
-        error = TRUE;
-      }
-    }
-    
-    if (fail(_py_thread__resolve_py_stack(self))) {
-      emit_invalid_frame();
-      error = TRUE;
-    }
+  for (int invalid = _py_thread__get_py_stack(self, is_idle); invalid > 0; invalid--) {
+    emit_invalid_frame();
+    error = TRUE;
   }
 
   #ifdef NATIVE
 
+  V_DESC(self->proc->py_v);
+
   if (V_MIN(3, 11)) {
     // We expect a CFrame to sit at the top of the stack
     if (!stack_is_empty() && stack_pop() != CFRAME_MAGIC) {
@@ -983,14 +1877,18 @@ py_thread__emit_collapsed_stack(py_thread_t * self, int64_t interp_id, ctime_t t
       log_e("Invalid native frame");
       break;
     }
-    char * scope = pargs.binary
-      ? lru_cache__maybe_hit(self->proc->string_cache, (key_dt) native_frame->scope)
-      : native_frame->scope;
-    if (!isvalid(scope)) {
-      scope = UNKNOWN_SCOPE;
+    int is_frame_eval = FALSE;
+    if (_py_thread__is_raw(self)) {
+      // The key of a native frame is its program counter.
+      is_frame_eval = py_proc__is_eval_addr(self->proc, (addr_t) native_frame->key);
+    }
+    else {
+      char * scope = pargs.binary
+        ? lru_cache__maybe_hit(self->proc->string_cache, (key_dt) native_frame->scope)
+        : native_frame->scope;
+      if (isvalid(scope) && scope != UNKNOWN_SCOPE)
+        is_frame_eval = isvalid(strstr(scope, "PyEval_EvalFrameDefault"));
     }
-
-    int is_frame_eval = (scope == UNKNOWN_SCOPE) ? FALSE : isvalid(strstr(scope, "PyEval_EvalFrameDefault"));
     if (!stack_is_empty() && is_frame_eval) {
       // TODO: if the py stack is empty we have a mismatch.
       frame_t * frame = stack_pop();
@@ -1026,10 +1924,7 @@ py_thread__emit_collapsed_stack(py_thread_t * self, int64_t interp_id, ctime_t t
   }
 
   #else
-  while (!stack_is_empty()) {
-    frame_t * frame = stack_pop();
-    emit_frame_ref(pargs.format, frame);
-  }
+  _py_thread__emit_py_stack(self);
   #endif
 
   if (pargs.gc && py_proc__is_gc_collecting(self->proc) == TRUE) {
@@ -1040,17 +1935,7 @@ py_thread__emit_collapsed_stack(py_thread_t * self, int64_t interp_id, ctime_t t
   if (unlikely(pargs.where))
     return;
 
-  // Finish off sample with the metric(s)
-  if (pargs.full) {
-    emit_full_metrics(time_delta, !!is_idle, mem_delta);
-  }
-  else {
-    if (pargs.memory) {
-      emit_memory_metric(mem_delta);
-    } else {
-      emit_time_metric(time_delta);
-    }
-  }
+  _py_thread__emit_metrics(time_delta, mem_delta, is_idle);
 
   // Update sampling stats
   stats_count_sample();
@@ -1059,9 +1944,44 @@ py_thread__emit_collapsed_stack(py_thread_t * self, int64_t interp_id, ctime_t t
 } /* py_thread__emit_collapsed_stack */
 
 
+#ifndef NATIVE
+// ----------------------------------------------------------------------------
+void
+py_thread__emit_deferred_stack(py_proc_t * proc, resolver_sample_t * sample) {
+  py_thread_t self = {
+    .raddr = {.pref = proc->proc_ref, .addr = NULL},
+    .proc  = proc,
+    .tid   = sample->tid,
+  };
+  int invalid = sample->invalid;
+
+  stack_reset();
+  for (size_t i = 0; i < sample->size; i++)
+    stack_py_push(NULL, sample->frames[i].code, sample->frames[i].lasti);
+
+  if (fail(_py_thread__resolve_py_stack(&self)))
+    invalid++;
+
+  emit_stack(pargs.head_format, proc->pid, sample->iid, sample->tid, "", "");
+
+  for (int i = 0; i < invalid; i++)
+    emit_invalid_frame();
+
+  _py_thread__emit_py_stack(&self);
+
+  if (sample->gc)
+    emit_gc();
+
+  _py_thread__emit_metrics(sample->time, sample->memory, sample->idle);
+
+  if (invalid) stats_count_error();
+}
+#endif
+
+
 // ----------------------------------------------------------------------------
 int
-py_thread_allocate(void) {
+py_thread_allocate_local(void) {
   if (isvalid(_stack))
     SUCCESS;
 
@@ -1071,6 +1991,39 @@ py_thread_allocate(void) {
     FAIL;
   }
 
+  _batch = mem_batch_new(MAX_BATCHED_FRAMES * 2);
+  if (!isvalid(_batch)) {
+    log_e("Failed to allocate remote memory batch");
+    stack_deallocate();
+    set_error(ETHREAD);
+    FAIL;
+  }
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+void
+py_thread_free_local(void) {
+  stack_deallocate();
+  mem_cache_free();
+  mem_batch__destroy(_batch);
+  _batch = NULL;
+  sfree(_frames.content);
+  sfree(_frames_heap.content);
+}
+
+
+// ----------------------------------------------------------------------------
+int
+py_thread_allocate(void) {
+  if (isvalid(_stack))
+    SUCCESS;
+
+  if (fail(py_thread_allocate_local()))
+    FAIL;
+
   #if defined PL_WIN
   // On Windows we need to fetch process and thread information to detect idle
   // threads. We allocate a buffer for periodically fetching that data and, if
@@ -1086,37 +2039,11 @@ py_thread_allocate(void) {
   max_pid = pid_max() + 1;
 
   #ifdef NATIVE
-  _tids = (void **) calloc(max_pid, sizeof(void *));
-  if (!isvalid(_tids))
-    goto failed;
-
-  size_t bmsize = (max_pid >> 3) + 1;
-
-  _tids_idle = (unsigned char *) calloc(bmsize, sizeof(unsigned char));
-  if (!isvalid(_tids_idle))
-    goto failed;
-
-  _tids_int = (unsigned char *) calloc(bmsize, sizeof(unsigned char));
-  if (!isvalid(_tids_int))
-    goto failed;
-
-  if (pargs.kernel) {
-    _kstacks = (char **) calloc(max_pid, sizeof(char *));
-    if (!isvalid(_kstacks))
-      goto failed;
+  _tids = lookup_new(64);
+  if (!isvalid(_tids)) {
+    set_error(ETHREAD);
+    FAIL;
   }
-  goto ok;
-
-failed:
-  sfree(_tids);
-  sfree(_tids_idle);
-  sfree(_tids_int);
-  sfree(_kstacks);
-  
-  set_error(ETHREAD);
-  FAIL;
-
-ok:
   #endif /* NATIVE */
 
   SUCCESS;
@@ -1141,27 +2068,26 @@ py_thread_free(void) {
   }
   #endif
 
-  stack_deallocate();
-  sfree(_frames.content);
-  sfree(_frames_heap.content);
+  py_thread_free_local();
 
   #ifdef NATIVE
-  for (pid_t tid = 0; tid < max_pid; tid++) {
-    if (isvalid(_tids[tid])) {
-      _UPT_destroy(_tids[tid]);
-      if (fail(wait_ptrace(PTRACE_DETACH, tid, 0, 0))) {
-        log_d("ptrace: failed to detach thread %ld", tid);
-      } else {
-        log_d("ptrace: thread %ld detached", tid);
+  if (isvalid(_tids)) {
+    lookup__iteritems_start(_tids, pid_t, tid, tid_state_t *, state) {
+      if (isvalid(state->context)) {
+        if (fail(wait_ptrace(PTRACE_DETACH, tid, 0, 0))) {
+          log_d("ptrace: failed to detach thread %ld", tid);
+        } else {
+          log_d("ptrace: thread %ld detached", tid);
+        }
       }
-    }
-    if (isvalid(_kstacks) && isvalid(_kstacks[tid])) {
-      sfree(_kstacks[tid]);
-    }
+      _tid_state__destroy(state);
+    } lookup__iter_stop(_tids);
+    lookup__destroy(_tids);
+    _tids = NULL;
   }
-  sfree(_tids);
-  sfree(_tids_idle);
-  sfree(_tids_int);
-  sfree(_kstacks);
+
+  #ifdef HAVE_BFD
+  bfd_symbolizer__destroy();
+  #endif
   #endif
 }
@@ -29,6 +29,7 @@
 #include "cache.h"
 #include "mem.h"
 #include "py_proc.h"
+#include "resolver.h"
 #include "stats.h"
 
 
@@ -43,6 +44,8 @@
 #define MAX_FRAME_CACHE_SIZE        MAX_STACK_SIZE
 #endif
 #define MAX_STRING_CACHE_SIZE       LRU_CACHE_EXPAND
+#define MAX_CODE_CACHE_SIZE         1024
+#define MAX_STACK_CACHE_SIZE        1024
 
 
 typedef struct thread {
@@ -50,6 +53,7 @@ typedef struct thread {
   raddr_t         next_raddr;
 
   py_proc_t     * proc;
+  py_thread_info_t * info;  // The information retained across samples, if any
 
   uintptr_t       tid;
   struct thread * next;
@@ -100,6 +104,33 @@ void
 py_thread__emit_collapsed_stack(py_thread_t *, int64_t, ctime_t, ssize_t);
 
 
+#ifndef NATIVE
+/**
+ * Resolve the frames of a sample that has been deferred to the resolver of the
+ * given process and print the stack using the collapsed format. This is called
+ * from the resolver thread.
+ *
+ * @param  py_proc_t          the process the sample was taken from.
+ * @param  resolver_sample_t  the sample.
+ */
+void
+py_thread__emit_deferred_stack(py_proc_t *, resolver_sample_t *);
+#endif
+
+
+/**
+ * Prefetch the thread states of the threads that were seen in the previous
+ * sample of the given process. The thread states are read in batches, and
+ * will be picked up by py_thread__fill_from_raddr during the new sample.
+ *
+ * This also marks the start of a new sample of the process.
+ *
+ * @param  py_proc_t  the process to sample.
+ */
+void
+py_thread_prefetch(py_proc_t *);
+
+
 /**
  * Allocate memory for dumping the thread data.
  *
@@ -115,6 +146,24 @@ py_thread_allocate(void);
 void
 py_thread_free(void);
 
+
+/**
+ * Allocate the thread-local memory for dumping the thread data. This is needed
+ * by any sampler thread other than the main one, which is covered by
+ * py_thread_allocate.
+ *
+ * @return either SUCCESS or FAIL.
+ */
+int
+py_thread_allocate_local(void);
+
+
+/**
+ * Deallocate the thread-local memory for dumping the thread data.
+ */
+void
+py_thread_free_local(void);
+
 #ifdef NATIVE
 int
 py_thread__set_idle(py_thread_t *);
@@ -127,6 +176,16 @@ py_thread__is_interrupted(py_thread_t * self);
 
 int
 py_thread__save_kernel_stack(py_thread_t *);
+
+/**
+ * Forget the native state of a thread that no longer exists, or whose TID has
+ * been reused by a thread that we have not seized. The state is created anew
+ * if the TID is seen again.
+ *
+ * @param  py_thread_t *  self.
+ */
+void
+py_thread__forget(py_thread_t *);
 #endif
 
 
@@ -0,0 +1,454 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined PL_UNIX
+#include <pthread.h>
+#endif
+
+#include "argparse.h"
+#include "events.h"
+#include "hints.h"
+#include "logging.h"
+#include "mojo.h"
+#include "py_thread.h"
+#include "resolver.h"
+
+
+#if defined PL_UNIX
+
+// ---- PRIVATE ---------------------------------------------------------------
+
+#define RESOLVER_RING_MASK  (RESOLVER_RING_SIZE - 1)
+
+// Every sample in the ring is preceded by its size in bytes, including the
+// size itself. A zero size marks the unused space at the end of the ring when
+// a sample does not fit there.
+#define RESOLVER_PADDING    0
+
+#define _resolver__align(size)  (((size) + 7) & ~((size_t) 7))
+
+
+typedef struct {
+  char   * data;
+  size_t   size;
+  size_t   capacity;
+} resolver_buffer_t;
+
+
+struct _resolver {
+  void              * owner;
+  resolver_emit_t     emit;
+
+  pthread_t           thread;
+  int                 ready;     // 1 once the thread is running, -1 on failure
+  int                 stop;
+  int                 sleeping;  // Whether the thread is waiting for samples
+
+  // Single-producer single-consumer ring of samples. The head is only moved by
+  // the sampler and the tail only by the resolver thread.
+  char              * ring;
+  size_t              head;
+  size_t              tail;
+  size_t              reserved;  // The size of the last reservation
+  ctime_t             woken;     // When the sampler last woke the thread up
+  unsigned long       dropped;   // Samples dropped since the last report
+  unsigned long       dropped_total;
+
+  // Held by the resolver thread while it resolves samples.
+  pthread_mutex_t     lock;
+
+  // The ring itself is lock-free. These are only used to sleep until the
+  // sampler wakes the resolver thread up.
+  pthread_mutex_t     wait_lock;
+  pthread_cond_t      data;
+
+  // The resolver thread emits to its own stream. The output is then moved to
+  // the output buffer, which is swapped with the spare one on collection.
+  FILE              * stream;
+  char              * buffer;
+  size_t              size;
+  pthread_mutex_t     output_lock;
+  resolver_buffer_t   output;
+  resolver_buffer_t   spare;
+};
+
+
+// ----------------------------------------------------------------------------
+#define _resolver__is_empty(self) \
+  ((self)->tail == __atomic_load_n(&(self)->head, __ATOMIC_SEQ_CST))
+
+#define _resolver__is_filling_up(self) \
+  ((self)->head - __atomic_load_n(&(self)->tail, __ATOMIC_RELAXED) > (RESOLVER_RING_SIZE >> 1))
+
+#define _resolver__is_pending(self) \
+  ((self)->head != __atomic_load_n(&(self)->tail, __ATOMIC_RELAXED))
+
+
+// ----------------------------------------------------------------------------
+// Wake the resolver thread up if it is sleeping. This is only called by the
+// sampler.
+static inline void
+_resolver__wake(resolver_t * self) {
+  if (!__atomic_load_n(&self->sleeping, __ATOMIC_SEQ_CST))
+    return;
+
+  pthread_mutex_lock(&self->wait_lock);
+  pthread_cond_signal(&self->data);
+  pthread_mutex_unlock(&self->wait_lock);
+
+  self->woken = gettime();
+}
+
+
+// ----------------------------------------------------------------------------
+// Move the output of the resolved samples to the output buffer.
+static inline void
+_resolver__hand_over(resolver_t * self) {
+  mojo_flush();
+  fflush(self->stream);
+
+  if (self->size == 0)
+    return;
+
+  pthread_mutex_lock(&self->output_lock);
+
+  resolver_buffer_t * output = &self->output;
+  if (output->size + self->size > output->capacity) {
+    size_t capacity = output->capacity << 1;
+    if (capacity < output->size + self->size)
+      capacity = output->size + self->size;
+
+    char * data = (char *) realloc(output->data, capacity);
+    if (!isvalid(data)) {
+      pthread_mutex_unlock(&self->output_lock);
+      log_e("Cannot allocate memory for the resolved samples");
+      rewind(self->stream);
+      return;
+    }
+    output->data     = data;
+    output->capacity = capacity;
+  }
+
+  memcpy(output->data + output->size, self->buffer, self->size);
+  output->size += self->size;
+
+  pthread_mutex_unlock(&self->output_lock);
+
+  rewind(self->stream);
+}
+
+
+// ----------------------------------------------------------------------------
+// Resolve all the samples that are in the ring.
+static inline void
+_resolver__drain(resolver_t * self) {
+  pthread_mutex_lock(&self->lock);
+
+  size_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+  size_t tail = self->tail;
+
+  while (tail != head) {
+    size_t offset = tail & RESOLVER_RING_MASK;
+    size_t size   = *((size_t *) (self->ring + offset));
+
+    if (size == RESOLVER_PADDING) {
+      tail += RESOLVER_RING_SIZE - offset;
+    }
+    else {
+      self->emit(self->owner, (resolver_sample_t *) (self->ring + offset + sizeof(size_t)));
+      tail += size;
+    }
+
+    // Make room for new samples as soon as possible.
+    __atomic_store_n(&self->tail, tail, __ATOMIC_RELEASE);
+  }
+
+  pthread_mutex_unlock(&self->lock);
+
+  _resolver__hand_over(self);
+}
+
+
+// ----------------------------------------------------------------------------
+static void *
+_resolver__run(void * arg) {
+  resolver_t * self = (resolver_t *) arg;
+
+  int ready = success(py_thread_allocate_local()) ? 1 : -1;
+
+  _output_file = self->stream;
+
+  pthread_mutex_lock(&self->wait_lock);
+  self->ready = ready;
+  pthread_cond_signal(&self->data);
+  pthread_mutex_unlock(&self->wait_lock);
+
+  if (ready < 0)
+    return NULL;
+
+  for (;;) {
+    _resolver__drain(self);
+
+    pthread_mutex_lock(&self->wait_lock);
+    // The sampler checks whether we are sleeping after it has moved the head,
+    // so either we see a filling ring here or we get woken up. Any other new
+    // samples are picked up when the sampler next collects the output.
+    __atomic_store_n(&self->sleeping, TRUE, __ATOMIC_SEQ_CST);
+    if (!self->stop && !_resolver__is_filling_up(self))
+      pthread_cond_wait(&self->data, &self->wait_lock);
+    __atomic_store_n(&self->sleeping, FALSE, __ATOMIC_RELAXED);
+    int stop = self->stop && _resolver__is_empty(self);
+    pthread_mutex_unlock(&self->wait_lock);
+
+    if (stop)
+      break;
+  }
+
+  py_thread_free_local();
+
+  return NULL;
+}
+
+
+// ---- PUBLIC ----------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+resolver_t *
+resolver_new(void * owner, resolver_emit_t emit) {
+  resolver_t * self = (resolver_t *) calloc(1, sizeof(resolver_t));
+  if (!isvalid(self))
+    return NULL;
+
+  self->owner = owner;
+  self->emit  = emit;
+
+  self->ring = (char *) malloc(RESOLVER_RING_SIZE);
+  if (!isvalid(self->ring))
+    goto error;
+
+  self->stream = open_memstream(&self->buffer, &self->size);
+  if (!isvalid(self->stream))
+    goto error;
+
+  pthread_mutex_init(&self->lock, NULL);
+  pthread_mutex_init(&self->wait_lock, NULL);
+  pthread_mutex_init(&self->output_lock, NULL);
+  pthread_cond_init(&self->data, NULL);
+
+  if (pthread_create(&self->thread, NULL, _resolver__run, self))
+    goto error_sync;
+
+  pthread_mutex_lock(&self->wait_lock);
+  while (self->ready == 0)
+    pthread_cond_wait(&self->data, &self->wait_lock);
+  pthread_mutex_unlock(&self->wait_lock);
+
+  if (self->ready > 0)
+    return self;
+
+  pthread_join(self->thread, NULL);
+
+error_sync:
+  pthread_cond_destroy(&self->data);
+  pthread_mutex_destroy(&self->output_lock);
+  pthread_mutex_destroy(&self->wait_lock);
+  pthread_mutex_destroy(&self->lock);
+
+error:
+  if (isvalid(self->stream))
+    fclose(self->stream);
+  sfree(self->buffer);
+  sfree(self->ring);
+  free(self);
+
+  return NULL;
+}
+
+
+// ----------------------------------------------------------------------------
+resolver_sample_t *
+resolver__reserve(resolver_t * self, size_t frames) {
+  size_t size = _resolver__align(
+    sizeof(size_t) + sizeof(resolver_sample_t) + frames * sizeof(resolver_frame_t)
+  );
+  size_t offset  = self->head & RESOLVER_RING_MASK;
+  size_t padding = offset + size > RESOLVER_RING_SIZE ? RESOLVER_RING_SIZE - offset : 0;
+
+  if (self->head + padding + size - __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE) > RESOLVER_RING_SIZE) {
+    // We never wait for the resolver to catch up.
+    __atomic_add_fetch(&self->dropped, 1, __ATOMIC_RELAXED);
+    self->dropped_total++;
+    return NULL;
+  }
+
+  if (padding) {
+    *((size_t *) (self->ring + offset)) = RESOLVER_PADDING;
+    offset = 0;
+  }
+  *((size_t *) (self->ring + offset)) = size;
+  self->reserved = padding + size;
+
+  resolver_sample_t * sample = (resolver_sample_t *) (self->ring + offset + sizeof(size_t));
+  sample->size = frames;
+
+  return sample;
+}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__commit(resolver_t * self) {
+  __atomic_store_n(&self->head, self->head + self->reserved, __ATOMIC_SEQ_CST);
+
+  if (_resolver__is_filling_up(self))
+    _resolver__wake(self);
+}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__collect(resolver_t * self) {
+  if (!isvalid(self))
+    return;
+
+  if (_resolver__is_pending(self) && gettime() - self->woken >= RESOLVER_INTERVAL)
+    _resolver__wake(self);
+
+  unsigned long dropped = __atomic_exchange_n(&self->dropped, 0, __ATOMIC_RELAXED);
+  if (dropped) {
+    emit_metadata("dropped_samples", "%lu", dropped);
+  }
+
+  // Take the output collected so far and leave the spare buffer to the
+  // resolver thread.
+  pthread_mutex_lock(&self->output_lock);
+  resolver_buffer_t output = self->output;
+  self->output = self->spare;
+  self->spare  = output;
+  pthread_mutex_unlock(&self->output_lock);
+
+  if (self->spare.size == 0)
+    return;
+
+  mojo_flush();
+  fwrite(self->spare.data, 1, self->spare.size, output_stream());
+  self->spare.size = 0;
+}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__pause(resolver_t * self) {
+  if (isvalid(self))
+    pthread_mutex_lock(&self->lock);
+}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__resume(resolver_t * self) {
+  if (isvalid(self))
+    pthread_mutex_unlock(&self->lock);
+}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__destroy(resolver_t * self) {
+  if (!isvalid(self))
+    return;
+
+  pthread_mutex_lock(&self->wait_lock);
+  self->stop = TRUE;
+  pthread_cond_signal(&self->data);
+  pthread_mutex_unlock(&self->wait_lock);
+
+  pthread_join(self->thread, NULL);
+
+  resolver__collect(self);
+
+  if (self->dropped_total)
+    log_w("Dropped %lu samples because their frames could not be resolved in time", self->dropped_total);
+
+  fclose(self->stream);
+  sfree(self->buffer);
+  sfree(self->output.data);
+  sfree(self->spare.data);
+  free(self->ring);
+
+  pthread_cond_destroy(&self->data);
+  pthread_mutex_destroy(&self->output_lock);
+  pthread_mutex_destroy(&self->wait_lock);
+  pthread_mutex_destroy(&self->lock);
+
+  free(self);
+}
+
+
+#else                                                              /* !UNIX */
+
+// ----------------------------------------------------------------------------
+resolver_t *
+resolver_new(void * owner, resolver_emit_t emit) {
+  log_w("Deferred frame resolution is not supported on this platform");
+  return NULL;
+}
+
+
+// ----------------------------------------------------------------------------
+resolver_sample_t *
+resolver__reserve(resolver_t * self, size_t frames) {
+  return NULL;
+}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__commit(resolver_t * self) {}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__collect(resolver_t * self) {}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__pause(resolver_t * self) {}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__resume(resolver_t * self) {}
+
+
+// ----------------------------------------------------------------------------
+void
+resolver__destroy(resolver_t * self) {}
+
+#endif
@@ -0,0 +1,149 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "stats.h"
+
+
+// The size of the ring of the samples that are waiting to be resolved, in
+// bytes. Must be a power of 2.
+#define RESOLVER_RING_SIZE  (1 << 20)
+
+// The sampler wakes the resolver thread up at most this often, in
+// microseconds, when there are new samples to resolve, so that it does not
+// have to signal it on every sample. The resolver thread is woken up earlier
+// if the ring is filling up, and not at all while there is nothing to resolve.
+#define RESOLVER_INTERVAL   1000
+
+
+// A frame as captured by the sampler, that is, before it is resolved.
+typedef struct {
+  void      * code;
+  int         lasti;
+} resolver_frame_t;
+
+
+// A sample whose frames are still to be resolved. The frames are in the order
+// they were unwound, that is, from the top of the stack.
+typedef struct {
+  int64_t            iid;
+  uintptr_t          tid;
+  ctime_t            time;
+  ssize_t            memory;
+  int                idle;
+  int                gc;
+  int                invalid;  // The number of failures while unwinding
+  size_t             size;
+  resolver_frame_t   frames[];
+} resolver_sample_t;
+
+
+typedef struct _resolver resolver_t;
+
+
+/**
+ * Resolve the frames of a sample and emit it. This is called from the resolver
+ * thread.
+ */
+typedef void (*resolver_emit_t)(void * owner, resolver_sample_t * sample);
+
+
+/**
+ * Create a new resolver and start its thread.
+ *
+ * @param  void *           the owner of the resolver, i.e. the process.
+ * @param  resolver_emit_t  the callback that resolves and emits the samples.
+ *
+ * @return a valid pointer to a resolver, NULL otherwise.
+ */
+resolver_t *
+resolver_new(void *, resolver_emit_t);
+
+
+/**
+ * Reserve room for a new sample with the given number of frames. The sample
+ * is handed over to the resolver with resolver__commit. This never blocks.
+ *
+ * @param  resolver_t *  self.
+ * @param  size_t        the number of frames.
+ *
+ * @return a pointer to the sample to fill, or NULL if the resolver is lagging
+ *         behind, in which case the sample is accounted for as dropped.
+ */
+resolver_sample_t *
+resolver__reserve(resolver_t *, size_t);
+
+
+/**
+ * Hand the last reserved sample over to the resolver thread.
+ *
+ * @param  resolver_t *  self.
+ */
+void
+resolver__commit(resolver_t *);
+
+
+/**
+ * Write the output of the samples resolved so far to the output stream of the
+ * calling thread.
+ *
+ * @param  resolver_t *  self.
+ */
+void
+resolver__collect(resolver_t *);
+
+
+/**
+ * Wait for the resolver to finish the sample that it is working on and keep
+ * it from starting a new one until resolver__resume is called. This gives the
+ * caller exclusive access to the structures used to resolve frames.
+ *
+ * @param  resolver_t *  self.
+ */
+void
+resolver__pause(resolver_t *);
+
+
+/**
+ * Let a paused resolver carry on.
+ *
+ * @param  resolver_t *  self.
+ */
+void
+resolver__resume(resolver_t *);
+
+
+/**
+ * Resolve the samples that are left, collect their output and stop the
+ * resolver thread.
+ *
+ * @param  resolver_t *  self.
+ */
+void
+resolver__destroy(resolver_t *);
+
+#endif
@@ -25,6 +25,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cache.h"
 #include "frame.h"
@@ -37,11 +38,24 @@
 #include "version.h"
 
 
+// A slot of the set of frame origins seen while unwinding a stack. Slots that
+// are not marked with the current generation are free, so that the set can be
+// emptied in constant time when the stack is reset.
 typedef struct {
-  size_t        size;
-  frame_t    ** base;
-  ssize_t       pointer;
-  py_frame_t  * py_base;
+  void         * origin;
+  unsigned int   generation;
+} origin_slot_t;
+
+typedef struct {
+  size_t          size;
+  frame_t      ** base;
+  ssize_t         pointer;
+  py_frame_t    * py_base;
+
+  origin_slot_t * origins;
+  size_t          origins_mask;
+  unsigned int    generation;
+  ssize_t         checked;  // The number of frames added to the origin set
   #ifdef NATIVE
   frame_t    ** native_base;
   ssize_t       native_pointer;
@@ -51,7 +65,7 @@ typedef struct {
   #endif
 } stack_dt;
 
-static stack_dt * _stack;
+static __thread stack_dt * _stack;
 
 static inline int
 stack_allocate(size_t size) {
@@ -62,9 +76,17 @@ stack_allocate(size_t size) {
   if (!isvalid(_stack))
     FAIL;
   
+  // Keep the origin set at most half full.
+  size_t slots = 1;
+  while (slots < (size << 1))
+    slots <<= 1;
+
   _stack->size    = size;
   _stack->base    = (frame_t **)   calloc(size, sizeof(frame_t *));
   _stack->py_base = (py_frame_t *) calloc(size, sizeof(py_frame_t));
+  _stack->origins = (origin_slot_t *) calloc(slots, sizeof(origin_slot_t));
+  _stack->origins_mask = slots - 1;
+  _stack->generation   = 1;
   #ifdef NATIVE
   _stack->native_base = (frame_t **) calloc(size, sizeof(frame_t *));
   _stack->kernel_base = (char **)    calloc(size, sizeof(char *));
@@ -80,31 +102,63 @@ stack_deallocate(void) {
 
   free(_stack->base);
   free(_stack->py_base);
+  free(_stack->origins);
   #ifdef NATIVE
   free(_stack->native_base);
   free(_stack->kernel_base);
   #endif
 
   free(_stack);
+  _stack = NULL;
+}
+
+
+static inline void
+_stack__clear_origins(void) {
+  if (++_stack->generation == 0) {
+    // The generation has wrapped around so we need to clear the slots.
+    memset(_stack->origins, 0, (_stack->origins_mask + 1) * sizeof(origin_slot_t));
+    _stack->generation = 1;
+  }
+  _stack->checked = 0;
 }
 
 
+// Add an origin to the set. Returns TRUE if it was already there.
+static inline int
+_stack__add_origin(void * origin) {
+  size_t index = (((uintptr_t) origin >> 4) * 2654435769u) & _stack->origins_mask;
+
+  for (;;) {
+    origin_slot_t * slot = _stack->origins + index;
+    if (slot->generation != _stack->generation) {
+      slot->origin     = origin;
+      slot->generation = _stack->generation;
+      return FALSE;
+    }
+    if (slot->origin == origin)
+      return TRUE;
+
+    index = (index + 1) & _stack->origins_mask;
+  }
+}
+
 
 static inline int
 stack_has_cycle(void) {
-  if (_stack->pointer < 2)
-    return FALSE;
-
-  // This sucks! :( Worst case is quadratic in the stack height, but if the
-  // sampled stacks are short on average, it might still be faster than the
-  // overhead introduced by looking up from a set-like data structure.
-  py_frame_t top = _stack->py_base[_stack->pointer-1];
-  for (ssize_t i = _stack->pointer - 2; i >= 0; i--) {
+  // Frames that have been popped might still be in the set, so start over.
+  if (_stack->checked > _stack->pointer)
+    _stack__clear_origins();
+
+  // Every frame is added to the set of origins only once, so checking for
+  // cycles after each push has constant amortised cost.
+  while (_stack->checked < _stack->pointer) {
+    void * origin = _stack->py_base[_stack->checked++].origin;
     #ifdef NATIVE
-    if (top.origin == _stack->py_base[i].origin && top.origin != CFRAME_MAGIC)
-    #else
-    if (top.origin == _stack->py_base[i].origin)
+    if (origin == CFRAME_MAGIC)
+      continue;
     #endif
+    if (_stack__add_origin(origin))
       return TRUE;
   }
   return FALSE;
@@ -122,11 +176,12 @@ stack_py_push(void * origin, void * code, int lasti) {
 #define stack_pointer()         (_stack->pointer)
 #define stack_push(frame)       {_stack->base[_stack->pointer++] = frame;}
 #define stack_set(i, frame)     {_stack->base[i] = frame;}
+#define stack_get(i)            (_stack->base[i])
 #define stack_pop()             (_stack->base[--_stack->pointer])
 #define stack_py_pop()          (_stack->py_base[--_stack->pointer])
 #define stack_py_get(i)         (_stack->py_base[i])
 #define stack_top()             (_stack->pointer ? _stack->base[_stack->pointer-1] : NULL)
-#define stack_reset()           {_stack->pointer = 0;}
+#define stack_reset()           {_stack->pointer = 0; _stack__clear_origins();}
 #define stack_is_valid()        (_stack->base[_stack->pointer-1]->line != 0)
 #define stack_is_empty()        (_stack->pointer == 0)
 #define stack_full()            (_stack->pointer >= _stack->size)
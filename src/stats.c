@@ -31,6 +31,7 @@
 #include <mach/clock.h>
 #include <mach/mach.h>
 #elif defined PL_WIN
+#include <windows.h>
 #include <profileapi.h>
 #endif
 
@@ -61,9 +62,28 @@ ctime_t _start_time;
 
 ustat_t _error_cnt;
 ustat_t _long_cnt;
+ustat_t _unchanged_cnt;
+ustat_t _skipped_cnt;
 
 ctime_t _gc_time;
 
+ctime_t _effective_interval;
+
+ustat_t _wakeup_cnt;
+ctime_t _avg_jitter;
+ctime_t _max_jitter;
+
+ustat_t _page_cache_hits;
+ustat_t _page_cache_misses;
+
+ustat_t _lru_cache_hits;
+ustat_t _lru_cache_misses;
+ustat_t _lru_cache_evictions;
+
+ustat_t _discovery_cnt;
+ctime_t _discovery_time;
+ctime_t _max_discovery_time;
+
 #if defined PL_MACOS
 static clock_serv_t cclock;
 #elif defined PL_WIN
@@ -97,15 +117,59 @@ gettime() {
 }
 
 
+ctime_t
+getcputime() {
+  #if defined PL_UNIX                                                 /* UNIX */
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+  #else                                                                /* WIN */
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time))
+    return 0;
+
+  ULARGE_INTEGER kernel, user;
+  kernel.LowPart  = kernel_time.dwLowDateTime;
+  kernel.HighPart = kernel_time.dwHighDateTime;
+  user.LowPart    = user_time.dwLowDateTime;
+  user.HighPart   = user_time.dwHighDateTime;
+
+  // Times are in units of 100 ns.
+  return (kernel.QuadPart + user.QuadPart) / 10;
+  #endif
+}
+
+
 void
 stats_reset() {
-  _sample_cnt = 0;
-  _error_cnt  = 0;
+  _sample_cnt    = 0;
+  _error_cnt     = 0;
+  _unchanged_cnt = 0;
+  _skipped_cnt   = 0;
 
   _min_sampling_time = ULONG_MAX;
   _max_sampling_time = 0;
   _avg_sampling_time = 0;
 
+  _effective_interval = pargs.t_sampling_interval;
+
+  _wakeup_cnt = 0;
+  _avg_jitter = 0;
+  _max_jitter = 0;
+
+  _page_cache_hits   = 0;
+  _page_cache_misses = 0;
+
+  _lru_cache_hits      = 0;
+  _lru_cache_misses    = 0;
+  _lru_cache_evictions = 0;
+
+  _discovery_cnt      = 0;
+  _discovery_time     = 0;
+  _max_discovery_time = 0;
+
   #if defined PL_MACOS
   host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
   #elif defined PL_WIN
@@ -148,6 +212,24 @@ stats_duration() {
 }
 
 
+static inline double
+_stats_get_rate(ctime_t duration) {
+  return duration ? _wakeup_cnt * 1000000. / duration : 0;
+}
+
+
+static inline double
+_stats_get_requested_rate() {
+  return 1000000. / pargs.t_sampling_interval;
+}
+
+
+static inline ctime_t
+_stats_get_avg_jitter() {
+  return _wakeup_cnt ? _avg_jitter / _wakeup_cnt : 0;
+}
+
+
 void
 stats_log_metrics() {
   if (pargs.pipe) {
@@ -164,6 +246,31 @@ stats_log_metrics() {
     emit_metadata("saturation", "%ld/%ld", _long_cnt, _sample_cnt);
 
     emit_metadata("errors", "%ld/%ld", _error_cnt, _sample_cnt);
+
+    if (_unchanged_cnt) {
+      emit_metadata("unchanged", "%ld/%ld", _unchanged_cnt, _sample_cnt);
+    }
+
+    if (_skipped_cnt) {
+      emit_metadata("skipped", "%ld", _skipped_cnt);
+    }
+
+    if (_wakeup_cnt) {
+      emit_metadata("rate", "%.2f/%.2f",
+        _stats_get_rate(stats_duration()),
+        _stats_get_requested_rate()
+      );
+
+      emit_metadata("jitter", "%lu,%lu", _stats_get_avg_jitter(), _max_jitter);
+    }
+
+    if (_discovery_cnt) {
+      emit_metadata("discovery", "%lu,%lu", _discovery_time / _discovery_cnt, _max_discovery_time);
+    }
+
+    if (_lru_cache_hits + _lru_cache_misses) {
+      emit_metadata("lru_cache", "%lu,%lu,%lu", _lru_cache_hits, _lru_cache_misses, _lru_cache_evictions);
+    }
   }
   else {
     ctime_t duration = stats_duration();
@@ -202,8 +309,56 @@ stats_log_metrics() {
       _sample_cnt,                                         \
       (float) _error_cnt / _sample_cnt * 100               \
     );
+
+    if (_unchanged_cnt) {
+      log_m("💤 Unchanged stacks : \033[1m%d/%d\033[0m (\033[1m%.2f %%\033[0m) samples reused the stack of a thread that had not run", \
+        _unchanged_cnt,                                      \
+        _sample_cnt,                                         \
+        (float) _unchanged_cnt / _sample_cnt * 100           \
+      );
+    }
+
+    if (_skipped_cnt) {
+      log_m("😴 Skipped samples : \033[1m%d\033[0m process samples skipped because no thread had run", _skipped_cnt);
+    }
+
+    if (_wakeup_cnt) {
+      log_m("🎯 Sampling rate (achieved/requested) : \033[1m%.2f/%.2f Hz\033[0m",
+        _stats_get_rate(duration),
+        _stats_get_requested_rate()
+      );
+
+      log_m("📳 Scheduling jitter (avg/max) : \033[1m%lu/%lu μs\033[0m",
+        _stats_get_avg_jitter(),
+        _max_jitter
+      );
+    }
+
+    if (_discovery_cnt) {
+      log_m("🔍 Child process discovery (avg/max) : \033[1m%lu/%lu μs\033[0m",
+        _discovery_time / _discovery_cnt,
+        _max_discovery_time
+      );
+    }
+
+    if (_lru_cache_hits + _lru_cache_misses) {
+      log_m("🗃️  LRU caches (hits/misses/evictions) : \033[1m%lu/%lu/%lu\033[0m (\033[1m%.2f %%\033[0m hit rate)",
+        _lru_cache_hits,
+        _lru_cache_misses,
+        _lru_cache_evictions,
+        (float) _lru_cache_hits / (_lru_cache_hits + _lru_cache_misses) * 100
+      );
+    }
   };
 
+  if (_page_cache_hits + _page_cache_misses) {
+    log_d("Remote page cache (hits/misses) : %lu/%lu (%.2f %% hit rate)",
+      _page_cache_hits,
+      _page_cache_misses,
+      (float) _page_cache_hits / (_page_cache_hits + _page_cache_misses) * 100
+    );
+  }
+
 release:
   #if defined PL_MACOS
   mach_port_deallocate(mach_task_self(), cclock);
@@ -29,6 +29,7 @@ typedef unsigned long ustat_t;  /* non-negative statistics metric */
 
 
 #include "argparse.h"
+#include "hints.h"
 
 
 #ifndef STATS_C
@@ -40,8 +41,27 @@ extern ctime_t _avg_sampling_time;
 
 extern ustat_t _error_cnt;
 extern ustat_t _long_cnt;
+extern ustat_t _unchanged_cnt;
+extern ustat_t _skipped_cnt;
 
 extern ctime_t _gc_time;
+
+extern ctime_t _effective_interval;
+
+extern ustat_t _wakeup_cnt;
+extern ctime_t _avg_jitter;
+extern ctime_t _max_jitter;
+
+extern ustat_t _page_cache_hits;
+extern ustat_t _page_cache_misses;
+
+extern ustat_t _lru_cache_hits;
+extern ustat_t _lru_cache_misses;
+extern ustat_t _lru_cache_evictions;
+
+extern ustat_t _discovery_cnt;
+extern ctime_t _discovery_time;
+extern ctime_t _max_discovery_time;
 #endif
 
 
@@ -53,6 +73,13 @@ ctime_t
 gettime();
 
 
+/**
+ * Get the CPU time consumed by the current process in microseconds.
+ */
+ctime_t
+getcputime();
+
+
 /**
  * Reset the statistics. Call this every time a new run is started.
  */
@@ -84,36 +111,122 @@ stats_get_avg_sampling_time();
 
 /**
  * Increase the sample counter.
+ *
+ * The counters are updated atomically as samples can be collected by multiple
+ * sampler threads.
  */
-#define stats_count_sample()            { _sample_cnt++; }
+#define stats_count_sample()            { __atomic_add_fetch(&_sample_cnt, 1, __ATOMIC_RELAXED); }
 
 
 /**
  * Increase the counter of samples with errors.
  */
-#define stats_count_error()             { _error_cnt++; }
+#define stats_count_error()             { __atomic_add_fetch(&_error_cnt, 1, __ATOMIC_RELAXED); }
+
+
+/**
+ * Increase the counter of samples that reused the stack of the previous sample
+ * of the same thread, because the thread has not run in the meantime.
+ */
+#define stats_count_unchanged()         { __atomic_add_fetch(&_unchanged_cnt, 1, __ATOMIC_RELAXED); }
+
+
+/**
+ * Increase the counter of the samples of processes that were skipped because
+ * none of their threads has run since the previous sample.
+ */
+#define stats_count_skipped()           { __atomic_add_fetch(&_skipped_cnt, 1, __ATOMIC_RELAXED); }
 
 
 /**
  * Accumulate GC time.
  */
-#define stats_gc_time(delta)             { _gc_time+=(delta); }
+#define stats_gc_time(delta)             { __atomic_add_fetch(&_gc_time, (delta), __ATOMIC_RELAXED); }
+
+
+/**
+ * Account for the time spent discovering child processes. This is only ever
+ * done by the main thread.
+ */
+#define stats_discovery_time(delta)     {                                      \
+  ctime_t _delta = (delta);                                                    \
+  _discovery_cnt++;                                                            \
+  _discovery_time += _delta;                                                   \
+  if (_delta > _max_discovery_time) _max_discovery_time = _delta;              \
+}
+
+
+/**
+ * Accumulate the hits and misses of the remote page cache.
+ */
+#define stats_page_cache(hits, misses)  {                                      \
+  __atomic_add_fetch(&_page_cache_hits, (hits), __ATOMIC_RELAXED);             \
+  __atomic_add_fetch(&_page_cache_misses, (misses), __ATOMIC_RELAXED);         \
+}
 
 
 /**
- * Check the duration of the last sampling and update the statistics.
+ * Accumulate the hits, misses and evictions of an LRU cache. This is done when
+ * the cache is about to be destroyed.
+ */
+#define stats_lru_cache(cache)          {                                      \
+  if (isvalid(cache)) {                                                        \
+    __atomic_add_fetch(&_lru_cache_hits, (cache)->hits, __ATOMIC_RELAXED);     \
+    __atomic_add_fetch(&_lru_cache_misses, (cache)->misses, __ATOMIC_RELAXED); \
+    __atomic_add_fetch(&_lru_cache_evictions, (cache)->evictions, __ATOMIC_RELAXED); \
+  }                                                                            \
+}
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_stats_update_min(ctime_t * min, ctime_t value) {
+  ctime_t current = __atomic_load_n(min, __ATOMIC_RELAXED);
+  while (value < current && !__atomic_compare_exchange_n(
+    min, &current, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+  ));
+}
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_stats_update_max(ctime_t * max, ctime_t value) {
+  ctime_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+  while (value > current && !__atomic_compare_exchange_n(
+    max, &current, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+  ));
+}
+
+
+/**
+ * Check the duration of the last sampling and update the statistics. Samples
+ * that take longer than the current effective sampling interval are counted
+ * as long samples.
  *
  * @param ctime_t the time it took to obtain the sample.
  * @param ctime_t the sampling interval.
  */
-#define stats_check_duration(delta) { \
-  if (delta > pargs.t_sampling_interval)                 \
-    _long_cnt++;                                         \
-  if (_min_sampling_time > delta)                        \
-    _min_sampling_time = delta;                          \
-  else if (_max_sampling_time < delta)                   \
-    _max_sampling_time = delta;                          \
-  _avg_sampling_time += delta;                           \
+#define stats_check_duration(delta) {                              \
+  if (delta > _effective_interval)                                 \
+    __atomic_add_fetch(&_long_cnt, 1, __ATOMIC_RELAXED);           \
+  _stats_update_min(&_min_sampling_time, delta);                   \
+  _stats_update_max(&_max_sampling_time, delta);                   \
+  __atomic_add_fetch(&_avg_sampling_time, delta, __ATOMIC_RELAXED); \
+}
+
+
+/**
+ * Account for a scheduler wake-up that occurred the given amount of time after
+ * the requested deadline. This is only called from the main thread.
+ *
+ * @param ctime_t the delay with respect to the deadline.
+ */
+#define stats_check_jitter(jitter) {                               \
+  ctime_t _jitter = (jitter);                                      \
+  _wakeup_cnt++;                                                   \
+  _avg_jitter += _jitter;                                          \
+  if (_max_jitter < _jitter)                                       \
+    _max_jitter = _jitter;                                         \
 }
 
 
@@ -24,16 +24,41 @@
 #define TIMER_H
 
 
+#include <time.h>
 #include <unistd.h>
 
+#include "platform.h"
+
+#if defined PL_LINUX
+#include <sys/prctl.h>
+#endif
+
 #include "argparse.h"
 #include "error.h"
+#include "events.h"
 #include "stats.h"
 
+// Maximum number of missed deadlines that the scheduler will try to catch up
+// with before giving up and starting afresh.
+#define MAX_SCHEDULER_BACKLOG      100
+
+// Largest sampling interval that the CPU budget can impose.
+#define MAX_BUDGET_INTERVAL    1000000  // 1s
+
+#ifndef AUSTIN_C
+extern
+#endif
+__thread ctime_t _sample_timestamp;
+
 #ifndef AUSTIN_C
 extern
 #endif
-ctime_t _sample_timestamp;
+ctime_t _sample_deadline;
+
+#ifndef AUSTIN_C
+extern
+#endif
+ctime_t _budget_cpu_time, _budget_cost;
 
 
 static inline void
@@ -48,11 +73,108 @@ stopwatch_duration(void) {
 } /* timer_stop */
 
 
+/**
+ * Start the sampling scheduler. The first deadline is set to the current time
+ * so that the first sample is collected straight away.
+ */
+static inline void
+scheduler_start(void) {
+  #if defined PL_LINUX
+  // The default timer slack of 50 us would make short sleeps overshoot.
+  prctl(PR_SET_TIMERSLACK, 1);
+  #endif
+
+  _effective_interval = pargs.t_sampling_interval;
+  _budget_cpu_time    = getcputime();
+  _budget_cost        = 0;
+
+  _sample_deadline = gettime();
+} /* scheduler_start */
+
+
+/**
+ * Adapt the effective sampling interval to the CPU budget.
+ *
+ * The CPU time spent on each round of sampling is smoothed with an exponential
+ * moving average and the interval is set so that this cost stays within the
+ * requested share of the interval, but never below the requested sampling
+ * interval. Changes are only applied when significant and are recorded in the
+ * output, since the time metrics of the following samples are affected.
+ */
+static inline void
+_scheduler__adapt_interval(void) {
+  ctime_t cpu_time = getcputime();
+  ctime_t cost     = cpu_time - _budget_cpu_time;
+
+  _budget_cpu_time = cpu_time;
+  _budget_cost     = _budget_cost ? (15 * _budget_cost + cost) >> 4 : cost;
+
+  ctime_t interval = _budget_cost / pargs.budget;
+  if (interval > MAX_BUDGET_INTERVAL)
+    interval = MAX_BUDGET_INTERVAL;
+  if (interval < pargs.t_sampling_interval)
+    interval = pargs.t_sampling_interval;
+
+  ctime_t tolerance = _effective_interval >> 2;
+  if (
+    interval > _effective_interval + tolerance ||
+    interval + tolerance < _effective_interval
+  ) {
+    _effective_interval = interval;
+    emit_metadata("effective_interval", "%lu", interval);
+  }
+} /* _scheduler__adapt_interval */
+
+
+/**
+ * Wait until the next sampling deadline.
+ *
+ * Deadlines are absolute and are spaced by the sampling interval, so that the
+ * time taken to collect a sample does not accumulate into a drift of the
+ * sampling rate. When sampling takes longer than the interval, the missed
+ * deadlines are either skipped, or caught up with by sampling straight away
+ * when the catch-up policy is selected. The interval is the effective one,
+ * which differs from the requested one only when a CPU budget is set.
+ */
 static inline void
-stopwatch_pause(ctime_t delta) {
-  // Pause if sampling took less than the sampling interval.
-  if (delta < pargs.t_sampling_interval)
-    usleep(pargs.t_sampling_interval - delta);
-}
+scheduler_wait(void) {
+  if (pargs.budget > 0)
+    _scheduler__adapt_interval();
+
+  ctime_t interval = _effective_interval;
+  ctime_t now      = gettime();
+
+  #ifdef NATIVE
+  // Leave the tracee alone for a full interval to reduce the impact of the
+  // sampler.
+  _sample_deadline = now + interval;
+  #else
+  _sample_deadline += interval;
+  if (_sample_deadline < now) {
+    ctime_t backlog = (now - _sample_deadline) / interval;
+    if (!pargs.catch_up)
+      // Skip to the next deadline in the future.
+      _sample_deadline += (backlog + 1) * interval;
+    else if (backlog > MAX_SCHEDULER_BACKLOG)
+      // Too far behind to catch up.
+      _sample_deadline = now;
+  }
+  #endif
+
+  #if defined PL_LINUX
+  struct timespec ts = {
+    _sample_deadline / 1000000,
+    (_sample_deadline % 1000000) * 1000
+  };
+  // If we get interrupted by a signal we return to the caller to handle it.
+  clock_nanosleep(CLOCK_BOOTTIME, TIMER_ABSTIME, &ts, NULL);
+  #else
+  if (_sample_deadline > now)
+    usleep(_sample_deadline - now);
+  #endif
+
+  now = gettime();
+  stats_check_jitter(now > _sample_deadline ? now - _sample_deadline : 0);
+} /* scheduler_wait */
 
 #endif
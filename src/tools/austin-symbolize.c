@@ -0,0 +1,724 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// austin-symbolize resolves the raw native frames of the MOJO output of
+// `austinp --raw --binary` to function names and source locations. The input
+// is copied to the output event by event. The references to raw native frames
+// within the stacks are replaced with references to resolved frames, which are
+// defined just before their first use. The VM maps of each process are
+// tracked through the map events, so that each program counter is resolved
+// against the object files that were mapped when it was sampled.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../argparse.h"
+#include "../cache.h"
+#include "../hints.h"
+#include "../logging.h"
+#include "../mojo.h"
+
+#include "../linux/addr2line.h"
+#include "../linux/elf_file.h"
+
+
+#define PROGRAM       "austin-symbolize"
+#define NATIVE_PREFIX "native@"
+
+// The MOJO encoder only needs the output file from the arguments.
+parsed_args_t   pargs        = {0};
+__thread FILE * _output_file = NULL;
+
+static int verbose = FALSE;
+
+
+// ---- Logging ---------------------------------------------------------------
+
+#define _log(level)                          \
+  {                                          \
+    va_list args;                            \
+    va_start(args, fmt);                     \
+    fputs(PROGRAM ": " level ": ", stderr);  \
+    vfprintf(stderr, fmt, args);             \
+    fputc('\n', stderr);                     \
+    va_end(args);                            \
+  }
+
+void log_f(const char * fmt, ...) _log("fatal")
+void log_e(const char * fmt, ...) _log("error")
+void log_w(const char * fmt, ...) _log("warning")
+void log_m(const char * fmt, ...) _log("info")
+void log_i(const char * fmt, ...) { if (verbose) _log("info") }
+#ifdef DEBUG
+void log_d(const char * fmt, ...) { if (verbose) _log("debug") }
+#endif
+
+
+// ---- VM maps ---------------------------------------------------------------
+
+typedef struct {
+  uintptr_t   lo;
+  uintptr_t   hi;
+  uintptr_t   base;
+  char      * path;
+  char      * build_id;
+  int         verified;  // 0 = not checked yet, 1 = matches, -1 = mismatch
+} vm_map_t;
+
+// The maps of a process, sorted by lower bound. The generation changes with
+// every change to the maps.
+typedef struct {
+  vm_map_t     * items;
+  int            size;
+  int            capacity;
+  unsigned int   generation;
+} vm_maps_t;
+
+static lookup_t * _maps = NULL;  // pid -> vm_maps_t
+
+
+// ----------------------------------------------------------------------------
+static vm_maps_t *
+_vm_maps__get(pid_t pid) {
+  vm_maps_t * maps = lookup__get(_maps, (key_dt) pid);
+  if (!isvalid(maps)) {
+    maps = (vm_maps_t *) calloc(1, sizeof(vm_maps_t));
+    if (!isvalid(maps))
+      return NULL;
+    lookup__set(_maps, (key_dt) pid, (value_t) maps);
+  }
+  return maps;
+}
+
+
+// ----------------------------------------------------------------------------
+// Return the index of the first map whose lower bound is not less than addr.
+static int
+_vm_maps__bisect(vm_maps_t * self, uintptr_t addr) {
+  int lo = 0, hi = self->size;
+
+  while (lo < hi) {
+    int mid = (lo + hi) >> 1;
+    if (self->items[mid].lo < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+_vm_map__release(vm_map_t * self) {
+  sfree(self->path);
+  sfree(self->build_id);
+}
+
+
+// ----------------------------------------------------------------------------
+static int
+vm_maps__add(vm_maps_t * self, uintptr_t lo, uintptr_t hi, uintptr_t base, char * path, char * build_id) {
+  if (self->size == self->capacity) {
+    int        capacity = self->capacity ? self->capacity << 1 : 64;
+    vm_map_t * items    = (vm_map_t *) realloc(self->items, capacity * sizeof(vm_map_t));
+    if (!isvalid(items))
+      FAIL;
+    self->items    = items;
+    self->capacity = capacity;
+  }
+
+  int i = _vm_maps__bisect(self, lo);
+  if (i < self->size && self->items[i].lo == lo) {
+    // A map event for a range that is already mapped replaces it.
+    _vm_map__release(self->items + i);
+  }
+  else {
+    memmove(self->items + i + 1, self->items + i, (self->size - i) * sizeof(vm_map_t));
+    self->size++;
+  }
+
+  self->items[i] = (vm_map_t) {lo, hi, base, strdup(path), strdup(build_id), 0};
+  self->generation++;
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+vm_maps__remove(vm_maps_t * self, uintptr_t lo, uintptr_t hi) {
+  int i = _vm_maps__bisect(self, lo);
+  if (i >= self->size || self->items[i].lo != lo || self->items[i].hi != hi)
+    return;
+
+  _vm_map__release(self->items + i);
+  memmove(self->items + i, self->items + i + 1, (self->size - i - 1) * sizeof(vm_map_t));
+  self->size--;
+  self->generation++;
+}
+
+
+// ----------------------------------------------------------------------------
+static vm_map_t *
+vm_maps__find(vm_maps_t * self, uintptr_t addr) {
+  int i = _vm_maps__bisect(self, addr + 1) - 1;
+
+  return i >= 0 && addr < self->items[i].hi ? self->items + i : NULL;
+}
+
+
+// ----------------------------------------------------------------------------
+// Check that the object file on this host is the one that was mapped when the
+// samples were collected, if we know its build ID.
+static int
+_vm_map__is_valid(vm_map_t * self) {
+  if (self->verified == 0) {
+    char build_id[(ELF_BUILD_ID_MAX << 1) + 1];
+
+    self->verified = 1;
+    if (*self->build_id != '\0') {
+      if (fail(elf_file__get_build_id(self->path, build_id)) || strcmp(build_id, self->build_id)) {
+        log_w("build ID of %s does not match the sampled one; skipping", self->path);
+        self->verified = -1;
+      }
+    }
+  }
+
+  return self->verified > 0;
+}
+
+
+// ---- MOJO decoding ---------------------------------------------------------
+
+static FILE * _input = NULL;
+
+static char * _string        = NULL;
+static size_t _string_size   = 0;
+
+
+// ----------------------------------------------------------------------------
+static int
+_read_integer(mojo_int_t * integer, int * sign) {
+  int c = getc(_input);
+  if (c == EOF)
+    FAIL;
+
+  mojo_int_t n     = c & 0x3f;
+  int        shift = 6;
+
+  if (isvalid(sign))
+    *sign = (c & 0x40) != 0;
+
+  while (c & 0x80) {
+    if ((c = getc(_input)) == EOF)
+      FAIL;
+    n |= ((mojo_int_t) (c & 0x7f)) << shift;
+    shift += 7;
+  }
+
+  *integer = n;
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+static char *
+_read_string(void) {
+  size_t size = 0;
+  int    c;
+
+  while ((c = getc(_input)) != '\0') {
+    if (c == EOF)
+      return NULL;
+
+    if (size + 1 >= _string_size) {
+      size_t new_size   = _string_size ? _string_size << 1 : 1024;
+      char * new_string = (char *) realloc(_string, new_size);
+      if (!isvalid(new_string))
+        return NULL;
+      _string      = new_string;
+      _string_size = new_size;
+    }
+
+    _string[size++] = c;
+  }
+
+  if (!isvalid(_string) && !isvalid(_string = (char *) calloc(1, _string_size = 1024)))
+    return NULL;
+
+  _string[size] = '\0';
+
+  return _string;
+}
+
+#define read_integer(n) if (fail(_read_integer(&n, NULL))) goto truncated;
+#define read_string(s)  if (!isvalid(s = _read_string())) goto truncated;
+
+
+// ---- Symbolization ---------------------------------------------------------
+
+static lookup_t * _raw_strings = NULL;  // string key -> PC
+static lookup_t * _raw_frames  = NULL;  // frame key  -> PC
+static lookup_t * _resolved    = NULL;  // resolved frame key -> outcome
+static lookup_t * _string_keys = NULL;  // input string key -> output key
+static lookup_t * _symbols     = NULL;  // symbol hash -> symbol_string_t
+
+// The string keys of the output are all allocated here, including those of the
+// strings that are copied over from the input, so that the resolved strings
+// cannot collide with any of the input keys, not even those that are yet to be
+// read.
+static key_dt _next_string_key = 0;
+
+typedef struct {
+  key_dt key;
+  char   string[];
+} symbol_string_t;
+
+#define RESOLVED    ((value_t) 1)
+#define UNRESOLVED  ((value_t) 2)
+
+static unsigned long _resolved_cnt   = 0;
+static unsigned long _unresolved_cnt = 0;
+
+static native_symbol_t _symbol;
+
+
+// ----------------------------------------------------------------------------
+static inline uint64_t
+_fnv1a(uint64_t hash, const void * data, size_t size) {
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ ((const unsigned char *) data)[i]) * 0x100000001b3ull;
+
+  return hash;
+}
+
+#define FNV1A_INIT 0xcbf29ce484222325ull
+
+
+// ----------------------------------------------------------------------------
+// Raw frame keys are program counters, which are only unique within a process
+// and for as long as its maps do not change, so the resolved frames are keyed
+// by process and maps generation too. The top bit keeps them apart from the
+// keys generated by Austin.
+static inline key_dt
+_resolved_key(pid_t pid, vm_maps_t * maps, key_dt key) {
+  unsigned int generation = isvalid(maps) ? maps->generation : 0;
+  uint64_t     hash       = _fnv1a(FNV1A_INIT, &pid, sizeof(pid));
+
+  hash = _fnv1a(_fnv1a(hash, &generation, sizeof(generation)), &key, sizeof(key));
+
+  return (key_dt) (hash | (1ull << 63));
+}
+
+
+// ----------------------------------------------------------------------------
+static inline key_dt
+_new_string_key(void) {
+  // Zero is reserved for the keys that are not mapped.
+  if ((++_next_string_key & MOJO_INT32) == 0)
+    _next_string_key++;
+
+  return _next_string_key & MOJO_INT32;
+}
+
+
+// ----------------------------------------------------------------------------
+// Map a string key of the input to the key of the same string in the output.
+// Keys of strings that have not been defined are left unchanged.
+static inline key_dt
+_string_key(key_dt key) {
+  key_dt output_key = (key_dt) lookup__get(_string_keys, key);
+
+  return output_key != 0 ? output_key : key;
+}
+
+
+// ----------------------------------------------------------------------------
+// Emit a resolved string, unless it has been emitted already, and return its
+// key. Hash collisions are resolved by probing.
+static inline key_dt
+_emit_string(const char * string) {
+  key_dt hash = (key_dt) _fnv1a(FNV1A_INIT, string, strlen(string));
+
+  for (;; hash++) {
+    symbol_string_t * symbol = lookup__get(_symbols, hash);
+    if (!isvalid(symbol))
+      break;
+    if (strcmp(symbol->string, string) == 0)
+      return symbol->key;
+  }
+
+  key_dt            key    = _new_string_key();
+  symbol_string_t * symbol = malloc(sizeof(symbol_string_t) + strlen(string) + 1);
+  if (isvalid(symbol)) {
+    symbol->key = key;
+    strcpy(symbol->string, string);
+    lookup__set(_symbols, hash, symbol);
+  }
+
+  mojo_string_event(key, string);
+
+  return key;
+}
+
+
+// ----------------------------------------------------------------------------
+// Emit the reference to the frame with the given key, as sampled in the given
+// process, resolving it first if it is a raw native frame.
+static void
+_emit_frame_ref(pid_t pid, key_dt key) {
+  uintptr_t pc = (uintptr_t) lookup__get(_raw_frames, key);
+  if (pc == 0)
+    goto raw;
+
+  vm_maps_t * maps         = lookup__get(_maps, (key_dt) pid);
+  key_dt      resolved_key = _resolved_key(pid, maps, key);
+  value_t     outcome      = lookup__get(_resolved, resolved_key);
+
+  if (!isvalid(outcome)) {
+    outcome = UNRESOLVED;
+
+    vm_map_t * map = isvalid(maps) ? vm_maps__find(maps, pc) : NULL;
+
+    if (
+      isvalid(map) && map->base > 0 && _vm_map__is_valid(map)
+      && success(bfd_symbolizer__resolve(map->path, pc - map->base, &_symbol))
+    ) {
+      key_dt filename = _emit_string(_symbol.filename);
+      key_dt scope    = _emit_string(_symbol.scope);
+
+      mojo_event(MOJO_FRAME);
+      mojo_integer(resolved_key, 0);
+      mojo_ref(filename);
+      mojo_ref(scope);
+      mojo_integer(_symbol.line, 0);
+      mojo_integer(0, 0);
+      mojo_integer(0, 0);
+      mojo_integer(0, 0);
+
+      outcome = RESOLVED;
+      _resolved_cnt++;
+    }
+    else
+      _unresolved_cnt++;
+
+    lookup__set(_resolved, resolved_key, outcome);
+  }
+
+  if (outcome == RESOLVED) {
+    mojo_event(MOJO_FRAME_REF);
+    mojo_integer(resolved_key, 0);
+    return;
+  }
+
+raw:
+  mojo_event(MOJO_FRAME_REF);
+  mojo_integer(key, 0);
+}
+
+
+// ----------------------------------------------------------------------------
+static int
+symbolize(void) {
+  mojo_int_t version, n, m, k, lo, hi, base;
+  char     * s;
+  int        sign;
+  pid_t      pid = 0;
+
+  if (getc(_input) != 'M' || getc(_input) != 'O' || getc(_input) != 'J') {
+    log_e("not a MOJO stream");
+    FAIL;
+  }
+  read_integer(version);
+  if (version > MOJO_VERSION) {
+    log_e("unsupported MOJO version %d", (int) version);
+    FAIL;
+  }
+
+  mojo_header();
+
+  int event;
+  while ((event = getc(_input)) != EOF) {
+    switch (event) {
+    case MOJO_METADATA:
+      mojo_event(MOJO_METADATA);
+      read_string(s); mojo_string(s);
+      read_string(s); mojo_string(s);
+      break;
+
+    case MOJO_STACK:
+      read_integer(n);
+      read_integer(m);
+      pid = (pid_t) n;
+      mojo_event(MOJO_STACK);
+      mojo_integer(n, 0);
+      mojo_integer(m, 0);
+      read_string(s); mojo_string(s);
+      break;
+
+    case MOJO_FRAME: {
+      mojo_int_t key, filename, scope, location[4] = {0};
+      read_integer(key);
+      read_integer(filename);
+      read_integer(scope);
+      for (int i = 0; i < (version >= 3 ? 4 : 1); i++) {
+        read_integer(location[i]);
+      }
+
+      uintptr_t pc = (uintptr_t) lookup__get(_raw_strings, (key_dt) filename);
+      if (pc != 0)
+        lookup__set(_raw_frames, (key_dt) key, (value_t) pc);
+
+      mojo_event(MOJO_FRAME);
+      mojo_integer(key, 0);
+      mojo_ref(_string_key((key_dt) filename));
+      mojo_ref(_string_key((key_dt) scope));
+      for (int i = 0; i < 4; i++) {
+        mojo_integer(location[i], 0);
+      }
+      break;
+    }
+
+    case MOJO_FRAME_REF:
+      read_integer(n);
+      _emit_frame_ref(pid, (key_dt) n);
+      break;
+
+    case MOJO_FRAME_KERNEL:
+      mojo_event(MOJO_FRAME_KERNEL);
+      read_string(s); mojo_string(s);
+      break;
+
+    case MOJO_FRAME_INVALID:
+    case MOJO_GC:
+    case MOJO_IDLE:
+      mojo_event(event);
+      break;
+
+    case MOJO_METRIC_TIME:
+    case MOJO_METRIC_MEMORY:
+      if (fail(_read_integer(&n, &sign)))
+        goto truncated;
+      mojo_event(event);
+      mojo_integer(n, sign);
+      break;
+
+    case MOJO_STRING: {
+      read_integer(n);
+      read_string(s);
+      uintptr_t pc = 0;
+      if (strncmp(s, NATIVE_PREFIX, sizeof(NATIVE_PREFIX) - 1) == 0)
+        pc = (uintptr_t) strtoul(s + sizeof(NATIVE_PREFIX) - 1, NULL, 16);
+      if (pc > 0)
+        lookup__set(_raw_strings, (key_dt) n, (value_t) pc);
+      else
+        lookup__del(_raw_strings, (key_dt) n);
+
+      // A key that is defined again refers to the new string from now on.
+      key_dt key = _new_string_key();
+      lookup__set(_string_keys, (key_dt) n, (value_t) key);
+      mojo_string_event(key, s);
+      break;
+    }
+
+    case MOJO_STRING_REF:
+      read_integer(n);
+      mojo_string_ref(_string_key((key_dt) n));
+      break;
+
+    case MOJO_STACK_REF:
+      read_integer(n);
+      mojo_event(event);
+      mojo_integer(n, 0);
+      break;
+
+    case MOJO_STACK_DEF:
+      read_integer(n);
+      read_integer(m);
+      mojo_event(MOJO_STACK_DEF);
+      mojo_integer(n, 0);
+      mojo_integer(m, 0);
+      for (mojo_int_t i = 0; i < m; i++) {
+        read_integer(k);
+        mojo_integer(k, 0);
+      }
+      break;
+
+    case MOJO_MAP: {
+      read_integer(n);
+      read_integer(lo);
+      read_integer(hi);
+      read_integer(base);
+      read_string(s);
+      char * path = strdup(s);
+      if (!isvalid(path))
+        FAIL;
+      read_string(s);
+
+      mojo_map(n, lo, hi, base, path, s);
+
+      vm_maps_t * maps = _vm_maps__get((pid_t) n);
+      int result = isvalid(maps) ? vm_maps__add(maps, lo, hi, base, path, s) : 1;
+      free(path);
+      if (fail(result))
+        FAIL;
+      break;
+    }
+
+    case MOJO_UNMAP: {
+      read_integer(n);
+      read_integer(lo);
+      read_integer(hi);
+
+      mojo_unmap(n, lo, hi);
+
+      vm_maps_t * maps = lookup__get(_maps, (key_dt) n);
+      if (isvalid(maps))
+        vm_maps__remove(maps, lo, hi);
+      break;
+    }
+
+    default:
+      log_e("unknown MOJO event %d", event);
+      FAIL;
+    }
+  }
+
+  SUCCESS;
+
+truncated:
+  log_w("truncated MOJO stream");
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+usage(FILE * stream) {
+  fputs(
+    "Usage: " PROGRAM " [-v] [-o FILE] [FILE]\n"
+    "Resolve the raw native frames in the MOJO output of austinp --raw --binary.\n"
+    "The input is read from FILE, or from the standard input if not given, and\n"
+    "the symbolized output is written to the standard output.\n"
+    "\n"
+    "  -o FILE  Write the output to FILE.\n"
+    "  -v       Report the symbolization statistics.\n"
+    "  -h       Give this help.\n",
+    stream
+  );
+}
+
+
+// ----------------------------------------------------------------------------
+int
+main(int argc, char ** argv) {
+  char * input_filename  = NULL;
+  char * output_filename = NULL;
+  int    result          = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      output_filename = argv[++i];
+    else if (strcmp(argv[i], "-v") == 0)
+      verbose = TRUE;
+    else if (strcmp(argv[i], "-h") == 0) {
+      usage(stdout);
+      return 0;
+    }
+    else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      usage(stderr);
+      return -1;
+    }
+    else
+      input_filename = argv[i];
+  }
+
+  _input = isvalid(input_filename) ? fopen(input_filename, "rb") : stdin;
+  if (!isvalid(_input)) {
+    log_e("cannot open %s", input_filename);
+    return 1;
+  }
+
+  pargs.binary      = TRUE;
+  pargs.output_file = isvalid(output_filename) ? fopen(output_filename, "wb") : stdout;
+  if (!isvalid(pargs.output_file)) {
+    log_e("cannot create %s", output_filename);
+    return 1;
+  }
+
+  _maps        = lookup_new(8);
+  _raw_strings = lookup_new(1024);
+  _raw_frames  = lookup_new(1024);
+  _resolved    = lookup_new(1024);
+  _string_keys = lookup_new(1024);
+  _symbols     = lookup_new(1024);
+  if (
+    !isvalid(_maps) || !isvalid(_raw_strings) || !isvalid(_raw_frames)
+    || !isvalid(_resolved) || !isvalid(_string_keys) || !isvalid(_symbols)
+  ) {
+    log_e("cannot allocate memory");
+    return 1;
+  }
+
+  result = symbolize();
+
+  mojo_flush();
+  fflush(pargs.output_file);
+
+  if (verbose)
+    log_m("resolved %lu native frames; %lu could not be resolved", _resolved_cnt, _unresolved_cnt);
+
+  bfd_symbolizer__destroy();
+
+  lookup__iteritems_start(_maps, key_dt, pid, vm_maps_t *, maps) {
+    (void) pid;
+    for (int i = 0; i < maps->size; i++)
+      _vm_map__release(maps->items + i);
+    sfree(maps->items);
+    free(maps);
+  } lookup__iter_stop(_maps);
+
+  lookup__destroy(_maps);
+  lookup__destroy(_raw_strings);
+  lookup__destroy(_raw_frames);
+  lookup__destroy(_resolved);
+  lookup__destroy(_string_keys);
+
+  lookup__iteritems_start(_symbols, key_dt, hash, symbol_string_t *, symbol) {
+    (void) hash;
+    free(symbol);
+  } lookup__iter_stop(_symbols);
+  lookup__destroy(_symbols);
+  sfree(_string);
+
+  if (isvalid(output_filename))
+    fclose(pargs.output_file);
+  if (isvalid(input_filename))
+    fclose(_input);
+
+  return result;
+}
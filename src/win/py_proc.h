@@ -380,6 +380,24 @@ static ssize_t _py_proc__get_resident_memory(py_proc_t * self) {
 }
 
 
+// ----------------------------------------------------------------------------
+static uint64_t _py_proc__get_cpu_time(py_proc_t * self) {
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+
+  if (!GetProcessTimes(self->proc_ref, &creation_time, &exit_time, &kernel_time, &user_time))
+    return 0;
+
+  ULARGE_INTEGER kernel, user;
+  kernel.LowPart  = kernel_time.dwLowDateTime;
+  kernel.HighPart = kernel_time.dwHighDateTime;
+  user.LowPart    = user_time.dwLowDateTime;
+  user.HighPart   = user_time.dwHighDateTime;
+
+  // Times are in units of 100 ns.
+  return (kernel.QuadPart + user.QuadPart) * 100;
+}
+
+
 // ----------------------------------------------------------------------------
 static int
 _py_proc__init(py_proc_t * self) {
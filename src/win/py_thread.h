@@ -77,3 +77,13 @@ _py_thread__is_idle(py_thread_t * self) {
 
   return -1;
 }
+
+
+// ----------------------------------------------------------------------------
+// The thread times on Windows are only updated on clock ticks, so they cannot
+// tell whether a thread has run between two samples. Returns 0, meaning that
+// the information is not available.
+static inline uint64_t
+_py_thread__run_time(py_thread_t * self) {
+  return 0;
+}
@@ -0,0 +1,452 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined PL_UNIX
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "argparse.h"
+#include "events.h"
+#include "hints.h"
+#include "logging.h"
+#include "mojo.h"
+#include "stats.h"
+#include "writer.h"
+
+
+#if defined PL_UNIX
+
+// ---- PRIVATE ---------------------------------------------------------------
+
+#define WRITER_RING_MASK  (WRITER_RING_SIZE - 1)
+
+typedef struct {
+  char          * data;
+  size_t          size;
+  unsigned long   samples;  // The number of samples in the chunk
+} writer_chunk_t;
+
+
+typedef struct {
+  pthread_t         thread;
+  int               running;
+  int               stop;
+
+  // Single-producer single-consumer ring of output chunks. The head is only
+  // moved by the sampling thread and the tail only by the writer thread.
+  writer_chunk_t    ring[WRITER_RING_SIZE];
+  size_t            head;
+  size_t            tail;
+
+  // The ring itself is lock-free. The lock is only used to sleep when there is
+  // nothing to do.
+  pthread_mutex_t   lock;
+  pthread_cond_t    data;   // New output is available
+  pthread_cond_t    space;  // A chunk has been written out
+
+  // Producer side
+  int               policy;
+  FILE            * stream;
+  char            * buffer;
+  size_t            size;
+  ctime_t           committed;  // The time of the last commit
+  unsigned long     samples;    // The sample count at the last commit
+  unsigned long     dropped;    // Samples dropped since the last report
+  unsigned long     dropped_total;
+
+  // Spill file. Once output starts spilling, all the output goes to the spill
+  // file until the writer has caught up with it.
+  pthread_mutex_t   spill_lock;
+  FILE            * spill;
+  off_t             spill_read;
+  off_t             spill_write;
+  int               spilling;
+  char              spill_buffer[WRITER_CHUNK_SIZE];
+} writer_t;
+
+static writer_t _writer;
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_writer__signal(pthread_cond_t * cond) {
+  pthread_mutex_lock(&_writer.lock);
+  pthread_cond_signal(cond);
+  pthread_mutex_unlock(&_writer.lock);
+}
+
+
+// ----------------------------------------------------------------------------
+#define _writer__is_empty() \
+  (_writer.tail == __atomic_load_n(&_writer.head, __ATOMIC_ACQUIRE))
+
+#define _writer__is_full() \
+  (_writer.head - __atomic_load_n(&_writer.tail, __ATOMIC_ACQUIRE) == WRITER_RING_SIZE)
+
+
+// ----------------------------------------------------------------------------
+static inline int
+_writer__push(writer_chunk_t * chunk) {
+  if (_writer__is_full())
+    FAIL;
+
+  _writer.ring[_writer.head & WRITER_RING_MASK] = *chunk;
+  __atomic_store_n(&_writer.head, _writer.head + 1, __ATOMIC_RELEASE);
+
+  _writer__signal(&_writer.data);
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+// Append the chunk to the spill file. If force is FALSE, this is done only if
+// the output is already spilling.
+static inline int
+_writer__spill(writer_chunk_t * chunk, int force) {
+  int spilled = FALSE;
+
+  pthread_mutex_lock(&_writer.spill_lock);
+
+  if (!_writer.spilling && !force)
+    goto release;
+
+  if (!isvalid(_writer.spill)) {
+    _writer.spill = tmpfile();
+    if (!isvalid(_writer.spill)) {
+      log_e("Cannot create the output spill file");
+      goto release;
+    }
+  }
+
+  for (size_t written = 0; written < chunk->size;) {
+    ssize_t n = pwrite(
+      fileno(_writer.spill), chunk->data + written, chunk->size - written,
+      _writer.spill_write + written
+    );
+    if (n <= 0) {
+      log_e("Cannot write to the output spill file");
+      goto release;
+    }
+    written += n;
+  }
+
+  _writer.spill_write += chunk->size;
+  _writer.spilling     = TRUE;
+  spilled              = TRUE;
+
+  free(chunk->data);
+
+release:
+  pthread_mutex_unlock(&_writer.spill_lock);
+
+  if (!spilled)
+    FAIL;
+
+  _writer__signal(&_writer.data);
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+// Write out the next block of the spill file. Returns FALSE once the writer
+// has caught up with the spill file.
+static inline int
+_writer__unspill(void) {
+  pthread_mutex_lock(&_writer.spill_lock);
+
+  if (!_writer.spilling) {
+    pthread_mutex_unlock(&_writer.spill_lock);
+    return FALSE;
+  }
+
+  ssize_t n = pread(
+    fileno(_writer.spill), _writer.spill_buffer, sizeof(_writer.spill_buffer),
+    _writer.spill_read
+  );
+  if (n <= 0) {
+    if (n < 0)
+      log_e("Cannot read from the output spill file");
+
+    // Start afresh with the ring.
+    _writer.spill_read = _writer.spill_write = 0;
+    if (ftruncate(fileno(_writer.spill), 0))
+      log_w("Cannot truncate the output spill file");
+    _writer.spilling = FALSE;
+
+    pthread_mutex_unlock(&_writer.spill_lock);
+    return FALSE;
+  }
+  _writer.spill_read += n;
+
+  pthread_mutex_unlock(&_writer.spill_lock);
+
+  // Only the writer reads from the spill buffer.
+  fwrite(_writer.spill_buffer, 1, n, pargs.output_file);
+
+  return TRUE;
+}
+
+
+// ----------------------------------------------------------------------------
+static void *
+_writer__run(void * arg) {
+  for (;;) {
+    if (!_writer__is_empty()) {
+      writer_chunk_t * chunk = &_writer.ring[_writer.tail & WRITER_RING_MASK];
+
+      fwrite(chunk->data, 1, chunk->size, pargs.output_file);
+      free(chunk->data);
+
+      __atomic_store_n(&_writer.tail, _writer.tail + 1, __ATOMIC_RELEASE);
+      _writer__signal(&_writer.space);
+      continue;
+    }
+
+    // The ring is empty, so whatever was spilled comes next.
+    if (_writer__unspill())
+      continue;
+
+    fflush(pargs.output_file);
+
+    pthread_mutex_lock(&_writer.lock);
+    // Let a producer that is waiting for us to catch up know that we are idle.
+    pthread_cond_signal(&_writer.space);
+    while (_writer__is_empty() && !_writer.spilling && !_writer.stop)
+      pthread_cond_wait(&_writer.data, &_writer.lock);
+    int stop = _writer.stop && _writer__is_empty() && !_writer.spilling;
+    pthread_mutex_unlock(&_writer.lock);
+
+    if (stop)
+      break;
+  }
+
+  return NULL;
+}
+
+
+// ----------------------------------------------------------------------------
+// Hand the chunk over to the writer. Returns FAIL if the chunk is dropped.
+static inline int
+_writer__submit(writer_chunk_t * chunk, int policy) {
+  // Keep the output in order while it is spilling.
+  if (policy == WRITER_SPILL && success(_writer__spill(chunk, FALSE)))
+    SUCCESS;
+
+  if (success(_writer__push(chunk)))
+    SUCCESS;
+
+  switch (policy) {
+  case WRITER_SPILL:
+    if (success(_writer__spill(chunk, TRUE)))
+      SUCCESS;
+    // If we cannot spill we block instead.
+    // fall through
+
+  case WRITER_BLOCK:
+    pthread_mutex_lock(&_writer.lock);
+    while (_writer__is_full())
+      pthread_cond_wait(&_writer.space, &_writer.lock);
+    pthread_mutex_unlock(&_writer.lock);
+
+    _writer__push(chunk);
+    SUCCESS;
+
+  default:
+    free(chunk->data);
+    FAIL;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Wait for the writer to write out all the output that it has been handed.
+static inline void
+_writer__drain(void) {
+  pthread_mutex_lock(&_writer.lock);
+  while (!_writer__is_empty() || _writer.spilling)
+    pthread_cond_wait(&_writer.space, &_writer.lock);
+  pthread_mutex_unlock(&_writer.lock);
+}
+
+
+// ----------------------------------------------------------------------------
+static inline void
+_writer__commit(int policy) {
+  if (_writer.dropped) {
+    emit_metadata("dropped_samples", "%lu", _writer.dropped);
+  }
+
+  mojo_flush();
+  fflush(_writer.stream);
+
+  if (_writer.size == 0)
+    return;
+
+  unsigned long  samples = __atomic_load_n(&_sample_cnt, __ATOMIC_RELAXED);
+  writer_chunk_t chunk   = {
+    .data    = (char *) malloc(_writer.size),
+    .size    = _writer.size,
+    .samples = samples - _writer.samples,
+  };
+
+  if (!isvalid(chunk.data)) {
+    // We cannot hand the output over to the writer, but we cannot drop it
+    // either, as it might contain definitions that are referenced later on. So
+    // we write it out ourselves, once the writer has caught up.
+    log_w("Cannot allocate an output chunk; writing the output synchronously");
+    _writer__drain();
+    fwrite(_writer.buffer, 1, _writer.size, pargs.output_file);
+    fflush(pargs.output_file);
+  }
+  else {
+    memcpy(chunk.data, _writer.buffer, _writer.size);
+  }
+  rewind(_writer.stream);
+
+  _writer.committed = gettime();
+  _writer.samples   = samples;
+
+  if (!isvalid(chunk.data) || success(_writer__submit(&chunk, policy))) {
+    // The dropped samples have been reported.
+    _writer.dropped = 0;
+    return;
+  }
+
+  _writer.dropped       += chunk.samples;
+  _writer.dropped_total += chunk.samples;
+}
+
+
+// ---- PUBLIC ----------------------------------------------------------------
+
+// ----------------------------------------------------------------------------
+int
+writer_start(void) {
+  memset(&_writer, 0, sizeof(writer_t));
+
+  _writer.policy = pargs.writer;
+
+  _writer.stream = open_memstream(&_writer.buffer, &_writer.size);
+  if (!isvalid(_writer.stream)) {
+    log_e("Cannot create the output stream for the writer");
+    FAIL;
+  }
+
+  pthread_mutex_init(&_writer.lock, NULL);
+  pthread_mutex_init(&_writer.spill_lock, NULL);
+  pthread_cond_init(&_writer.data, NULL);
+  pthread_cond_init(&_writer.space, NULL);
+
+  if (pthread_create(&_writer.thread, NULL, _writer__run, NULL)) {
+    log_e("Cannot start the writer thread");
+    fclose(_writer.stream);
+    sfree(_writer.buffer);
+    FAIL;
+  }
+
+  _output_file      = _writer.stream;
+  _writer.committed = gettime();
+  _writer.running   = TRUE;
+
+  SUCCESS;
+}
+
+
+// ----------------------------------------------------------------------------
+void
+writer_commit(void) {
+  if (!_writer.running)
+    return;
+
+  mojo_flush();
+  fflush(_writer.stream);
+
+  if (_writer.size < WRITER_CHUNK_SIZE && gettime() - _writer.committed < WRITER_COMMIT_INTERVAL)
+    return;
+
+  _writer__commit(_writer.policy);
+}
+
+
+// ----------------------------------------------------------------------------
+void
+writer_stop(void) {
+  if (!_writer.running)
+    return;
+
+  // Make sure that the last of the output is not dropped.
+  _writer__commit(_writer.policy == WRITER_DROP ? WRITER_BLOCK : _writer.policy);
+
+  pthread_mutex_lock(&_writer.lock);
+  _writer.stop = TRUE;
+  pthread_cond_signal(&_writer.data);
+  pthread_mutex_unlock(&_writer.lock);
+
+  pthread_join(_writer.thread, NULL);
+
+  _output_file    = NULL;
+  _writer.running = FALSE;
+
+  fclose(_writer.stream);
+  sfree(_writer.buffer);
+  if (isvalid(_writer.spill))
+    fclose(_writer.spill);
+
+  pthread_cond_destroy(&_writer.space);
+  pthread_cond_destroy(&_writer.data);
+  pthread_mutex_destroy(&_writer.spill_lock);
+  pthread_mutex_destroy(&_writer.lock);
+
+  if (_writer.dropped_total)
+    log_w("Dropped %lu samples because the output could not keep up", _writer.dropped_total);
+}
+
+
+#else                                                              /* !UNIX */
+
+// ----------------------------------------------------------------------------
+int
+writer_start(void) {
+  log_w("The output writer thread is not supported on this platform");
+  FAIL;
+}
+
+
+// ----------------------------------------------------------------------------
+void
+writer_commit(void) {}
+
+
+// ----------------------------------------------------------------------------
+void
+writer_stop(void) {}
+
+#endif
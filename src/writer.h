@@ -0,0 +1,72 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "stats.h"
+
+
+// Backpressure policies, i.e. what to do with new output when the writer
+// cannot keep up with it.
+#define WRITER_OFF    0
+#define WRITER_BLOCK  1  // Wait for the writer to catch up
+#define WRITER_DROP   2  // Drop the output and account for the dropped samples
+#define WRITER_SPILL  3  // Spill the output to a temporary file
+
+// The number of output chunks that can be in flight. Must be a power of 2.
+#define WRITER_RING_SIZE        64
+
+// Output is handed over to the writer in chunks of at least this size, or
+// after the commit interval has elapsed, whichever comes first.
+#define WRITER_CHUNK_SIZE       (1 << 16)
+#define WRITER_COMMIT_INTERVAL  100000  // 0.1s
+
+
+/**
+ * Start the writer thread with the policy given on the command line. From
+ * this point on, the output of the calling thread is collected in memory and
+ * handed over to the writer on commit.
+ *
+ * @return either SUCCESS or FAIL.
+ */
+int
+writer_start(void);
+
+
+/**
+ * Hand over the output collected so far to the writer thread, if enough has
+ * been collected or enough time has passed since the last commit. This is a
+ * no-op if the writer is not running.
+ */
+void
+writer_commit(void);
+
+
+/**
+ * Hand over whatever output is left and wait for the writer to write it out.
+ * The output of the calling thread goes to the output file again afterwards.
+ */
+void
+writer_stop(void);
+
+#endif
@@ -0,0 +1,221 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Microbenchmarks for the hash table that backs the frame and string caches.
+// The open-addressing table is compared against a baseline that resolves
+// collisions by chaining, as the hash table used to do. Build and run from the
+// repository root with
+//
+//   gcc -O3 -Isrc -o cache_bm test/bm/cache.c src/cache.c -lm && ./cache_bm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cache.h"
+
+
+#define ROUNDS 200
+
+#define MAX_STACK_SIZE 2048
+
+
+// -- Chained baseline --------------------------------------------------------
+
+typedef struct {
+  size_t     capacity;
+  size_t     size;
+  chain_t ** chains;
+} chained_table_t;
+
+
+// ----------------------------------------------------------------------------
+static chained_table_t *
+chained_table_new(size_t capacity) {
+  chained_table_t * self = (chained_table_t *) calloc(1, sizeof(chained_table_t));
+
+  self->capacity = capacity;
+  self->chains   = (chain_t **) calloc(capacity, sizeof(chain_t *));
+
+  return self;
+}
+
+
+// ----------------------------------------------------------------------------
+#define _chained_table__index(self, key) (((key) * 2654435761) % (self)->capacity)
+
+static value_t
+chained_table__get(chained_table_t * self, key_dt key) {
+  chain_t * chain = self->chains[_chained_table__index(self, key)];
+  if (!isvalid(chain))
+    return NULL;
+
+  return chain__find(chain, key);
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+chained_table__set(chained_table_t * self, key_dt key, value_t value) {
+  index_t index = _chained_table__index(self, key);
+
+  if (!isvalid(self->chains[index]))
+    self->chains[index] = chain_head();
+
+  self->size += chain__add(self->chains[index], key, value);
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+chained_table__destroy(chained_table_t * self) {
+  for (size_t i = 0; i < self->capacity; i++)
+    chain__destroy(self->chains[i]);
+
+  free(self->chains);
+  free(self);
+}
+
+
+// -- Keys --------------------------------------------------------------------
+
+// Frame keys combine the (aligned) address of a code object with the last
+// instruction offset. String keys are the addresses of the remote objects.
+#define FRAME_KEYS  0
+#define STRING_KEYS 1
+
+static key_dt *
+make_keys(size_t n, int kind) {
+  key_dt * keys = (key_dt *) malloc(n * sizeof(key_dt));
+  key_dt   base = 0x7f3a5c000000;
+
+  srand(42);
+  for (size_t i = 0; i < n; i++) {
+    base += 16 * (1 + rand() % 64);
+    keys[i] = kind == FRAME_KEYS
+      ? ((base & 0xFFFFFFFF) << 16) | ((rand() % 512) << 1)
+      : base;
+  }
+
+  return keys;
+}
+
+
+// -- Timing ------------------------------------------------------------------
+
+static inline double
+now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static volatile uintptr_t sink;
+
+
+// ----------------------------------------------------------------------------
+static void
+bm_chained(size_t n, key_dt * keys, double * insert, double * lookup) {
+  double t_insert = 0, t_lookup = 0;
+
+  for (int r = 0; r < ROUNDS; r++) {
+    chained_table_t * table = chained_table_new((n * 4 / 3) | 1);
+
+    double start = now();
+    for (size_t i = 0; i < n; i++)
+      chained_table__set(table, keys[i], (value_t) (keys[i] | 1));
+    t_insert += now() - start;
+
+    start = now();
+    for (size_t i = 0; i < n; i++)
+      sink += (uintptr_t) chained_table__get(table, keys[(i * 7) % n]);
+    t_lookup += now() - start;
+
+    chained_table__destroy(table);
+  }
+
+  *insert = t_insert / (ROUNDS * n);
+  *lookup = t_lookup / (ROUNDS * n);
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+bm_open(size_t n, key_dt * keys, double * insert, double * lookup) {
+  double t_insert = 0, t_lookup = 0;
+
+  for (int r = 0; r < ROUNDS; r++) {
+    hash_table_t * table = hash_table_new((n * 4 / 3) | 1);
+
+    double start = now();
+    for (size_t i = 0; i < n; i++)
+      hash_table__set(table, keys[i], (value_t) (keys[i] | 1));
+    t_insert += now() - start;
+
+    start = now();
+    for (size_t i = 0; i < n; i++)
+      sink += (uintptr_t) hash_table__get(table, keys[(i * 7) % n]);
+    t_lookup += now() - start;
+
+    hash_table__destroy(table);
+  }
+
+  *insert = t_insert / (ROUNDS * n);
+  *lookup = t_lookup / (ROUNDS * n);
+}
+
+
+// ----------------------------------------------------------------------------
+int
+main(void) {
+  struct {
+    const char * name;
+    size_t       size;
+    int          kind;
+  } cases[] = {
+    {"frame cache",         MAX_STACK_SIZE,      FRAME_KEYS},
+    {"frame cache (native)", MAX_STACK_SIZE << 1, FRAME_KEYS},
+    {"string cache",        1024,                STRING_KEYS},
+    {"string cache",        4096,                STRING_KEYS},
+    {"string cache",        16384,               STRING_KEYS},
+  };
+
+  printf("%-22s %7s  %-14s %-14s %s\n", "cache", "items", "insert (ns)", "lookup (ns)", "speedup");
+
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    key_dt * keys = make_keys(cases[c].size, cases[c].kind);
+    double   ci, cl, oi, ol;
+
+    bm_chained(cases[c].size, keys, &ci, &cl);
+    bm_open(cases[c].size, keys, &oi, &ol);
+
+    printf(
+      "%-22s %7zu  %5.1f -> %5.1f  %5.1f -> %5.1f  %.2fx/%.2fx\n",
+      cases[c].name, cases[c].size, ci, oi, cl, ol, ci / oi, cl / ol
+    );
+
+    free(keys);
+  }
+
+  return 0;
+}
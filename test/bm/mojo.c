@@ -0,0 +1,187 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Microbenchmark for the MOJO encoder. The buffered encoder is compared against
+// a baseline that writes every byte to the output stream, as the encoder used
+// to do. Both write to /dev/null through stdio. Build and run from the
+// repository root with
+//
+//   gcc -O3 -Isrc -o mojo_bm test/bm/mojo.c src/mojo.c && ./mojo_bm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "argparse.h"
+#include "mojo.h"
+
+
+parsed_args_t   pargs;
+__thread FILE * _output_file = NULL;
+
+
+#define SAMPLES 200000
+
+#define TID     ((uintptr_t) 0x7f3a5c000700)
+
+
+// -- Stdio baseline ----------------------------------------------------------
+
+static inline void
+stdio_integer(mojo_int_t integer, int sign) {
+  FILE        * stream = output_stream();
+  unsigned char byte   = integer & 0x3f;
+  if (sign) {
+    byte |= 0x40;
+  }
+
+  integer >>= 6;
+  if (integer) {
+    byte |= 0x80;
+  }
+
+  fputc(byte, stream);
+
+  while (integer) {
+    byte = integer & 0x7f;
+    integer >>= 7;
+    if (integer) {
+      byte |= 0x80;
+    }
+    fputc(byte, stream);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+stdio_sample(int pid, uintptr_t tid, key_dt * keys, int depth, int metric) {
+  FILE * stream = output_stream();
+
+  fputc(MOJO_STACK, stream);
+  stdio_integer(pid, 0);
+  stdio_integer(0, 0);
+  fprintf(stream, FORMAT_TID, tid);
+  fputc('\0', stream);
+
+  for (int i = 0; i < depth; i++) {
+    fputc(MOJO_FRAME_REF, stream);
+    stdio_integer(keys[i], 0);
+  }
+
+  fputc(MOJO_METRIC_TIME, stream);
+  stdio_integer(metric, 0);
+}
+
+
+// -- Buffered encoder --------------------------------------------------------
+
+static void
+buffered_sample(int pid, uintptr_t tid, key_dt * keys, int depth, int metric) {
+  mojo_stack(pid, 0, tid);
+
+  for (int i = 0; i < depth; i++) {
+    mojo_event(MOJO_FRAME_REF);
+    mojo_integer(keys[i], 0);
+  }
+
+  mojo_metric_time(metric);
+}
+
+
+// -- Timing ------------------------------------------------------------------
+
+static inline double
+now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// ----------------------------------------------------------------------------
+// The number of bytes that encode a sample.
+static size_t
+sample_size(key_dt * keys, int depth) {
+  char   * buffer = NULL;
+  size_t   size   = 0;
+
+  pargs.output_file = open_memstream(&buffer, &size);
+  stdio_sample(4242, TID, keys, depth, 1000);
+  fclose(pargs.output_file);
+  free(buffer);
+
+  return size;
+}
+
+
+// ----------------------------------------------------------------------------
+// Encode samples to /dev/null, flushing the buffered encoder at the end of
+// every sample, as Austin does. Returns the throughput in MB/s.
+static double
+bm(int buffered, key_dt * keys, int depth) {
+  size_t size = sample_size(keys, depth);
+
+  pargs.output_file = fopen("/dev/null", "wb");
+
+  double start = now();
+  for (int s = 0; s < SAMPLES; s++) {
+    if (buffered) {
+      buffered_sample(4242, TID, keys, depth, 1000);
+      mojo_flush();
+    }
+    else {
+      stdio_sample(4242, TID, keys, depth, 1000);
+    }
+  }
+  fflush(pargs.output_file);
+  double elapsed = now() - start;
+
+  fclose(pargs.output_file);
+
+  return size * SAMPLES / elapsed * 1e3;
+}
+
+
+// ----------------------------------------------------------------------------
+int
+main(void) {
+  int depths[] = {1, 10, 50, 200};
+
+  key_dt * keys = (key_dt *) malloc(200 * sizeof(key_dt));
+  srand(42);
+  for (int i = 0; i < 200; i++)
+    keys[i] = ((key_dt) rand() << 16) | (rand() % 512);
+
+  printf("%-12s %-16s %-16s %s\n", "stack depth", "stdio (MB/s)", "buffered (MB/s)", "speedup");
+
+  for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+    double s = bm(0, keys, depths[d]);
+    double b = bm(1, keys, depths[d]);
+
+    printf("%-12d %-16.1f %-16.1f %.2fx\n", depths[d], s, b, b / s);
+  }
+
+  free(keys);
+
+  return 0;
+}
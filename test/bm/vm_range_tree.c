@@ -0,0 +1,306 @@
+// This file is part of "austin" which is released under GPL.
+//
+// See file LICENCE or go to http://www.gnu.org/licenses/ for full license
+// details.
+//
+// Austin is a Python frame stack sampler for CPython.
+//
+// Copyright (c) 2018-2022 Gabriele N. Tornetta <phoenix1987@gmail.com>.
+// All rights reserved.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Microbenchmark for the look-up of native program counters in the VM maps.
+// The sorted array is compared against a baseline that stores the ranges in an
+// AVL tree, as the VM range tree used to do. Build and run from the repository
+// root with
+//
+//   gcc -O3 -Isrc -o vm_range_tree_bm test/bm/vm_range_tree.c && ./vm_range_tree_bm
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define PY_PROC_C
+#define PY_THREAD_C
+#include "linux/vm-range-tree.h"
+
+
+#define ROUNDS  200
+
+#define LOOKUPS 100000
+
+
+// -- AVL baseline ------------------------------------------------------------
+
+typedef struct _avl_range {
+  addr_t              lo, hi;
+  char              * name;
+  struct _avl_range * left;
+  struct _avl_range * right;
+  int                 height;
+} avl_range_t;
+
+#define max(a, b) ((a > b) ? a : b)
+#define avl_range__height(r) (isvalid(r) ? r->height : 0)
+
+
+// ----------------------------------------------------------------------------
+static avl_range_t *
+avl_range_new(addr_t lo, addr_t hi, char * name) {
+  avl_range_t * range = (avl_range_t *) calloc(1, sizeof(avl_range_t));
+
+  range->lo     = lo;
+  range->hi     = hi;
+  range->name   = name;
+  range->height = 1;
+
+  return range;
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+avl_range__destroy(avl_range_t * self) {
+  if (!isvalid(self))
+    return;
+
+  avl_range__destroy(self->left);
+  avl_range__destroy(self->right);
+
+  free(self);
+}
+
+
+// ----------------------------------------------------------------------------
+static avl_range_t *
+avl_range__rrot(avl_range_t * self) {
+  avl_range_t * x = self->left;
+
+  self->left = x->right;
+  x->right   = self;
+
+  self->height = max(avl_range__height(self->left), avl_range__height(self->right)) + 1;
+  x->height    = max(avl_range__height(x->left), avl_range__height(x->right)) + 1;
+
+  return x;
+}
+
+
+// ----------------------------------------------------------------------------
+static avl_range_t *
+avl_range__lrot(avl_range_t * self) {
+  avl_range_t * y = self->right;
+
+  self->right = y->left;
+  y->left     = self;
+
+  self->height = max(avl_range__height(self->left), avl_range__height(self->right)) + 1;
+  y->height    = max(avl_range__height(y->left), avl_range__height(y->right)) + 1;
+
+  return y;
+}
+
+
+// ----------------------------------------------------------------------------
+static avl_range_t *
+avl_range__add(avl_range_t * self, avl_range_t * range) {
+  if (!isvalid(self))
+    return range;
+
+  if (range->lo < self->lo)
+    self->left = avl_range__add(self->left, range);
+  else
+    self->right = avl_range__add(self->right, range);
+
+  self->height = 1 + max(avl_range__height(self->left), avl_range__height(self->right));
+
+  int balance = avl_range__height(self->left) - avl_range__height(self->right);
+  if (balance > 1) {
+    if (range->lo >= self->left->lo)
+      self->left = avl_range__lrot(self->left);
+    return avl_range__rrot(self);
+  }
+  if (balance < -1) {
+    if (range->lo < self->right->lo)
+      self->right = avl_range__rrot(self->right);
+    return avl_range__lrot(self);
+  }
+
+  return self;
+}
+
+
+// ----------------------------------------------------------------------------
+static avl_range_t *
+avl_range__find(avl_range_t * self, addr_t addr) {
+  if (!isvalid(self))
+    return NULL;
+
+  if (addr >= self->lo && addr < self->hi)
+    return self;
+
+  return avl_range__find(addr < self->lo ? self->left : self->right, addr);
+}
+
+
+// -- Maps --------------------------------------------------------------------
+
+// The ranges mimic the VM maps of a process, with object files mapped at
+// page-aligned addresses and gaps in between. The program counters fall mostly
+// within the ranges, with the occasional miss.
+typedef struct {
+  addr_t lo, hi;
+} bm_range_t;
+
+static bm_range_t *
+make_ranges(size_t n) {
+  bm_range_t * ranges = (bm_range_t *) malloc(n * sizeof(bm_range_t));
+  addr_t       addr   = 0x7f3a5c000000;
+
+  srand(42);
+  for (size_t i = 0; i < n; i++) {
+    addr += 0x1000 * (1 + rand() % 16);
+    ranges[i].lo = addr;
+    addr += 0x1000 * (1 + rand() % 256);
+    ranges[i].hi = addr;
+  }
+
+  return ranges;
+}
+
+
+static addr_t *
+make_pcs(bm_range_t * ranges, size_t n) {
+  addr_t * pcs = (addr_t *) malloc(LOOKUPS * sizeof(addr_t));
+
+  for (size_t i = 0; i < LOOKUPS; i++) {
+    bm_range_t * range = ranges + rand() % n;
+    pcs[i] = rand() % 16
+      ? range->lo + rand() % (range->hi - range->lo)
+      : range->lo - 1;
+  }
+
+  return pcs;
+}
+
+
+// Shuffle the ranges to add them in the order in which a tree would receive
+// them from an incremental refresh.
+static void
+shuffle(bm_range_t * ranges, size_t n) {
+  for (size_t i = n - 1; i > 0; i--) {
+    size_t     j = rand() % (i + 1);
+    bm_range_t t = ranges[i];
+    ranges[i] = ranges[j];
+    ranges[j] = t;
+  }
+}
+
+
+// -- Timing ------------------------------------------------------------------
+
+static inline double
+now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static volatile uintptr_t sink;
+
+static char name[] = "libpython3.so";
+
+
+// ----------------------------------------------------------------------------
+static void
+bm_avl(bm_range_t * ranges, size_t n, addr_t * pcs, double * insert, double * lookup) {
+  double t_insert = 0, t_lookup = 0;
+
+  for (int r = 0; r < ROUNDS; r++) {
+    avl_range_t * root = NULL;
+
+    double start = now();
+    for (size_t i = 0; i < n; i++)
+      root = avl_range__add(root, avl_range_new(ranges[i].lo, ranges[i].hi, name));
+    t_insert += now() - start;
+
+    start = now();
+    for (size_t i = 0; i < LOOKUPS; i++)
+      sink += (uintptr_t) avl_range__find(root, pcs[i]);
+    t_lookup += now() - start;
+
+    avl_range__destroy(root);
+  }
+
+  *insert = t_insert / (ROUNDS * n);
+  *lookup = t_lookup / (ROUNDS * LOOKUPS);
+}
+
+
+// ----------------------------------------------------------------------------
+static void
+bm_array(bm_range_t * ranges, size_t n, addr_t * pcs, double * insert, double * lookup) {
+  double t_insert = 0, t_lookup = 0;
+
+  for (int r = 0; r < ROUNDS; r++) {
+    vm_range_tree_t * tree = vm_range_tree_new();
+
+    double start = now();
+    for (size_t i = 0; i < n; i++)
+      vm_range_tree__add(tree, ranges[i].lo, ranges[i].hi, NULL);
+    t_insert += now() - start;
+
+    start = now();
+    for (size_t i = 0; i < LOOKUPS; i++)
+      sink += (uintptr_t) vm_range_tree__find(tree, pcs[i]);
+    t_lookup += now() - start;
+
+    vm_range_tree__destroy(tree);
+  }
+
+  *insert = t_insert / (ROUNDS * n);
+  *lookup = t_lookup / (ROUNDS * LOOKUPS);
+}
+
+
+// ----------------------------------------------------------------------------
+int
+main(void) {
+  size_t sizes[] = {32, 128, 512, 2048};
+
+  printf("%7s  %-14s %-14s %s\n", "ranges", "insert (ns)", "lookup (ns)", "speedup");
+
+  for (size_t c = 0; c < sizeof(sizes) / sizeof(sizes[0]); c++) {
+    size_t       n      = sizes[c];
+    bm_range_t * ranges = make_ranges(n);
+    addr_t     * pcs    = make_pcs(ranges, n);
+    double       ai, al, si, sl;
+
+    shuffle(ranges, n);
+
+    bm_avl(ranges, n, pcs, &ai, &al);
+    bm_array(ranges, n, pcs, &si, &sl);
+
+    printf(
+      "%7zu  %5.1f -> %5.1f  %5.1f -> %5.1f  %.2fx/%.2fx\n",
+      n, ai, si, al, sl, ai / si, al / sl
+    );
+
+    free(pcs);
+    free(ranges);
+  }
+
+  return 0;
+}
@@ -9,6 +9,7 @@ CFLAGS = ["-g", "-fprofile-arcs", "-ftest-coverage", "-fPIC"]
 EXTRA_SOURCES = [
     SRC / "argparse.c",
     SRC / "logging.c",
+    SRC / "mojo.c",
 ]
 
 sys.modules[__name__] = CModule.compile(
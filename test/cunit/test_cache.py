@@ -85,6 +85,159 @@ def test_hash_table_full():
     assert t.get(42) == 24
 
 
+# A table with a capacity of 10 items has 16 slots, and the home slot of a key
+# is given by its Fibonacci hash, as in src/cache.c.
+HASH_TABLE_BITS = 4
+
+
+def home_slot(key):
+    return ((key * 11400714819323198485) & ((1 << 64) - 1)) >> (64 - HASH_TABLE_BITS)
+
+
+def keys_at(slot, n):
+    keys = []
+    key = 1
+    while len(keys) < n:
+        if home_slot(key) == slot:
+            keys.append(key)
+        key += 1
+    return keys
+
+
+def test_hash_table_collisions():
+    t = HashTable(10)
+
+    # Keys with the same home slot end up in consecutive slots.
+    keys = keys_at(3, 4)
+    for i, k in enumerate(keys):
+        t.set(k, i + 1)
+
+    for i, k in enumerate(keys):
+        assert t.get(k) == i + 1
+
+    # A key that lands on the probe sequence misses without going past it.
+    assert t.get(keys_at(3, 5)[-1]) is NULL
+    assert t.get(keys_at(4, 1)[0]) is NULL
+
+
+def test_hash_table_wrap_around():
+    t = HashTable(10)
+
+    # The probe sequence of the keys in the last slot wraps around to the
+    # first ones, where it displaces the keys that are closer to their home.
+    last = keys_at((1 << HASH_TABLE_BITS) - 1, 3)
+    first = keys_at(0, 2)
+
+    t.set(first[0], 1)
+    for i, k in enumerate(last):
+        t.set(k, i + 10)
+    t.set(first[1], 2)
+
+    for i, k in enumerate(last):
+        assert t.get(k) == i + 10
+    assert t.get(first[0]) == 1
+    assert t.get(first[1]) == 2
+
+    # Deleting across the end of the slots shifts the keys back.
+    getattr(t, "del")(last[0])
+    assert t.get(last[0]) is NULL
+    for i, k in enumerate(last[1:], 1):
+        assert t.get(k) == i + 10
+    assert t.get(first[0]) == 1
+    assert t.get(first[1]) == 2
+
+
+def test_hash_table_backward_shift():
+    t = HashTable(10)
+
+    (prev,) = keys_at(4, 1)
+    keys = keys_at(5, 3)
+    other = keys_at(6, 2)
+
+    t.set(prev, 100)
+    for i, k in enumerate(keys + other):
+        t.set(k, i + 1)
+
+    # Deleting the head of a probe sequence moves the following keys back
+    # towards their home slot, across the keys homed at the next slot.
+    getattr(t, "del")(keys[0])
+    assert t.get(keys[0]) is NULL
+    assert t.get(keys[1]) == 2
+    assert t.get(keys[2]) == 3
+    assert t.get(other[0]) == 4
+    assert t.get(other[1]) == 5
+
+    # The keys that have been moved back to their home slot stay there.
+    getattr(t, "del")(prev)
+    assert t.get(prev) is NULL
+    assert t.get(keys[1]) == 2
+    assert t.get(keys[2]) == 3
+
+    # Deleting from the middle keeps the rest of the sequence reachable.
+    getattr(t, "del")(keys[2])
+    assert t.get(keys[1]) == 2
+    assert t.get(keys[2]) is NULL
+    assert t.get(other[0]) == 4
+    assert t.get(other[1]) == 5
+
+    # Deleting a missing key leaves the table unchanged.
+    getattr(t, "del")(keys[0])
+    assert t.get(keys[1]) == 2
+    assert t.get(other[0]) == 4
+    assert t.get(other[1]) == 5
+
+    # Deleted keys can be added back.
+    t.set(keys[0], 42)
+    assert t.get(keys[0]) == 42
+    assert t.get(keys[1]) == 2
+
+
+def test_hash_table_reinsert():
+    t = HashTable(10)
+
+    # Setting an existing key replaces its value without taking a new slot.
+    keys = keys_at(7, 2)
+    for _ in range(20):
+        for i, k in enumerate(keys):
+            t.set(k, i + 1)
+
+    t.set(keys[1], 24)
+    assert t.get(keys[0]) == 1
+    assert t.get(keys[1]) == 24
+
+    for i in range(8):
+        t.set(1000 + i, i + 1)
+
+    for i in range(8):
+        assert t.get(1000 + i) == i + 1
+
+
+def test_hash_table_full_delete():
+    t = HashTable(10)
+
+    for i in range(10):
+        t.set(42 + i, i + 1)
+
+    assert t.is_full()
+
+    # New keys are dropped at full capacity, but existing ones can still be
+    # updated.
+    t.set(100, 100)
+    assert t.get(100) is NULL
+
+    t.set(42, 24)
+    assert t.get(42) == 24
+
+    # Deleting a key makes room for a new one.
+    getattr(t, "del")(43)
+    t.set(100, 100)
+    assert t.get(100) == 100
+    assert t.get(43) is NULL
+
+    for i in range(2, 10):
+        assert t.get(42 + i) == i + 1
+
+
 def test_lru_cache():
     c = LruCache(10, C.free)
 
@@ -23,6 +23,7 @@
 import platform
 import sys
 from test.utils import austin
+from test.utils import austinp
 from test.utils import no_sudo
 from test.utils import run_python
 from test.utils import target
@@ -102,3 +103,9 @@ def test_cli_permissions_darwin():
     )
     assert result.returncode == 37, result.stderr
     assert "Insufficient permissions" in result.stderr, result.stderr
+
+
+def test_cli_raw_requires_binary():
+    result = austinp("-r", "python3", "-c", "pass", expect_fail=255)
+    assert result.returncode == 255
+    assert "requires the binary output format" in result.stdout
@@ -21,6 +21,7 @@
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 import platform
+import struct
 from pathlib import Path
 from test.utils import allpythons
 from test.utils import austin
@@ -165,10 +166,13 @@ def test_fork_output(py, tmp_path: Path, mojo):
 # Support for multiprocess is attach-like and seems to suffer from the same
 # issues as attach tests on Windows.
 @pytest.mark.xfail(platform.system() == "Windows", reason="Does not pass in Windows CI")
+@pytest.mark.parametrize("jobs", [tuple(), ("-j", "4")])
 @allpythons()
 @mojo
-def test_fork_multiprocess(py, mojo):
-    result = austin("-Ci", "1ms", *python(py), target("target_mp.py"), mojo=mojo)
+def test_fork_multiprocess(py, mojo, jobs):
+    result = austin(
+        "-Ci", "1ms", *jobs, *python(py), target("target_mp.py"), mojo=mojo
+    )
     assert result.returncode == 0, result.stderr or result.stdout
 
     ps = processes(result.stdout)
@@ -247,3 +251,46 @@ def test_no_logging(py, monkeypatch):
         result.stdout
     )
     assert result.returncode == 0, result.stderr or result.stdout
+
+
+# The offset of the Python version in an ELF cache record, past the record
+# header and the has_symbols field (see src/linux/elf_cache.h).
+ELF_CACHE_VERSION_OFFSET = 32 + 4
+
+
+@pytest.mark.skipif(platform.system() != "Linux", reason="Linux only")
+@allpythons()
+def test_fork_cache_dir(py, tmp_path, monkeypatch):
+    monkeypatch.setenv("AUSTIN_CACHE_DIR", str(tmp_path))
+
+    def run():
+        result = austin("-Pi", "1ms", *python(py), target("target34.py"))
+        assert result.returncode == 0, result.stderr or result.stdout
+        assert has_pattern(result.stdout, "target34.py:keep_cpu_busy:3"), compress(
+            result.stdout
+        )
+        return metadata(result.stdout)
+
+    major, minor, _ = run()["python"]
+
+    records = {_: _.stat().st_ino for _ in tmp_path.glob("*.elf")}
+    assert records, "ELF analysis has been persisted"
+
+    # Tamper with the Python version stored in the records. The second run can
+    # only report it if it has picked up the analysis from disk. Python 3.13
+    # and later report the version via the debug offsets instead.
+    tampered = False
+    for record in records:
+        data = bytearray(record.read_bytes())
+        if struct.unpack_from("<ii", data, ELF_CACHE_VERSION_OFFSET) == (major, minor):
+            struct.pack_into("<i", data, ELF_CACHE_VERSION_OFFSET + 8, 99)
+            record.write_bytes(data)
+            tampered = True
+
+    meta = run()
+
+    if tampered:
+        assert meta["python"] == (major, minor, 99)
+
+    # A fresh analysis would have replaced the records with new files.
+    assert {_: _.stat().st_ino for _ in records} == records
@@ -20,10 +20,26 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+from collections import Counter
+from io import BytesIO
 from pathlib import Path
-from test.utils import allpythons, austin, python, target
-
-from austin.format.mojo import MojoFile, MojoFrame
+from test.utils import (
+    MOJO_FRAME,
+    MOJO_FRAME_REF,
+    MOJO_MAP,
+    MOJO_STACK,
+    MOJO_STACK_DEF,
+    MOJO_UNMAP,
+    allpythons,
+    austin,
+    austin_symbolize,
+    austinp,
+    demojo,
+    has_pattern,
+    parse_mojo,
+    python,
+    target,
+)
 
 
 @allpythons(min=(3, 11))
@@ -36,14 +52,15 @@ def test_mojo_column_data(py, tmp_path: Path):
     assert result.returncode == 0, result.stderr or result.stdout
 
     def strip(f):
-        return (f.scope.string.value, f.line, f.line_end, f.column, f.column_end)
+        return (f.scope, f.line, f.line_end, f.column, f.column_end)
 
     with datafile.open("rb") as f:
         frames = {
-            strip(_)
-            for _ in MojoFile(f).parse()
-            if isinstance(_, MojoFrame)
-            and _.filename.string.value.endswith("column.py")
+            strip(frame)
+            for e, *args in parse_mojo(f)
+            if e == MOJO_FRAME
+            for frame in args
+            if frame.filename.endswith("column.py")
         }
 
         assert frames & {
@@ -67,12 +84,135 @@ def test_mojo_no_column_data(py, tmp_path: Path):
     )
     assert result.returncode == 0, result.stderr or result.stdout
 
-    def strip(f):
-        return
-
     with datafile.open("rb") as f:
         assert {
-            (e.line_end, e.column, e.column_end)
-            for e in MojoFile(f).parse()
-            if isinstance(e, MojoFrame)
+            (frame.line_end, frame.column, frame.column_end)
+            for e, *args in parse_mojo(f)
+            if e == MOJO_FRAME
+            for frame in args
         } == {(0, 0, 0)}
+
+
+@allpythons()
+def test_mojo_stack_refs(py, tmp_path: Path):
+    """
+    Test that repeated stacks are emitted as references to the stacks defined
+    earlier on.
+    """
+    datafile = tmp_path / "test_mojo_stacks.austin"
+
+    result = austin(
+        "-i", "1ms", "-o", str(datafile), *python(py), target("target34.py"), mojo=True
+    )
+    assert result.returncode == 0, result.stderr or result.stdout
+
+    data = datafile.read_bytes()
+
+    events = Counter(e for e, *_ in parse_mojo(BytesIO(data)))
+    assert 0 < 10 * events[MOJO_STACK_DEF] < events[MOJO_STACK], events
+
+    assert has_pattern(demojo(data), "target34.py:keep_cpu_busy:32")
+
+
+@allpythons()
+def test_mojo_raw_native_frames(py):
+    """
+    Test that raw mode records the native frames by program counter, together
+    with the VM maps required to resolve them offline.
+    """
+    result = austinp(
+        "-ri", "10ms", *python(py), target("target34.py"), mojo=True, convert=False
+    )
+    assert result.returncode == 0, result.stderr
+
+    events = list(parse_mojo(BytesIO(result.stdout)))
+
+    maps = [args for e, *args in events if e == MOJO_MAP]
+    assert maps, "VM maps are emitted"
+    assert all(lo < hi for _, lo, hi, *_ in maps)
+
+    assert any(
+        frame.filename.startswith("native@")
+        for e, *args in events
+        if e == MOJO_FRAME
+        for frame in args
+    )
+
+
+@allpythons()
+def test_mojo_stack_refs_multiprocess(py, tmp_path: Path):
+    """
+    Test that the stack references emitted by each process resolve to the
+    stack definitions of the same process.
+    """
+    datafile = tmp_path / "test_mojo_stacks_mp.austin"
+
+    result = austin(
+        "-Ci",
+        "1ms",
+        "-o",
+        str(datafile),
+        *python(py),
+        target("target_mp.py"),
+        "3",
+        mojo=True,
+    )
+    assert result.returncode == 0, result.stderr or result.stdout
+
+    data = datafile.read_bytes()
+
+    # Stack keys are scoped to processes, so the decoder fails on a reference
+    # to a stack that the process has not defined.
+    pid, defs, refs = None, Counter(), Counter()
+    for e, *args in parse_mojo(BytesIO(data)):
+        if e == MOJO_STACK:
+            pid = args[0]
+        elif e == MOJO_STACK_DEF:
+            defs[pid] += 1
+        elif e == MOJO_FRAME_REF:
+            refs[pid] += 1
+
+    assert len(defs) > 1, defs
+    assert set(refs) <= set(defs), (refs, defs)
+
+    assert has_pattern(demojo(data), "target_mp.py:fact")
+
+
+@allpythons()
+def test_mojo_raw_symbolize(py, tmp_path: Path):
+    """
+    Test that austin-symbolize resolves the raw native frames recorded by
+    austinp, and that the map events are carried over.
+    """
+    raw = tmp_path / "test_mojo_raw.austin"
+    symbolized = tmp_path / "test_mojo_symbolized.austin"
+
+    result = austinp(
+        "-ri", "10ms", "-o", str(raw), *python(py), target("target34.py"), mojo=True
+    )
+    assert result.returncode == 0, result.stderr
+
+    result = austin_symbolize("-o", str(symbolized), str(raw))
+    assert result.returncode == 0, result.stderr
+
+    raw_events = list(parse_mojo(BytesIO(raw.read_bytes())))
+    events = list(parse_mojo(BytesIO(symbolized.read_bytes())))
+
+    def maps(events):
+        return [tuple(args) for e, *args in events if e in (MOJO_MAP, MOJO_UNMAP)]
+
+    def native(events):
+        return sum(
+            1
+            for e, *args in events
+            if e == MOJO_FRAME_REF and args[0].filename.startswith("native@")
+        )
+
+    assert maps(events), "VM maps are carried over"
+    assert maps(events) == maps(raw_events)
+
+    assert sum(e == MOJO_STACK for e, *_ in events) == sum(
+        e == MOJO_STACK for e, *_ in raw_events
+    )
+    assert 0 <= native(events) < native(raw_events)
+    assert has_pattern(demojo(symbolized.read_bytes()), "EvalFrame")
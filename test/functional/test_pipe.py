@@ -20,8 +20,14 @@
 # You should have received a copy of the GNU General Public License
 # along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+import platform
 from itertools import takewhile
+from subprocess import PIPE
+from subprocess import Popen
 from subprocess import check_output
+from time import sleep
+
+import pytest
 
 from test.utils import allpythons
 from test.utils import austin
@@ -61,6 +67,17 @@ def test_pipe_wall_time(py):
 
     assert 0 < 0.8 * d < a < 2.2 * d
 
+    achieved, requested = (float(_) for _ in meta["rate"].split("/"))
+    assert requested == 1000 / interval, meta
+    assert 0 < achieved <= 1.1 * requested, meta
+
+    avg_jitter, max_jitter = (int(_) for _ in meta["jitter"].split(","))
+    assert 0 <= avg_jitter <= max_jitter, meta
+
+    # The caches miss on the first sample of each frame and hit afterwards.
+    hits, misses, _ = (int(_) for _ in meta["lru_cache"].split(","))
+    assert hits > 0 and misses > 0, meta
+
 
 @allpythons()
 def test_pipe_cpu_time(py):
@@ -75,6 +92,184 @@ def test_pipe_cpu_time(py):
     assert meta["interval"] == "1000", meta
 
 
+@allpythons()
+def test_pipe_budget(py):
+    result = austin("-PB", "1%", "-i", "10us", *python(py), target())
+    assert result.returncode == 0
+
+    meta = metadata(result.stdout)
+
+    assert meta["budget"] == "1.00%", meta
+    assert meta["interval"] == "10", meta
+
+    intervals = [
+        int(_.split(": ")[1])
+        for _ in result.stdout.splitlines()
+        if _.startswith("# effective_interval: ")
+    ]
+    assert intervals, meta
+    assert all(10 <= _ <= 1000000 for _ in intervals), intervals
+
+
+@allpythons()
+def test_pipe_aggregate(py):
+    result = austin("-PA", "1", "-i", "1ms", *python(py), target())
+    assert result.returncode == 0
+
+    meta = metadata(result.stdout)
+
+    assert "dropped" not in meta, meta
+
+    assert has_pattern(result.stdout, "target34.py:keep_cpu_busy:32")
+
+    a = sum_metric(result.stdout)
+    d = int(meta["duration"])
+
+    assert 0 < 0.8 * d < a < 2.2 * d
+
+    # Samples of the same stack are collapsed into a single line, so there
+    # should be far fewer lines than samples.
+    assert len(list(samples(result.stdout))) < a / 1000 / 5
+
+
+@allpythons()
+@pytest.mark.parametrize("policy", ["block", "drop", "spill"])
+def test_pipe_writer(py, policy):
+    result = austin("-PW", policy, "-i", "1ms", *python(py), target())
+    assert result.returncode == 0
+
+    meta = metadata(result.stdout)
+
+    assert "dropped_samples" not in meta, meta
+
+    assert has_pattern(result.stdout, "target34.py:keep_cpu_busy:32")
+
+    a = sum_metric(result.stdout)
+    d = int(meta["duration"])
+
+    assert 0 < 0.8 * d < a < 2.2 * d
+
+
+def throttled(variant, *args: str) -> tuple[int, str]:
+    """Run Austin and read its output slowly, so that the writer falls behind."""
+    if not variant.path.is_file():
+        pytest.skip(f"Variant '{variant}' not available")
+
+    output = bytearray()
+    with Popen([str(variant.path), *args], stdout=PIPE, stderr=PIPE) as process:
+        while chunk := process.stdout.read1(4096):
+            output += chunk
+            sleep(0.01)
+        process.wait()
+
+    return process.returncode, output.decode(errors="ignore")
+
+
+@pytest.mark.skipif(
+    platform.system() == "Windows", reason="The writer is not available on Windows"
+)
+@allpythons()
+def test_pipe_writer_drop_throttled(py):
+    returncode, output = throttled(
+        austin, "-PW", "drop", "-i", "100", *python(py), target()
+    )
+    assert returncode == 0
+
+    meta = metadata(output)
+
+    # Every sample is either in the output or reported as dropped.
+    dropped = sum(
+        int(_.partition(": ")[2])
+        for _ in output.splitlines()
+        if _.startswith("# dropped_samples: ")
+    )
+    assert dropped > 0, meta
+
+    _, total = (int(_) for _ in meta["errors"].split("/"))
+    assert len(list(samples(output))) + dropped == total, meta
+
+
+@pytest.mark.skipif(
+    platform.system() == "Windows", reason="The writer is not available on Windows"
+)
+@allpythons()
+def test_pipe_writer_spill_throttled(py):
+    returncode, output = throttled(
+        austin, "-PW", "spill", "-i", "100", *python(py), target()
+    )
+    assert returncode == 0
+
+    meta = metadata(output)
+
+    assert "dropped_samples" not in meta, meta
+
+    # No sample is lost while the output is spilling.
+    _, total = (int(_) for _ in meta["errors"].split("/"))
+    assert len(list(samples(output))) == total, meta
+
+    assert has_pattern(output, "target34.py:keep_cpu_busy:32")
+
+
+@allpythons()
+def test_pipe_deferred(py):
+    result = austin("-PDi", "1ms", *python(py), target())
+    assert result.returncode == 0
+
+    meta = metadata(result.stdout)
+
+    assert has_pattern(result.stdout, "target34.py:keep_cpu_busy:32")
+
+    a = sum_metric(result.stdout)
+    d = int(meta["duration"])
+
+    assert 0 < 0.8 * d < a < 2.2 * d
+
+    # Code objects that are freed before their frames are resolved, like those
+    # of modules that have finished importing, give invalid samples.
+    errors, total = (int(_) for _ in meta["errors"].split("/"))
+    assert errors <= 0.01 * total, meta
+
+
+@pytest.mark.skipif(
+    platform.system() == "Windows", reason="Thread run time not available on Windows"
+)
+@allpythons()
+def test_pipe_unchanged_stacks(py):
+    result = austin("-Pi", "1ms", *python(py), target("sleepy.py"))
+    assert result.returncode == 0
+
+    meta = metadata(result.stdout)
+
+    # The main thread spends most of its time sleeping, so most of its stacks
+    # are reused from the previous sample.
+    unchanged, total = (int(_) for _ in meta["unchanged"].split("/"))
+    assert unchanged >= 0.5 * total, meta
+
+    assert has_pattern(result.stdout, "sleepy.py:<module>:")
+    assert has_pattern(result.stdout, "sleepy.py:cpu_bound:")
+
+    a = sum_metric(result.stdout)
+    d = int(meta["duration"])
+
+    assert 0 < 0.8 * d < a < 2.2 * d
+
+
+@allpythons()
+def test_pipe_sleepless_idle_process(py):
+    result = austin("-sPi", "1ms", *python(py), target("sleepy.py"))
+    assert result.returncode == 0
+
+    meta = metadata(result.stdout)
+
+    # The samples taken while the process is sleeping are skipped altogether,
+    # and the time spent sleeping is not accounted for.
+    assert int(meta["skipped"]) > 0, meta
+
+    assert has_pattern(result.stdout, "sleepy.py:cpu_bound:")
+
+    assert sum_metric(result.stdout) < 0.5 * int(meta["duration"]), meta
+
+
 @allpythons()
 def test_pipe_wall_time_multiprocess(py):
     result = austin("-CPi", "1ms", *python(py), target())
@@ -88,6 +283,9 @@ def test_pipe_wall_time_multiprocess(py):
     assert meta["multiprocess"] == "on", meta
     assert ".".join((str(_) for _ in meta["python"])).startswith(py), meta
 
+    avg_discovery, max_discovery = (int(_) for _ in meta["discovery"].split(","))
+    assert 0 <= avg_discovery <= max_discovery, meta
+
 
 @allpythons()
 def test_pipe_wall_time_multiprocess_output(py, tmp_path):
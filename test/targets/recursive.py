@@ -1,3 +1,12 @@
+import sys
+
+# The recursion depth can be passed on the command line. The number of calls is
+# the same regardless of the depth.
+N = int(sys.argv[1]) if len(sys.argv) > 1 else 16
+
+sys.setrecursionlimit(max(sys.getrecursionlimit(), N + 100))
+
+
 def sum_up_to(n):
     if n <= 1:
         return 1
@@ -7,6 +16,5 @@ def sum_up_to(n):
     return result
 
 
-for _ in range(300000):
-    N = 16
+for _ in range((300000 * 16) // N):
     assert sum_up_to(N) == (N * (N + 1)) >> 1
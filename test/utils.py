@@ -40,8 +40,10 @@ from tempfile import gettempdir
 from test import PYTHON_VERSIONS
 from time import sleep
 from types import ModuleType
+from typing import BinaryIO
 from typing import Iterator
 from typing import List
+from typing import NamedTuple
 from typing import TypeVar
 from typing import Union
 
@@ -51,7 +53,6 @@ try:
 except ImportError:
     pytest = None
 
-from austin.format.mojo import MojoFile
 
 
 HERE = Path(__file__).parent
@@ -289,6 +290,19 @@ austin = Variant("austin")
 austinp = Variant("austinp")
 
 
+def austin_symbolize(*args: str, timeout: int = 60) -> CompletedProcess:
+    path = (Path("src") / "austin-symbolize").with_suffix(EXEEXT)
+    if not path.is_file():
+        path = Path("austin-symbolize").with_suffix(EXEEXT)
+    if not path.is_file():
+        pytest.skip("austin-symbolize not available")
+
+    result = run([str(path), *args], capture_output=True, timeout=timeout)
+    result.stderr = result.stderr.decode()
+
+    return result
+
+
 def run_async(command: list[str], *args: tuple[str], env: dict | None = None) -> Popen:
     return Popen(command + list(args), stdout=PIPE, stderr=PIPE, env=env)
 
@@ -409,11 +423,158 @@ def compress(data: str) -> str:
     return output
 
 
+class MojoFrame(NamedTuple):
+    key: int
+    filename: str
+    scope: str
+    line: int
+    line_end: int = 0
+    column: int = 0
+    column_end: int = 0
+
+
+# MOJO event IDs
+(
+    MOJO_RESERVED,
+    MOJO_METADATA,
+    MOJO_STACK,
+    MOJO_FRAME,
+    MOJO_FRAME_INVALID,
+    MOJO_FRAME_REF,
+    MOJO_FRAME_KERNEL,
+    MOJO_GC,
+    MOJO_IDLE,
+    MOJO_METRIC_TIME,
+    MOJO_METRIC_MEMORY,
+    MOJO_STRING,
+    MOJO_STRING_REF,
+    MOJO_STACK_DEF,
+    MOJO_STACK_REF,
+    MOJO_MAP,
+    MOJO_UNMAP,
+) = range(17)
+
+
+def _mojo_int(stream: BinaryIO) -> int:
+    (b,) = stream.read(1)
+    n, sign, shift = b & 0x3F, b & 0x40, 6
+    while b & 0x80:
+        (b,) = stream.read(1)
+        n |= (b & 0x7F) << shift
+        shift += 7
+    return -n if sign else n
+
+
+def _mojo_string(stream: BinaryIO) -> str:
+    buffer = bytearray()
+    while (c := stream.read(1)) != b"\0":
+        if not c:
+            raise EOFError("Unterminated MOJO string")
+        buffer += c
+    return buffer.decode(errors="replace")
+
+
+def parse_mojo(stream: BinaryIO) -> Iterator[tuple]:
+    """Parse a MOJO stream into a sequence of events.
+
+    Each event is a tuple whose first element is the event ID. References to
+    frames and stacks are resolved, so that a stack reference is returned as
+    the references to the frames of the stack. Stack keys are scoped to the
+    process of the sample that they occur in.
+    Strings are not returned as events since they are resolved too.
+    """
+    if stream.read(3) != b"MOJ":
+        raise ValueError("Not a MOJO stream")
+    version = _mojo_int(stream)
+
+    strings: dict[int, str] = {}
+    frames: dict[int, MojoFrame] = {}
+    stacks: dict[tuple[int, int], list[int]] = {}
+    pid = 0
+
+    while event := stream.read(1):
+        (e,) = event
+        if e == MOJO_METADATA:
+            yield e, _mojo_string(stream), _mojo_string(stream)
+        elif e == MOJO_STACK:
+            pid = _mojo_int(stream)
+            yield e, pid, _mojo_int(stream), _mojo_string(stream)
+        elif e == MOJO_FRAME:
+            key, filename, scope = (_mojo_int(stream) for _ in range(3))
+            location = [_mojo_int(stream) for _ in range(4 if version >= 3 else 1)]
+            frame = MojoFrame(key, strings[filename], strings[scope], *location)
+            frames[key] = frame
+            yield e, frame
+        elif e == MOJO_FRAME_REF:
+            yield e, frames[_mojo_int(stream)]
+        elif e == MOJO_FRAME_KERNEL:
+            yield e, _mojo_string(stream)
+        elif e in (MOJO_FRAME_INVALID, MOJO_GC, MOJO_IDLE):
+            yield (e,)
+        elif e in (MOJO_METRIC_TIME, MOJO_METRIC_MEMORY):
+            yield e, _mojo_int(stream)
+        elif e == MOJO_STRING:
+            key = _mojo_int(stream)
+            strings[key] = _mojo_string(stream)
+        elif e == MOJO_STRING_REF:
+            _mojo_int(stream)
+        elif e == MOJO_STACK_DEF:
+            key, size = _mojo_int(stream), _mojo_int(stream)
+            stacks[(pid, key)] = [_mojo_int(stream) for _ in range(size)]
+            yield e, key, [frames[_] for _ in stacks[(pid, key)]]
+        elif e == MOJO_STACK_REF:
+            for key in stacks[(pid, _mojo_int(stream))]:
+                yield MOJO_FRAME_REF, frames[key]
+        elif e == MOJO_MAP:
+            pid, lo, hi, base = (_mojo_int(stream) for _ in range(4))
+            yield e, pid, lo, hi, base, _mojo_string(stream), _mojo_string(stream)
+        elif e == MOJO_UNMAP:
+            yield e, *(_mojo_int(stream) for _ in range(3))
+        else:
+            raise ValueError(f"Unknown MOJO event {e}")
+
+
 def demojo(data: bytes) -> str:
     result = StringIO()
-
-    for e in MojoFile(BytesIO(data)).parse():
-        result.write(e.to_austin())
+    metrics: list[str] = []
+
+    def flush_metrics():
+        if metrics:
+            result.write(f" {','.join(metrics)}\n")
+            metrics.clear()
+
+    for e, *args in parse_mojo(BytesIO(data)):
+        if e == MOJO_METADATA:
+            flush_metrics()
+            result.write(f"# {args[0]}: {args[1]}\n")
+        elif e == MOJO_STACK:
+            flush_metrics()
+            pid, iid, tid = args
+            result.write(f"P{pid};T{iid}:{int(tid, 16)}")
+        elif e == MOJO_FRAME_REF:
+            (frame,) = args
+            result.write(f";{frame.filename}:{frame.scope}:{frame.line}")
+        elif e == MOJO_FRAME_KERNEL:
+            result.write(f";kernel:{args[0]}:0")
+        elif e == MOJO_FRAME_INVALID:
+            result.write(";:INVALID:")
+        elif e == MOJO_GC:
+            result.write(";:GC:")
+        elif e == MOJO_METRIC_TIME:
+            metrics.append(str(args[0]))
+        elif e == MOJO_IDLE:
+            metrics.append("1")
+        elif e == MOJO_MAP:
+            flush_metrics()
+            _, lo, hi, _, path, _ = args
+            result.write(f"# map: {lo:x}-{hi:x} {path}\n")
+        elif e == MOJO_METRIC_MEMORY:
+            if len(metrics) == 1:
+                # Full metrics, with the idle flag unset
+                metrics.append("0")
+            metrics.append(str(args[0]))
+
+    flush_metrics()
 
     return result.getvalue()
 